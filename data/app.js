@@ -6,6 +6,8 @@
 let lastData = {};
 let lastFeatures = null;
 let sessionHistory = []; // 用於儲存本次連線的歷史數據
+let streamActive = false; // 伺服器端連續取樣是否進行中 (依 stream_stats 更新)
+const STREAM_HZ = 5;      // 連續取樣的要求取樣率
 
 function bindActions() {
     console.log("Binding actions...");
@@ -102,6 +104,39 @@ function bindActions() {
             window.location.href = '/datalog.csv';
         };
     }
+    const btnSeriesDl = el('btnSeriesDownload');
+    if (btnSeriesDl) {
+        btnSeriesDl.onclick = () => {
+            window.location.href = '/series.csv';
+        };
+    }
+    // 目前電池的歷史紀錄 (MCU 端依 ROM ID 索引)
+    const btnHistoryDl = el('btnHistoryDownload');
+    if (btnHistoryDl) {
+        btnHistoryDl.onclick = () => {
+            if (!lastData || !lastData.rom_id) {
+                alert(t('err_no_rom'));
+                return;
+            }
+            window.location.href = `/api/history?rom=${encodeURIComponent(lastData.rom_id)}`;
+        };
+    }
+    // 所有讀取過的電池的統計 (MCU 端隨每次讀取更新)
+    const btnFleet = el('btnFleetStats');
+    if (btnFleet) {
+        btnFleet.onclick = () => {
+            window.open('/api/fleet', '_blank');
+        };
+    }
+    const btnFleetClear = el('btnFleetClear');
+    if (btnFleetClear) {
+        btnFleetClear.onclick = async () => {
+            if (confirm(t('confirm_clear_fleet'))) {
+                await fetch('/api/fleet_clear');
+                alert(t('fleet_cleared_success'));
+            }
+        };
+    }
 
     // 7. 刪除 MCU 紀錄
     const btnMcuDel = el('btnMcuDelete');
@@ -127,6 +162,60 @@ function bindActions() {
             }, 500);
         };
     }
+
+    // 9. 連續取樣 (按鈕狀態以伺服器回報的 stream_stats 為準)
+    const btnStream = el('btnStream');
+    if (btnStream) {
+        btnStream.classList.add('btn-gray');
+        btnStream.onclick = () => {
+            if (streamActive) {
+                log(`${t('streamStop')}...`);
+                WSClient.send('stream_stop');
+            } else {
+                log(`${t('streamStart')}...`);
+                WSClient.send('stream_start', { hz: STREAM_HZ });
+            }
+        };
+    }
+
+    // 10. 負載測試 (需硬體繼電器；負載電阻值記在瀏覽器中)
+    const btnLoadTest = el('btnLoadTest');
+    if (btnLoadTest) {
+        btnLoadTest.classList.add('btn-gray');
+        btnLoadTest.onclick = () => {
+            const saved = localStorage.getItem('loadMohm') || '500';
+            const input = prompt(t('load_test_prompt'), saved);
+            const loadMohm = parseInt(input, 10);
+            if (!(loadMohm > 0)) return;
+            localStorage.setItem('loadMohm', String(loadMohm));
+            setButtonLoading('btnLoadTest', true, 'testing');
+            log(`${t('loadTest')}... (${loadMohm} mΩ)`);
+            WSClient.send('load_test', { load_mohm: loadMohm });
+        };
+    }
+}
+
+// 連續取樣狀態變更：切換按鈕文字與顏色
+function setStreamState(active) {
+    streamActive = active;
+    const btn = el('btnStream');
+    if (!btn) return;
+    const key = active ? 'streamStop' : 'streamStart';
+    btn.setAttribute('data-lang-key', key);
+    btn.textContent = t(key);
+    if (!btn.disabled) {
+        btn.classList.remove('btn-blue', 'btn-red', 'btn-gray');
+        btn.classList.add(active ? 'btn-red' : 'btn-blue');
+    }
+}
+
+// 有歷史數據後啟用匯出按鈕 (變藍色)
+function markExportReady() {
+    const btnExport = el('btnExport');
+    if (btnExport && sessionHistory.length > 0) {
+        btnExport.classList.remove('btn-gray');
+        btnExport.classList.add('btn-blue');
+    }
 }
 
 // --- 主題切換邏輯 ---
@@ -180,40 +269,42 @@ window.addEventListener('load', async () => {
     }
 });
 
-// 新增：集中計算衍生數據 (SOH, 顏色狀態)，避免重複邏輯
+// 異常旗標的語言鍵 (依位元順序，需與 src/Analytics.h 的 AnomalyFlag 一致)
+const ANOMALY_KEYS = [
+    'anomaly_cell_imbalance', 'anomaly_imbalance_rising', 'anomaly_cell_low', 'anomaly_cell_high',
+    'anomaly_over_temp', 'anomaly_thermal_spread', 'anomaly_pack_mismatch', 'anomaly_locked',
+    'anomaly_fuse_blown', 'anomaly_error_counts', 'anomaly_low_soh'
+];
+
+// 衍生顯示資料：SOH、壓差趨勢、溫差與異常旗標都由裝置端 (Analytics) 計算，這裡只決定顏色與文字
 function calculateDerivedData(data) {
-    // 1. SOH 計算
-    const cycles = Number(data.charge_cycles) || 0;
-    const overDis = Number(data.over_discharge) || 0;
-    const overLoad = Number(data.over_load) || 0;
-    const err04 = Number(data.err_cnt_04) || 0; // 過放錯誤 (嚴重)
-    const err05 = Number(data.err_cnt_05) || 0; // 過熱錯誤 (嚴重)
-    const err06 = Number(data.err_cnt_06) || 0; // 充電錯誤 (嚴重)
-    const err07 = Number(data.err_cnt_07) || 0; // 過流錯誤 (嚴重)
-
-    // 優化後的 SOH 算法：
-    // 1. 循環次數：每 100 次扣 5% (假設壽命 2000 次)
-    // 2. 過放紀錄 (歷史)：每 10 次扣 1% (這是正常使用耗損，權重降低)
-    // 3. 過載紀錄 (歷史)：每 10 次扣 1%
-    // 4. 錯誤計數 (嚴重)：每個錯誤扣 20% (這些才是導致鎖定的主因)
-    let soh = 100;
-    soh -= cycles * 0.05;
-    soh -= overDis * 0.1;
-    soh -= overLoad * 0.1;
-    soh -= (err04 + err05 + err06 + err07) * 20;
-
-    if (soh < 0) soh = 0;
-
-    data.health_soh = soh.toFixed(0); // 注入字串
-    data._sohColor = soh > 85 ? 'var(--success)' :
-        soh > 60 ? 'var(--warning)' : // 改用變數
-            'var(--warn)';
+    // 1. SOH 顏色
+    if (data.health_pct !== undefined) {
+        const soh = Number(data.health_pct) || 0;
+        data.health_soh = String(soh);
+        data._sohColor = soh > 85 ? 'var(--success)' :
+            soh > 60 ? 'var(--warning)' : // 改用變數
+                'var(--warn)';
+    }
 
     // 2. 鎖定狀態顏色
     data._lockColor = 'inherit';
     // lock_status 現在是數字：0=正常(綠), >0=鎖定(紅)
     if (data.lock_status > 0) data._lockColor = 'var(--warn)';
     else data._lockColor = 'var(--success)';
+
+    // 3. 壓差平均與趨勢 (正值代表不平衡在擴大)
+    if (data.cell_diff_ewma_mv !== undefined) {
+        const trend = Number(data.cell_diff_trend_mv) || 0;
+        data.cell_diff_trend_text = `${data.cell_diff_ewma_mv} mV (${trend >= 0 ? '+' : ''}${trend})`;
+    }
+
+    // 4. 異常旗標
+    if (data.anomalies !== undefined) {
+        const active = ANOMALY_KEYS.filter((k, bit) => data.anomalies & (1 << bit));
+        data.anomaly_text = active.length ? active.map(k => t(k)).join(', ') : t('anomaly_none');
+        data._anomalyColor = active.length ? 'var(--warn)' : 'var(--success)';
+    }
 }
 
 // 數據表格渲染 (請對齊 Langs_TW.js 的 Key)
@@ -284,7 +375,7 @@ function renderAdvancedData(data) {
             const unitText = (typeof t === 'function') ? t(unitKey) : unitKey;
 
             // 修正：針對溫度欄位，格式化為小數點後一位
-            if (key === 'temp1' || key === 'temp2' || key === 'temp3') {
+            if (key === 'temp1' || key === 'temp2' || key === 'temp3' || key === 'thermal_spread') {
                 displayVal = `${parseFloat(val).toFixed(1)} ${unitText}`;
             } else {
                 displayVal = `${val} ${unitText}`;
@@ -314,14 +405,27 @@ function renderAdvancedData(data) {
     console.log("收到的 data:", data);
 }
 
+// 裝置端一律傳送 BMS 回報的整數單位 (mV、0.01°C)，只在瀏覽器換算成顯示用的 V / °C
+function fromDeviceUnits(data) {
+    if (!data) return data;
+    if (data.pack_mv !== undefined) data.pack_voltage = data.pack_mv / 1000;
+    if (Array.isArray(data.cell_mv)) data.cell_voltages = data.cell_mv.map(mv => mv / 1000);
+    if (data.cell_diff_mv !== undefined) data.cell_diff = data.cell_diff_mv / 1000;
+    ['temp1', 'temp2', 'temp3', 'thermal_spread'].forEach(k => {
+        if (data[k + '_centi'] !== undefined) data[k] = data[k + '_centi'] / 100;
+    });
+    return data;
+}
 
 function handleMessage(event) {
     try {
-        const msg = JSON.parse(event.data);
+        // 二進位遙測幀已由 ws_client.js 解碼為物件
+        const msg = typeof event.data === 'string' ? JSON.parse(event.data) : event.data;
         let dataSummary = "";
+        fromDeviceUnits(msg.data);
 
         // 優化：忽略 presence 和 pong 訊息，避免干擾日誌
-        if (msg.type === 'presence' || msg.type === 'pong') return;
+        if (msg.type === 'presence' || msg.type === 'pong' || msg.type === 'hello') return;
 
         // --- 新增：處理後端回傳的狀態訊息 (結果與錯誤) ---
         if (msg.type === 'success') {
@@ -347,6 +451,48 @@ function handleMessage(event) {
             if (usedEl) usedEl.textContent = usedKB;
             if (totalEl) totalEl.textContent = totalKB;
             log(`ℹ️ 檔案系統: 已使用 ${usedKB}KB / 共 ${totalKB}KB`);
+            if (msg.heap_free !== undefined) {
+                log(`ℹ️ Heap: ${(msg.heap_free / 1024).toFixed(1)}KB (最低 ${(msg.heap_min / 1024).toFixed(1)}KB, 最大區塊 ${(msg.heap_max_block / 1024).toFixed(1)}KB, 碎片 ${msg.heap_frag}%)`);
+            }
+            if (msg.log_records !== undefined) {
+                log(`ℹ️ MCU 紀錄: ${msg.log_records}/${msg.log_capacity} 筆, 寫入 平均 ${msg.log_append_avg_us}µs / 最大 ${msg.log_append_max_us}µs`);
+                if (msg.log_pending !== undefined) {
+                    log(`ℹ️ MCU 紀錄暫存: ${msg.log_pending} 筆待寫入, 提交 平均 ${msg.log_commit_avg_us}µs / 最大 ${msg.log_commit_max_us}µs`);
+                }
+                if (msg.series_samples !== undefined) {
+                    const perSample = msg.series_samples ? (msg.series_bytes / msg.series_samples).toFixed(2) : '-';
+                    log(`ℹ️ 時序紀錄: ${msg.series_samples} 筆, ${msg.series_blocks}/${msg.series_capacity} 區塊, ${perSample}B/筆`);
+                }
+            }
+            return;
+        } else if (msg.type === 'log_benchmark') {
+            ['ring', 'legacy'].forEach(k => {
+                const r = msg[k];
+                log(`ℹ️ Log benchmark ${k}: 平均 ${r.avg_us}µs, 最大 ${r.max_us}µs, 寫入 ${r.bytes_written}B / 讀取 ${r.bytes_read}B 每筆 (${msg.samples} 筆)`);
+            });
+            if (msg.series) {
+                const s = msg.series;
+                log(`ℹ️ Log benchmark series: ${(s.bytes / s.samples).toFixed(2)}B/筆 (固定紀錄 ${s.record_bytes}B), 編碼 ${s.encode_ns}ns/筆, 解碼 ${s.decode_per_sec}筆/s, 不符 ${s.mismatches} (${s.samples} 筆)`);
+            }
+            return;
+        } else if (msg.type === 'stream_stats') {
+            setStreamState(msg.active);
+            if (msg.samples > 0) {
+                log(`ℹ️ Stream: ${(msg.achieved_centi_hz / 100).toFixed(2)}/${msg.hz} Hz, ${msg.samples} 筆, 抖動 平均 ${msg.jitter_avg_us}µs / 最大 ${msg.jitter_max_us}µs, 遺失 ${msg.dropped + msg.net_dropped}, 錯過時槽 ${msg.missed}`);
+            }
+            return;
+        } else if (msg.type === 'load_test') {
+            // 各電芯結果已由後端逐行寫入日誌，這裡只補總結
+            const amps = (msg.current_ma / 1000).toFixed(2);
+            const packIr = (msg.pack_ir_uohm / 1000).toFixed(1);
+            log(`ℹ️ ${t('loadTest')}: ${msg.pack_rest_mv}mV → ${msg.pack_loaded_mv}mV @ ${amps}A, IR ${packIr}mΩ (${msg.samples} @ ${msg.hz}Hz)`);
+            return;
+        } else if (msg.type === 'stream_sample') {
+            // 連續取樣：只更新畫面與歷史 (不寫日誌、不重置按鈕，避免每秒數筆洗版)
+            lastData = { ...lastData, ...msg.data };
+            renderUI(lastData, lastFeatures, 'dynamic_data');
+            sessionHistory.push({ ts: getFormattedTimestamp(), ...lastData });
+            markExportReady();
             return;
         }
         // ------------------------------------------------
@@ -413,11 +559,7 @@ function handleMessage(event) {
             });
 
             // 更新匯出按鈕狀態 (有數據變藍色)
-            const btnExport = el('btnExport');
-            if (btnExport && sessionHistory.length > 0) {
-                btnExport.classList.remove('btn-gray');
-                btnExport.classList.add('btn-blue');
-            }
+            markExportReady();
             // ----------------------------------
         }
         // 在介面運行日誌顯示
@@ -504,6 +646,9 @@ function updateButtonStates(features, shouldShowAdvanced) {
     // 3. 更新按鈕 2 (更新數據) 的狀態
     // 按鍵 2：可用時變藍色
     setBtnState(btnReadDynamic, 'btn-blue', features.read_dynamic);
+    // 連續取樣與更新數據使用同一個 0xD7 讀取，可用條件相同
+    setBtnState(el('btnStream'), streamActive ? 'btn-red' : 'btn-blue', features.read_dynamic);
+    setBtnState(el('btnLoadTest'), 'btn-red', features.load_test);
 
     // 4. 控制下方服務區塊 (清除故障/LED) 的顯示
     if (serviceBlock) {
@@ -681,7 +826,7 @@ function setButtonLoading(id, isLoading, langKey) {
 }
 
 function resetAllButtons() {
-    ['btnReadStatic', 'btnReadDynamic', 'btnClearErrors', 'btnLed'].forEach(id => setButtonLoading(id, false));
+    ['btnReadStatic', 'btnReadDynamic', 'btnClearErrors', 'btnLed', 'btnLoadTest'].forEach(id => setButtonLoading(id, false));
 }
 
 function updateStatusText(key) { const s = el('statusText'); if (s) s.textContent = t(key); }
\ No newline at end of file
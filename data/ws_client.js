@@ -2,11 +2,100 @@
  * WebSocket Client Module
  * 負責處理連線生命週期、自動重連、狀態顯示與指令發送
  */
+/**
+ * 二進位遙測幀 (須與 src/Telemetry.h 的欄位表保持一致)
+ * [0]=0xD7 [1]=版本 [2]=旗標 [3..6]=欄位遮罩 (LE) [7..]=依欄位順序的數值 (LE)
+ * 連續取樣幀 (FLAG_STREAM) 在 [7..10] 多一個取樣時間戳 t_us (裝置 micros())
+ */
+const TELEMETRY_VERSION = 2;
+const TELEMETRY_FRAME_DYNAMIC = 0xD7;
+const TELEMETRY_FLAG_KEYFRAME = 0x02; // 完整幀；否則為只含變動欄位的差異幀
+const TELEMETRY_FLAG_STREAM = 0x04;   // 連續取樣幀 (stream_start 訂閱的欄位)
+const TELEMETRY_FIELDS = [
+    { key: 'pack_mv', size: 2 },
+    { key: 'cell_mv', index: 0, size: 2 },
+    { key: 'cell_mv', index: 1, size: 2 },
+    { key: 'cell_mv', index: 2, size: 2 },
+    { key: 'cell_mv', index: 3, size: 2 },
+    { key: 'cell_mv', index: 4, size: 2 },
+    { key: 'cell_diff_mv', size: 2 },
+    { key: 'temp1_centi', size: 2, signed: true },
+    { key: 'temp2_centi', size: 2, signed: true },
+    { key: 'temp3_centi', size: 2, signed: true },
+    { key: 'charge_cycles', size: 2 },
+    { key: 'over_discharge', size: 1 },
+    { key: 'over_load', size: 1 },
+    { key: 'err_cnt_04', size: 1 },
+    { key: 'err_cnt_05', size: 1 },
+    { key: 'err_cnt_06', size: 1 },
+    { key: 'err_cnt_07', size: 1 },
+    { key: 'fuse_blown', size: 1 },
+    { key: 'lock_status', size: 1 },
+    { key: 'status_code', size: 2 },
+    { key: 'fw_ver', size: 1 },
+    { key: 'health_pct', size: 1 },
+    { key: 'remaining_capacity', size: 2 },
+    { key: 'full_capacity', size: 2 },
+    { key: 'cell_diff_ewma_mv', size: 2 },
+    { key: 'cell_diff_trend_mv', size: 2, signed: true },
+    { key: 'thermal_spread_centi', size: 2 },
+    { key: 'anomalies', size: 2 }
+];
+
+// 將二進位幀解回與 JSON 相同的 { type, data } 結構；格式不符時回傳 null
+function decodeTelemetryFrame(buffer) {
+    const view = new DataView(buffer);
+    if (view.byteLength < 7 || view.getUint8(0) !== TELEMETRY_FRAME_DYNAMIC || view.getUint8(1) !== TELEMETRY_VERSION) {
+        return null;
+    }
+    const flags = view.getUint8(2);
+    const mask = view.getUint32(3, true);
+    const data = {};
+    let pos = 7;
+    if (flags & TELEMETRY_FLAG_STREAM) {
+        if (view.byteLength < 11) return null;
+        data.t_us = view.getUint32(7, true);
+        pos = 11;
+    }
+    for (let i = 0; i < TELEMETRY_FIELDS.length; i++) {
+        if (!(mask & (1 << i))) continue;
+        const f = TELEMETRY_FIELDS[i];
+        if (pos + f.size > view.byteLength) return null;
+        const v = f.size === 2
+            ? (f.signed ? view.getInt16(pos, true) : view.getUint16(pos, true))
+            : view.getUint8(pos);
+        pos += f.size;
+        if (f.index !== undefined) {
+            (data[f.key] = data[f.key] || [])[f.index] = v;
+        } else {
+            data[f.key] = v;
+        }
+    }
+    const type = (flags & TELEMETRY_FLAG_STREAM) ? 'stream_sample' : 'dynamic_data';
+    return { type, data, flags, mask };
+}
+
+// 將差異幀套用到目前的遙測狀態 (完整幀則整份取代)，回傳合併後的完整數據
+function applyTelemetryFrame(state, frame) {
+    const next = (frame.flags & TELEMETRY_FLAG_KEYFRAME) ? {} : { ...state };
+    for (const [key, value] of Object.entries(frame.data)) {
+        if (Array.isArray(value)) {
+            const arr = Array.isArray(next[key]) ? next[key].slice() : [];
+            value.forEach((v, i) => { if (v !== undefined) arr[i] = v; });
+            next[key] = arr;
+        } else {
+            next[key] = value;
+        }
+    }
+    return next;
+}
+
 const WSClient = {
     ws: null,
     messageHandler: null,
     openHandler: null,
     heartbeatInterval: null,
+    telemetry: {}, // 二進位差異幀累積出的目前數值
 
     // 初始化並開始連線
     init(options) {
@@ -18,16 +107,29 @@ const WSClient = {
     connect() {
         this.updateStatus('ws_connecting', 'status-warn');
         this.ws = new WebSocket(`ws://${location.host}/ws`);
+        this.ws.binaryType = 'arraybuffer';
+        this.telemetry = {}; // 重新連線後伺服器會先送完整幀
         
         this.ws.onopen = () => {
             console.log("WebSocket 已連線");
             this.updateStatus('ws_connected', 'status-ok');
+            // 協商二進位遙測格式 (伺服器不支援時維持 JSON)
+            this.send('hello', { binary: TELEMETRY_VERSION });
             if (this.openHandler) this.openHandler();
             this.startHeartbeat();
         };
 
         this.ws.onmessage = (event) => {
-            if (this.messageHandler) this.messageHandler(event);
+            if (!this.messageHandler) return;
+            if (event.data instanceof ArrayBuffer) {
+                const frame = decodeTelemetryFrame(event.data);
+                if (!frame) return;
+                this.telemetry = applyTelemetryFrame(this.telemetry, frame);
+                // 交給 app.js 的是合併後的完整數據，與 JSON 路徑相同
+                this.messageHandler({ data: { type: frame.type, data: { ...this.telemetry } } });
+                return;
+            }
+            this.messageHandler(event);
         };
 
         this.ws.onclose = () => {
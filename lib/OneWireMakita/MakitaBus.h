@@ -0,0 +1,74 @@
+// lib/OneWireMakita/MakitaBus.h
+
+#ifndef MakitaBus_h
+#define MakitaBus_h
+
+#include <Arduino.h>
+#include "OneWireTiming.h"
+
+// Makita 匯流排抽象介面：MakitaBMS 只透過此介面通訊，
+// 具體時序由後端 (GPIO bit-bang / RMT 週邊) 實作。
+class MakitaBus
+{
+  protected:
+    uint16_t _gapUs = 90;          // 位元組之間的間隔 (µs)
+    uint32_t _lastTransactUs = 0;  // 最近一次 transact() 的匯流排耗時 (µs)
+    uint32_t _lastPulseUs = 0;     // 最近一次 readRegisters() 的脈衝總長 (µs，耗時的理論下限)
+
+  public:
+    virtual ~MakitaBus() {}
+
+    // 初始化硬體 (於 setup 階段呼叫，而非全域建構時)
+    virtual bool begin(void) { return true; }
+
+    // 匯流排重置，回傳是否收到存在脈衝
+    virtual bool reset(void) = 0;
+
+    // 單一位元組收發 (無位元組間隔)
+    virtual void write(uint8_t v) = 0;
+    virtual uint8_t read(void) = 0;
+
+    // 區塊收發：每個位元組之後等待 interByteGap()
+    virtual void writeBytes(const uint8_t *buf, size_t len) = 0;
+    virtual void readBytes(uint8_t *buf, size_t len) = 0;
+
+    void setInterByteGap(uint16_t us) { _gapUs = us; }
+    uint16_t interByteGap() const { return _gapUs; }
+
+    // 先寫入指令再讀取回應 (不含 reset)，並記錄總耗時
+    void transact(const uint8_t *cmd, size_t cmd_len, uint8_t *rsp, size_t rsp_len)
+    {
+        uint32_t start = micros();
+        if (cmd != nullptr) writeBytes(cmd, cmd_len);
+        if (rsp != nullptr) readBytes(rsp, rsp_len);
+        _lastTransactUs = micros() - start;
+    }
+    uint32_t lastTransactMicros() const { return _lastTransactUs; }
+    uint32_t lastPulseMicros() const { return _lastPulseUs; }
+
+    // 暫存器快照：對清單中每個位址執行 reset + prefix + 位址 + 讀 1 位元組，
+    // 結果依清單順序寫入 out (無存在脈衝時為 0xFF)，並記錄總耗時與脈衝總長。
+    // 後端可覆寫為整份清單一次硬體傳輸 (見 OneWireMakitaRMT)；bit-bang 逐個暫存器執行。
+    virtual void readRegisters(uint8_t prefix, const uint8_t *regs, size_t count, uint8_t *out)
+    {
+        uint32_t start = micros();
+        uint32_t pulse_us = 0;
+        BusPulse pulses[MakitaTiming::REGISTER_READ_PULSES];
+        for (size_t i = 0; i < count; i++)
+        {
+            pulse_us += pulseTrainUs(pulses, encodeRegisterRead(prefix, regs[i], pulses));
+            if (!reset())
+            {
+                out[i] = 0xFF;
+                continue;
+            }
+            write(prefix);
+            write(regs[i]);
+            out[i] = read();
+        }
+        _lastTransactUs = micros() - start;
+        _lastPulseUs = pulse_us;
+    }
+};
+
+#endif
@@ -19,6 +19,7 @@ OneWireMakita::OneWireMakita(uint8_t pin) {
 
 // 總線重設的實現
 bool OneWireMakita::reset(void) {
+    const BusPulse p = encodeReset();
     digitalWrite(_pin, HIGH);
     pinMode(_pin, INPUT); // 暫時切換到輸入端，檢查匯流排是否繁忙
     uint8_t retries = 125;
@@ -33,48 +34,100 @@ bool OneWireMakita::reset(void) {
     digitalWrite(_pin, LOW); // 發送重設脈衝
     portEXIT_CRITICAL(&oneWireMux);
 
-    delayMicroseconds(750); // 重置脈衝持續時間
+    delayMicroseconds(p.low_us); // 重置脈衝持續時間
 
     portENTER_CRITICAL(&oneWireMux);
     digitalWrite(_pin, HIGH); // 鬆開EN
-    delayMicroseconds(70);    // 等待電池管理系統回應
+    delayMicroseconds(MakitaTiming::PRESENCE_SAMPLE_US); // 等待電池管理系統回應
     uint8_t r = !digitalRead(_pin); // 讀取存在脈衝訊號（線路應拉至低）
     portEXIT_CRITICAL(&oneWireMux);
 
-    delayMicroseconds(410); // 剩餘時段
+    delayMicroseconds(p.high_us - MakitaTiming::PRESENCE_SAMPLE_US); // 剩餘時段
     return r;
 }
 
+// 脈衝執行 (呼叫端負責臨界區)
+void OneWireMakita::writePulse(const BusPulse &p) {
+    digitalWrite(_pin, LOW); delayMicroseconds(p.low_us);
+    digitalWrite(_pin, HIGH); delayMicroseconds(p.high_us);
+}
+
+bool OneWireMakita::readSlot(const BusPulse &p) {
+    digitalWrite(_pin, LOW); delayMicroseconds(p.low_us);
+    digitalWrite(_pin, HIGH); delayMicroseconds(MakitaTiming::READ_SAMPLE_US);
+    bool bit = digitalRead(_pin);
+    delayMicroseconds(p.high_us - MakitaTiming::READ_SAMPLE_US);
+    return bit;
+}
+
 // 位元組記錄的實作（位元）
 void OneWireMakita::write(uint8_t v) {
-    for (uint8_t bitMask = 0x01; bitMask; bitMask <<= 1) {
+    BusPulse pulses[MakitaTiming::BITS_PER_BYTE];
+    encodeWriteByte(v, pulses);
+    for (const BusPulse &p : pulses) {
+        // 只有低電位區段需要精確時序，恢復時段在臨界區外等待
         portENTER_CRITICAL(&oneWireMux);
-        if ((bitMask & v)) { // 記錄“1”
-            digitalWrite(_pin, LOW); delayMicroseconds(12);
-            digitalWrite(_pin, HIGH);
-            portEXIT_CRITICAL(&oneWireMux);
-            delayMicroseconds(120);
-        } else { // 記錄“0”
-            digitalWrite(_pin, LOW); delayMicroseconds(100);
-            digitalWrite(_pin, HIGH);
-            portEXIT_CRITICAL(&oneWireMux);
-            delayMicroseconds(30);
-        }
+        digitalWrite(_pin, LOW); delayMicroseconds(p.low_us);
+        digitalWrite(_pin, HIGH);
+        portEXIT_CRITICAL(&oneWireMux);
+        delayMicroseconds(p.high_us);
     }
 }
 
 // 實作位元讀取位元組
 uint8_t OneWireMakita::read() {
+    BusPulse slots[MakitaTiming::BITS_PER_BYTE];
+    encodeReadByte(slots);
     uint8_t r = 0;
-    for (uint8_t bitMask = 0x01; bitMask; bitMask <<= 1) {
+    for (uint8_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++) {
         portENTER_CRITICAL(&oneWireMux);
-        digitalWrite(_pin, LOW); delayMicroseconds(10);
-        digitalWrite(_pin, HIGH); delayMicroseconds(10);
+        digitalWrite(_pin, LOW); delayMicroseconds(slots[i].low_us);
+        digitalWrite(_pin, HIGH); delayMicroseconds(MakitaTiming::READ_SAMPLE_US);
         if (digitalRead(_pin)) {
-            r |= bitMask;
+            r |= (1 << i);
         }
         portEXIT_CRITICAL(&oneWireMux);
-        delayMicroseconds(53);
+        delayMicroseconds(slots[i].high_us - MakitaTiming::READ_SAMPLE_US);
+    }
+    return r;
+}
+
+// 整個位元組在同一個臨界區內寫出
+void OneWireMakita::writeByteCritical(uint8_t v) {
+    BusPulse pulses[MakitaTiming::BITS_PER_BYTE];
+    encodeWriteByte(v, pulses);
+    portENTER_CRITICAL(&oneWireMux);
+    for (const BusPulse &p : pulses) {
+        writePulse(p);
+    }
+    portEXIT_CRITICAL(&oneWireMux);
+}
+
+// 整個位元組在同一個臨界區內讀入
+uint8_t OneWireMakita::readByteCritical() {
+    BusPulse slots[MakitaTiming::BITS_PER_BYTE];
+    encodeReadByte(slots);
+    uint8_t r = 0;
+    portENTER_CRITICAL(&oneWireMux);
+    for (uint8_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++) {
+        if (readSlot(slots[i])) {
+            r |= (1 << i);
+        }
     }
+    portEXIT_CRITICAL(&oneWireMux);
     return r;
-}
\ No newline at end of file
+}
+
+void OneWireMakita::writeBytes(const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        writeByteCritical(buf[i]);
+        if (_gapUs) delayMicroseconds(_gapUs);
+    }
+}
+
+void OneWireMakita::readBytes(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = readByteCritical();
+        if (_gapUs) delayMicroseconds(_gapUs);
+    }
+}
@@ -4,25 +4,43 @@
 #define OneWireMakita_h
 
 #include <Arduino.h>
+#include "MakitaBus.h"
+#include "OneWireTiming.h"
 
 // Класс для реализации модифицированного протокола OneWire для Makita
-class OneWireMakita
+// (GPIO bit-bang 後端，時序來自 OneWireTiming.h)
+class OneWireMakita : public MakitaBus
 {
   private:
     gpio_num_t _pin; // Номер GPIO пина, используемого для шины
 
+    // 執行一個寫入脈衝
+    void writePulse(const BusPulse &p);
+    // 執行一個讀取時槽並回傳取樣到的位元
+    bool readSlot(const BusPulse &p);
+
+    // 單一位元組收發：整個位元組只進出一次臨界區
+    void writeByteCritical(uint8_t v);
+    uint8_t readByteCritical(void);
+
   public:
     // Конструктор, принимает номер пина
     OneWireMakita(uint8_t pin);
     
     // Выполняет сброс шины и ждет ответа (импульса присутствия)
-    bool reset(void);
+    bool reset(void) override;
 
     // Отправляет один байт данных на шину
-    void write(uint8_t v);
+    void write(uint8_t v) override;
 
     // Читает один байт данных с шины
-    uint8_t read(void);
+    uint8_t read(void) override;
+
+    // --- 區塊收發 ---
+    // 每個位元組只進出一次臨界區 (中斷關閉時間上限約為一個位元組：寫 ~1.1ms / 讀 ~0.6ms)，
+    // 位元組之後再等待可設定的間隔。
+    void writeBytes(const uint8_t *buf, size_t len) override;
+    void readBytes(uint8_t *buf, size_t len) override;
 };
 
-#endif
\ No newline at end of file
+#endif
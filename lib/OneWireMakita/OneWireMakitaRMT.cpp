@@ -0,0 +1,134 @@
+// lib/OneWireMakita/OneWireMakitaRMT.cpp
+
+#include "OneWireMakitaRMT.h"
+#include <driver/gpio.h>
+#include <esp_rom_gpio.h>
+#include <soc/gpio_sig_map.h>
+
+// RMT 時脈：APB 80MHz / 80 = 1 tick 為 1µs，時序表可直接使用
+static const uint8_t RMT_CLK_DIV = 80;
+// 線路閒置超過此時間即視為一個擷取框結束 (需大於時序表中最長的高電位區段)
+static const uint16_t RMT_RX_IDLE_US = 600;
+// 擷取等待上限
+static const TickType_t RMT_RX_TIMEOUT = pdMS_TO_TICKS(10);
+
+OneWireMakitaRMT::OneWireMakitaRMT(uint8_t pin, rmt_channel_t tx_channel, rmt_channel_t rx_channel)
+    : _pin((gpio_num_t)pin), _txCh(tx_channel), _rxCh(rx_channel)
+{
+}
+
+bool OneWireMakitaRMT::begin(void) {
+    if (_ready) return true;
+
+    rmt_config_t tx = RMT_DEFAULT_CONFIG_TX(_pin, _txCh);
+    tx.clk_div = RMT_CLK_DIV;
+    tx.tx_config.idle_output_en = true;
+    tx.tx_config.idle_level = RMT_IDLE_LEVEL_HIGH; // 閒置時釋放匯流排
+    if (rmt_config(&tx) != ESP_OK || rmt_driver_install(_txCh, 0, 0) != ESP_OK) return false;
+
+    rmt_config_t rx = RMT_DEFAULT_CONFIG_RX(_pin, _rxCh);
+    rx.clk_div = RMT_CLK_DIV;
+    rx.rx_config.idle_threshold = RMT_RX_IDLE_US;
+    rx.rx_config.filter_en = true;
+    rx.rx_config.filter_ticks_thresh = 30; // 濾除 < ~0.4µs 的雜訊 (單位為 APB tick)
+    rx.mem_block_num = RX_MEM_BLOCKS;
+    if (rmt_config(&rx) != ESP_OK ||
+        rmt_driver_install(_rxCh, 2 * RX_MEM_BLOCKS * 64 * sizeof(rmt_item32_t), 0) != ESP_OK) return false;
+    rmt_get_ringbuf_handle(_rxCh, &_rxBuf);
+
+    // 同一支腳位：先設為開漏輸入輸出，再把 TX 輸出與 RX 輸入接回 GPIO 矩陣
+    // (gpio_set_direction 會把輸出訊號重設為一般 GPIO，因此必須先呼叫)
+    gpio_set_direction(_pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_pullup_en(_pin);
+    esp_rom_gpio_connect_out_signal(_pin, RMT_SIG_OUT0_IDX + _txCh, false, false);
+    esp_rom_gpio_connect_in_signal(_pin, RMT_SIG_IN0_IDX + _rxCh, false);
+
+    _ready = (_rxBuf != nullptr);
+    return _ready;
+}
+
+rmt_item32_t OneWireMakitaRMT::toItem(const BusPulse &p) {
+    rmt_item32_t item;
+    item.val = encodeRmtItem(p);
+    return item;
+}
+
+size_t OneWireMakitaRMT::transmitAndCapture(const BusPulse *pulses, size_t count, uint16_t *lows, size_t max_lows) {
+    if (count > MAX_PULSES) count = MAX_PULSES;
+    for (size_t i = 0; i < count; i++) _items[i] = toItem(pulses[i]);
+
+    rmt_rx_start(_rxCh, true);
+    rmt_write_items(_txCh, _items, count, true);
+
+    size_t rx_size = 0;
+    rmt_item32_t *rx = (rmt_item32_t *)xRingbufferReceive(_rxBuf, &rx_size, RMT_RX_TIMEOUT);
+    rmt_rx_stop(_rxCh);
+    if (!rx) return 0;
+
+    // 依序取出所有低電位區段的長度
+    size_t found = collectLowDurations(&rx[0].val, rx_size / sizeof(rmt_item32_t), lows, max_lows);
+    vRingbufferReturnItem(_rxBuf, rx);
+    return found;
+}
+
+bool OneWireMakitaRMT::reset(void) {
+    if (!_ready) return false;
+    const BusPulse p = encodeReset();
+    uint16_t lows[4];
+    size_t n = transmitAndCapture(&p, 1, lows, 4);
+    return capturedPresence(lows, n, 1);
+}
+
+void OneWireMakitaRMT::write(uint8_t v) {
+    BusPulse pulses[MakitaTiming::BITS_PER_BYTE];
+    rmt_item32_t items[MakitaTiming::BITS_PER_BYTE];
+    size_t n = encodeWriteByte(v, pulses);
+    for (size_t i = 0; i < n; i++) items[i] = toItem(pulses[i]);
+    rmt_write_items(_txCh, items, n, true);
+}
+
+uint8_t OneWireMakitaRMT::read(void) {
+    BusPulse slots[MakitaTiming::BITS_PER_BYTE];
+    uint16_t lows[MakitaTiming::BITS_PER_BYTE];
+    size_t n = encodeReadByte(slots);
+    if (transmitAndCapture(slots, n, lows, n) != n) return 0xFF; // 擷取不完整視為讀取失敗
+    return decodeReadByte(lows);
+}
+
+void OneWireMakitaRMT::readRegisters(uint8_t prefix, const uint8_t *regs, size_t count, uint8_t *out) {
+    uint32_t start = micros();
+    uint32_t pulse_us = 0;
+
+    // 逐個暫存器傳輸時，每次都要等 RX 閒置門檻 (RMT_RX_IDLE_US) 才結束擷取，再加上驅動程式的啟動開銷；
+    // 整批串接後這些開銷每批只付一次，匯流排上只剩脈衝本身的時間
+    for (size_t done = 0; done < count;) {
+        size_t batch = count - done < REGS_PER_CAPTURE ? count - done : REGS_PER_CAPTURE;
+        size_t n = 0;
+        for (size_t i = 0; i < batch; i++) n += encodeRegisterRead(prefix, regs[done + i], _pulses + n);
+        pulse_us += pulseTrainUs(_pulses, n);
+
+        size_t found = transmitAndCapture(_pulses, n, _lows, MAX_PULSES + REGS_PER_CAPTURE);
+        decodeRegisterReads(_lows, found, batch, out + done);
+        done += batch;
+    }
+    _lastTransactUs = micros() - start;
+    _lastPulseUs = pulse_us;
+}
+
+void OneWireMakitaRMT::writeBytes(const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        BusPulse pulses[MakitaTiming::BITS_PER_BYTE];
+        rmt_item32_t items[MakitaTiming::BITS_PER_BYTE];
+        size_t n = encodeWriteByte(buf[i], pulses);
+        pulses[n - 1].high_us += _gapUs; // 位元組間隔併入最後一個位元的高電位，由硬體計時
+        for (size_t k = 0; k < n; k++) items[k] = toItem(pulses[k]);
+        rmt_write_items(_txCh, items, n, true);
+    }
+}
+
+void OneWireMakitaRMT::readBytes(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = read();
+        if (_gapUs) delayMicroseconds(_gapUs);
+    }
+}
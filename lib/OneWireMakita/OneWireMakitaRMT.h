@@ -0,0 +1,53 @@
+// lib/OneWireMakita/OneWireMakitaRMT.h
+
+#ifndef OneWireMakitaRMT_h
+#define OneWireMakitaRMT_h
+
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include "MakitaBus.h"
+#include "OneWireTiming.h"
+
+// RMT 週邊時序後端：脈衝由硬體產生與擷取，不需關閉中斷，
+// 也不會在每個位元上忙等 CPU。脈衝序列與 GPIO 後端來自同一份 OneWireTiming.h。
+// TX/RX 兩個通道接到同一支開漏腳位 (TX 輸出、RX 回讀線路電位)。
+class OneWireMakitaRMT : public MakitaBus
+{
+  private:
+    gpio_num_t _pin;
+    rmt_channel_t _txCh;
+    rmt_channel_t _rxCh;
+    RingbufHandle_t _rxBuf = nullptr;
+    bool _ready = false;
+
+    // RX 通道佔用的 RMT 記憶體區塊 (每塊 64 個項目)：一次擷取需容納多個暫存器讀取的完整波形
+    static const uint8_t RX_MEM_BLOCKS = 4;
+    // 每次擷取的暫存器數：每個暫存器的脈衝加上可能分開的存在脈衝
+    static const size_t REGS_PER_CAPTURE = RX_MEM_BLOCKS * 64 / (MakitaTiming::REGISTER_READ_PULSES + 1);
+    // 單次傳輸的脈衝上限 (暫存器快照)
+    static const size_t MAX_PULSES = REGS_PER_CAPTURE * MakitaTiming::REGISTER_READ_PULSES;
+
+    // 傳輸緩衝區 (數 KB，不放在呼叫端任務的堆疊上)
+    BusPulse _pulses[MAX_PULSES];
+    rmt_item32_t _items[MAX_PULSES];
+    uint16_t _lows[MAX_PULSES + REGS_PER_CAPTURE];
+
+    static rmt_item32_t toItem(const BusPulse &p);
+
+    // 發送脈衝並擷取線路波形，回傳擷取到的低電位區段長度 (µs)
+    size_t transmitAndCapture(const BusPulse *pulses, size_t count, uint16_t *lows, size_t max_lows);
+
+  public:
+    OneWireMakitaRMT(uint8_t pin, rmt_channel_t tx_channel = RMT_CHANNEL_0, rmt_channel_t rx_channel = RMT_CHANNEL_1);
+
+    bool begin(void) override;
+    bool reset(void) override;
+    void write(uint8_t v) override;
+    uint8_t read(void) override;
+    void writeBytes(const uint8_t *buf, size_t len) override;
+    void readBytes(uint8_t *buf, size_t len) override;
+    // 整份清單 (最多 REGS_PER_CAPTURE 個暫存器一批) 串成一次 RMT 傳輸/擷取，再以重置脈衝切分結果
+    void readRegisters(uint8_t prefix, const uint8_t *regs, size_t count, uint8_t *out) override;
+};
+
+#endif
@@ -0,0 +1,170 @@
+// lib/OneWireMakita/OneWireTiming.h
+
+#ifndef OneWireTiming_h
+#define OneWireTiming_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 單一脈衝：先拉低 low_us，再釋放 (高電位) high_us。
+// 所有後端都由同一份時序表產生相同的脈衝序列。
+struct BusPulse
+{
+    uint16_t low_us;
+    uint16_t high_us;
+};
+
+// Makita 匯流排時序表 (µs)
+namespace MakitaTiming
+{
+    constexpr uint16_t RESET_LOW_US = 750;       // 重置脈衝
+    constexpr uint16_t PRESENCE_SAMPLE_US = 70;  // 釋放後多久取樣存在脈衝
+    constexpr uint16_t RESET_TAIL_US = 410;      // 存在脈衝後的剩餘時段
+
+    constexpr BusPulse WRITE_1 = {12, 120};      // 寫“1”
+    constexpr BusPulse WRITE_0 = {100, 30};      // 寫“0”
+    constexpr BusPulse READ_SLOT = {10, 63};     // 讀取時槽
+    constexpr uint16_t READ_SAMPLE_US = 10;      // 釋放後多久取樣資料位元
+
+    // 讀取判定門檻：從拉低開始算，低電位持續到取樣點即為“0”
+    constexpr uint16_t READ_ZERO_MIN_LOW_US = READ_SLOT.low_us + READ_SAMPLE_US;
+
+    constexpr size_t BITS_PER_BYTE = 8;
+
+    // 單一暫存器讀取：reset + prefix + 位址 + 讀 1 位元組
+    constexpr size_t REGISTER_READ_PULSES = 1 + 3 * BITS_PER_BYTE;
+    // 擷取到的低電位達此長度即視為重置脈衝 (資料位元的低電位都遠短於此)，用來切分連續的暫存器讀取
+    constexpr uint16_t RESET_DETECT_US = RESET_LOW_US / 2;
+}
+
+// 重置時序 (存在脈衝取樣點與剩餘時段合併為一個高電位區段)
+inline BusPulse encodeReset()
+{
+    return BusPulse{MakitaTiming::RESET_LOW_US,
+                    (uint16_t)(MakitaTiming::PRESENCE_SAMPLE_US + MakitaTiming::RESET_TAIL_US)};
+}
+
+// 將一個位元組編碼為 8 個寫入脈衝 (LSB 優先)，out 至少需 8 個元素
+inline size_t encodeWriteByte(uint8_t v, BusPulse *out)
+{
+    for (size_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++)
+        out[i] = (v & (1u << i)) ? MakitaTiming::WRITE_1 : MakitaTiming::WRITE_0;
+    return MakitaTiming::BITS_PER_BYTE;
+}
+
+// 讀取一個位元組所需的 8 個讀取時槽，out 至少需 8 個元素
+inline size_t encodeReadByte(BusPulse *out)
+{
+    for (size_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++)
+        out[i] = MakitaTiming::READ_SLOT;
+    return MakitaTiming::BITS_PER_BYTE;
+}
+
+// 單一暫存器讀取的完整脈衝序列，out 至少需 REGISTER_READ_PULSES 個元素
+inline size_t encodeRegisterRead(uint8_t prefix, uint8_t reg, BusPulse *out)
+{
+    size_t n = 0;
+    out[n++] = encodeReset();
+    n += encodeWriteByte(prefix, out + n);
+    n += encodeWriteByte(reg, out + n);
+    n += encodeReadByte(out + n);
+    return n;
+}
+
+// 脈衝序列的總時長 (µs)：匯流排耗時的理論下限，用來比較各後端的額外開銷
+inline uint32_t pulseTrainUs(const BusPulse *pulses, size_t count)
+{
+    uint32_t us = 0;
+    for (size_t i = 0; i < count; i++)
+        us += (uint32_t)pulses[i].low_us + pulses[i].high_us;
+    return us;
+}
+
+// 由觀察到的低電位持續時間判定讀取位元
+inline bool decodeReadBit(uint16_t observed_low_us)
+{
+    return observed_low_us < MakitaTiming::READ_ZERO_MIN_LOW_US;
+}
+
+// 8 個讀取時槽觀察到的低電位持續時間 → 位元組 (LSB 優先)
+inline uint8_t decodeReadByte(const uint16_t *observed_low_us)
+{
+    uint8_t r = 0;
+    for (size_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++)
+        if (decodeReadBit(observed_low_us[i]))
+            r |= (uint8_t)(1u << i);
+    return r;
+}
+
+// --- RMT 項目 ---
+// 與 rmt_item32_t 相同的 32 位元格式 (1 tick = 1µs)，不依賴 ESP-IDF，可在主機端測試：
+//   bit 0..14 duration0、bit 15 level0、bit 16..30 duration1、bit 31 level1
+namespace RmtItem
+{
+    constexpr uint16_t MAX_DURATION = 0x7FFF;
+
+    constexpr uint32_t make(uint16_t duration0, bool level0, uint16_t duration1, bool level1)
+    {
+        return (uint32_t)(duration0 & MAX_DURATION) | ((uint32_t)level0 << 15) |
+               ((uint32_t)(duration1 & MAX_DURATION) << 16) | ((uint32_t)level1 << 31);
+    }
+    constexpr uint16_t duration0(uint32_t item) { return item & MAX_DURATION; }
+    constexpr bool level0(uint32_t item) { return (item >> 15) & 1; }
+    constexpr uint16_t duration1(uint32_t item) { return (item >> 16) & MAX_DURATION; }
+    constexpr bool level1(uint32_t item) { return item >> 31; }
+}
+
+static_assert(MakitaTiming::RESET_LOW_US <= RmtItem::MAX_DURATION &&
+                  MakitaTiming::PRESENCE_SAMPLE_US + MakitaTiming::RESET_TAIL_US <= RmtItem::MAX_DURATION,
+              "reset timing must fit one RMT item");
+
+// 脈衝 → RMT 發送項目：先拉低 (level0 = 0) 再釋放 (level1 = 1)，時長與 GPIO 後端的延遲相同
+inline uint32_t encodeRmtItem(const BusPulse &p)
+{
+    return RmtItem::make(p.low_us, false, p.high_us, true);
+}
+
+// RMT 擷取到的項目 → 依序的低電位區段長度 (µs)，回傳區段數 (最多 max_lows)
+inline size_t collectLowDurations(const uint32_t *items, size_t count, uint16_t *lows, size_t max_lows)
+{
+    size_t found = 0;
+    for (size_t i = 0; i < count && found < max_lows; i++)
+    {
+        if (!RmtItem::level0(items[i]) && RmtItem::duration0(items[i]))
+            lows[found++] = RmtItem::duration0(items[i]);
+        if (found < max_lows && !RmtItem::level1(items[i]) && RmtItem::duration1(items[i]))
+            lows[found++] = RmtItem::duration1(items[i]);
+    }
+    return found;
+}
+
+// 以重置脈衝開頭、共送出 sent 個脈衝的擷取結果中是否有存在脈衝：
+// 釋放後出現額外一段低電位，或緊接重置脈衝使第一段低電位被拉長。少於 sent 段表示擷取不完整。
+inline bool capturedPresence(const uint16_t *lows, size_t found, size_t sent)
+{
+    if (found == 0 || found < sent)
+        return false;
+    return found > sent || lows[0] > MakitaTiming::RESET_LOW_US + MakitaTiming::READ_SAMPLE_US;
+}
+
+// 一次擷取中連續 count 個暫存器讀取 (encodeRegisterRead 依序串接) 的低電位區段 → 各暫存器的值。
+// 以重置脈衝切分成每個暫存器的區段，區段需有存在脈衝且長度正確才取最後 8 段讀取時槽，否則為 0xFF。
+inline void decodeRegisterReads(const uint16_t *lows, size_t found, size_t count, uint8_t *out)
+{
+    using namespace MakitaTiming;
+    size_t pos = 0;
+    for (size_t r = 0; r < count; r++)
+    {
+        while (pos < found && lows[pos] < RESET_DETECT_US)
+            pos++;
+        size_t end = pos < found ? pos + 1 : found;
+        while (end < found && lows[end] < RESET_DETECT_US)
+            end++;
+        size_t seg = end - pos;
+        bool ok = seg <= REGISTER_READ_PULSES + 1 && capturedPresence(lows + pos, seg, REGISTER_READ_PULSES);
+        out[r] = ok ? decodeReadByte(lows + end - BITS_PER_BYTE) : 0xFF;
+        pos = end;
+    }
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "Analytics.h"
+
+static const uint32_t DIFF_FAST_TAU_MS = 30000UL;  // 壓差短期平均的時間常數
+static const uint32_t DIFF_SLOW_TAU_MS = 600000UL; // 長期平均 (10 分鐘)
+static const int32_t EWMA_SCALE = 16;              // 定點小數 (1/16 mV)
+
+static const uint16_t IMBALANCE_MV = 100;       // 壓差 EWMA 門檻
+static const int16_t IMBALANCE_RISING_MV = 20;  // 短期 - 長期平均門檻
+static const uint16_t CELL_LOW_MV = 2700;
+static const uint16_t CELL_HIGH_MV = 4250;
+static const int16_t OVER_TEMP_CENTI = 6000;    // 60°C
+static const uint16_t THERMAL_SPREAD_CENTI = 800; // 8°C
+static const uint8_t PACK_MISMATCH_PCT = 3;
+static const uint16_t LOW_SOH_CENTI = 6000;     // 60%，與前端 SOH 顏色的警告門檻相同
+
+// 鋰離子電芯靜置開路電壓與剩餘電量的對照 (mV, %)，之間線性內插。
+// 負載中電壓下陷會低估剩餘容量，只作為粗略參考。
+struct OcvPoint
+{
+    uint16_t mv;
+    uint8_t pct;
+};
+static const OcvPoint OCV_TABLE[] = {
+    {3000, 0}, {3450, 5}, {3550, 10}, {3650, 20}, {3700, 30}, {3750, 40},
+    {3800, 50}, {3850, 60}, {3950, 70}, {4030, 80}, {4100, 90}, {4200, 100},
+};
+
+uint16_t estimateSohCenti(int charge_cycles, uint8_t over_discharge, uint8_t over_load, uint16_t err_total)
+{
+    // 以 0.01% 整數運算，避免浮點格式化
+    long soh = 10000;
+    soh -= (charge_cycles > 0 ? charge_cycles : 0) * 5L;
+    soh -= over_discharge * 10L;
+    soh -= over_load * 10L;
+    soh -= err_total * 2000L;
+    return soh < 0 ? 0 : (uint16_t)soh;
+}
+
+uint16_t counterAnomalyFlags(int charge_cycles, uint8_t over_discharge, uint8_t over_load,
+                             const uint8_t err_cnt[4], uint8_t lock_status, uint8_t fuse_blown)
+{
+    uint16_t flags = 0;
+    if (lock_status != 0)
+        flags |= ANOMALY_LOCKED;
+    if (fuse_blown)
+        flags |= ANOMALY_FUSE_BLOWN;
+    if (err_cnt[0] || err_cnt[1] || err_cnt[2] || err_cnt[3])
+        flags |= ANOMALY_ERROR_COUNTS;
+    if (estimateSohCenti(charge_cycles, over_discharge, over_load, err_cnt[0] + err_cnt[1] + err_cnt[2] + err_cnt[3]) < LOW_SOH_CENTI)
+        flags |= ANOMALY_LOW_SOH;
+    return flags;
+}
+
+static uint8_t socFromCellMv(uint16_t mv)
+{
+    const size_t n = sizeof(OCV_TABLE) / sizeof(OCV_TABLE[0]);
+    if (mv <= OCV_TABLE[0].mv)
+        return 0;
+    for (size_t i = 1; i < n; i++)
+    {
+        const OcvPoint &a = OCV_TABLE[i - 1];
+        const OcvPoint &b = OCV_TABLE[i];
+        if (mv <= b.mv)
+            return a.pct + (uint8_t)((uint32_t)(mv - a.mv) * (b.pct - a.pct) / (b.mv - a.mv));
+    }
+    return 100;
+}
+
+struct CellRange
+{
+    uint8_t count;
+    uint16_t min_mv;
+    uint16_t max_mv;
+    uint32_t sum_mv;
+};
+
+// 只統計有讀到電壓的電芯 (14.4V 電池只有 4 顆)
+static CellRange cellRange(const BatteryData &data)
+{
+    CellRange r = {0, 0xFFFF, 0, 0};
+    for (int i = 0; i < 5; i++)
+    {
+        uint16_t mv = data.cell_mv[i];
+        if (mv <= CELL_VALID_MV)
+            continue;
+        r.count++;
+        r.sum_mv += mv;
+        if (mv < r.min_mv)
+            r.min_mv = mv;
+        if (mv > r.max_mv)
+            r.max_mv = mv;
+    }
+    return r;
+}
+
+// 0 值為尚未讀到 (第三溫度讀取失敗時沿用舊值，開機後可能一直是 0)
+static bool validTemp(int16_t centi)
+{
+    return centi != 0 && centi > -4000 && centi < 12000;
+}
+
+static int32_t ewmaStep(int32_t delta, uint32_t dt_ms, uint32_t tau_ms)
+{
+    // alpha = dt / (tau + dt)：間隔越長，新樣本的權重越高
+    return (int32_t)((int64_t)delta * dt_ms / ((int64_t)tau_ms + dt_ms));
+}
+
+static int32_t fromScaled(int32_t v)
+{
+    return (v >= 0 ? v + EWMA_SCALE / 2 : v - EWMA_SCALE / 2) / EWMA_SCALE;
+}
+
+void PackAnalytics::reset()
+{
+    memset(_rom, 0, sizeof(_rom));
+    _samples = 0;
+    _lastMs = 0;
+    _diffFast = 0;
+    _diffSlow = 0;
+}
+
+bool PackAnalytics::tracks(const BatteryData &data) const
+{
+    return _samples > 0 && memcmp(data.rom_id, _rom, sizeof(_rom)) == 0;
+}
+
+void PackAnalytics::update(BatteryData &data, uint32_t t_ms)
+{
+    if (memcmp(data.rom_id, _rom, sizeof(_rom)) != 0)
+    {
+        reset();
+        memcpy(_rom, data.rom_id, sizeof(_rom));
+    }
+
+    CellRange r = cellRange(data);
+    if (r.count >= 2)
+    {
+        int32_t x = (int32_t)(r.max_mv - r.min_mv) * EWMA_SCALE;
+        if (_samples == 0)
+        {
+            _diffFast = _diffSlow = x;
+        }
+        else
+        {
+            // 連續取樣的時間戳可能比上一筆一般讀取稍早：視為同一時刻
+            uint32_t dt = (int32_t)(t_ms - _lastMs) > 0 ? t_ms - _lastMs : 0;
+            _diffFast += ewmaStep(x - _diffFast, dt, DIFF_FAST_TAU_MS);
+            _diffSlow += ewmaStep(x - _diffSlow, dt, DIFF_SLOW_TAU_MS);
+        }
+        _lastMs = t_ms;
+        _samples++;
+    }
+    apply(data);
+}
+
+void PackAnalytics::apply(BatteryData &data) const
+{
+    // --- 壽命與容量 ---
+    uint16_t soh = estimateSohCenti(data.charge_cycles, data.over_discharge, data.over_load,
+                                    data.err_cnt_04 + data.err_cnt_05 + data.err_cnt_06 + data.err_cnt_07);
+    data.health_pct = (uint8_t)((soh + 50) / 100);
+    data.full_capacity = (uint16_t)((uint32_t)data.capacity_deci_ah * 100 * soh / 10000);
+
+    CellRange r = cellRange(data);
+    data.remaining_capacity = r.count > 0 ? (uint16_t)((uint32_t)data.full_capacity * socFromCellMv(r.min_mv) / 100) : 0;
+
+    // --- 電芯不平衡 ---
+    if (tracks(data))
+    {
+        data.cell_diff_ewma_mv = (uint16_t)fromScaled(_diffFast);
+        data.cell_diff_trend_mv = (int16_t)fromScaled(_diffFast - _diffSlow);
+    }
+    else
+    {
+        data.cell_diff_ewma_mv = r.count >= 2 ? r.max_mv - r.min_mv : 0;
+        data.cell_diff_trend_mv = 0;
+    }
+
+    // --- 溫度 ---
+    const int16_t temps[3] = {data.temp1_centi, data.temp2_centi, data.temp3_centi};
+    int16_t tmin = INT16_MAX, tmax = INT16_MIN;
+    uint8_t tcount = 0;
+    for (int16_t t : temps)
+    {
+        if (!validTemp(t))
+            continue;
+        tcount++;
+        if (t < tmin)
+            tmin = t;
+        if (t > tmax)
+            tmax = t;
+    }
+    data.thermal_spread_centi = tcount >= 2 ? (uint16_t)(tmax - tmin) : 0;
+
+    // --- 異常旗標 ---
+    uint16_t flags = 0;
+    if (data.cell_diff_ewma_mv > IMBALANCE_MV)
+        flags |= ANOMALY_CELL_IMBALANCE;
+    if (data.cell_diff_trend_mv > IMBALANCE_RISING_MV)
+        flags |= ANOMALY_IMBALANCE_RISING;
+    if (r.count > 0 && r.min_mv < CELL_LOW_MV)
+        flags |= ANOMALY_CELL_LOW;
+    if (r.count > 0 && r.max_mv > CELL_HIGH_MV)
+        flags |= ANOMALY_CELL_HIGH;
+    if (tcount > 0 && tmax > OVER_TEMP_CENTI)
+        flags |= ANOMALY_OVER_TEMP;
+    if (data.thermal_spread_centi > THERMAL_SPREAD_CENTI)
+        flags |= ANOMALY_THERMAL_SPREAD;
+    if (r.count >= 4 && data.pack_mv > 0 &&
+        (uint32_t)abs((int32_t)data.pack_mv - (int32_t)r.sum_mv) * 100 > (uint32_t)data.pack_mv * PACK_MISMATCH_PCT)
+        flags |= ANOMALY_PACK_MISMATCH;
+    const uint8_t err_cnt[4] = {data.err_cnt_04, data.err_cnt_05, data.err_cnt_06, data.err_cnt_07};
+    flags |= counterAnomalyFlags(data.charge_cycles, data.over_discharge, data.over_load, err_cnt,
+                                 data.lock_status, data.fuse_blown);
+    data.anomaly_flags = flags;
+}
@@ -0,0 +1,60 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <Arduino.h>
+#include "MakitaBMS.h"
+
+// 電池健康分析：SOH、容量估計、電芯不平衡趨勢、溫差與異常旗標只在 MCU 端計算一次，
+// 結果寫入 BatteryData 的分析欄位後隨遙測幀送出，瀏覽器與 CSV 只負責顯示。
+//
+// 每筆動態樣本 O(1) 更新：電芯壓差以兩個時間常數的 EWMA 追蹤 (快 - 慢 = 趨勢)，
+// 依實際取樣間隔計算權重，所以連續取樣 (數十 Hz) 與一般讀取 (數秒一次) 的結果一致。
+// 更換電池 (rom_id 不同) 時重新開始；只保存在 RAM 中。
+
+// 異常旗標 (位元需與 data/app.js 的 ANOMALY_KEYS 一致)
+enum AnomalyFlag : uint16_t
+{
+    ANOMALY_CELL_IMBALANCE = 1 << 0,  // 壓差 EWMA 超過門檻
+    ANOMALY_IMBALANCE_RISING = 1 << 1, // 壓差短期平均明顯高於長期平均
+    ANOMALY_CELL_LOW = 1 << 2,        // 最低電芯低於過放門檻
+    ANOMALY_CELL_HIGH = 1 << 3,       // 最高電芯高於過充門檻
+    ANOMALY_OVER_TEMP = 1 << 4,       // 任一溫度感測器過熱
+    ANOMALY_THERMAL_SPREAD = 1 << 5,  // 感測器之間溫差過大 (局部發熱)
+    ANOMALY_PACK_MISMATCH = 1 << 6,   // 總電壓與電芯總和不符 (量測或接觸問題)
+    ANOMALY_LOCKED = 1 << 7,          // BMS 鎖定中
+    ANOMALY_FUSE_BLOWN = 1 << 8,      // 軟體保險絲已熔斷
+    ANOMALY_ERROR_COUNTS = 1 << 9,    // 錯誤計數 04h..07h 不為 0
+    ANOMALY_LOW_SOH = 1 << 10,        // SOH 低於 60%
+};
+// 只由壽命計數器/鎖定狀態決定的旗標 (不需要電芯電壓或溫度)
+static const uint16_t ANOMALY_COUNTER_FLAGS = ANOMALY_LOCKED | ANOMALY_FUSE_BLOWN | ANOMALY_ERROR_COUNTS | ANOMALY_LOW_SOH;
+
+// 由壽命計數器估計 SOH (0.01% 單位)，供即時分析與 MCU 紀錄 CSV 共用：
+// 循環每次扣 0.05%、過放/過載紀錄每次扣 0.1%、錯誤計數 04h..07h 每次扣 20%，最低為 0
+uint16_t estimateSohCenti(int charge_cycles, uint8_t over_discharge, uint8_t over_load, uint16_t err_total);
+// ANOMALY_COUNTER_FLAGS 的部分 (err_cnt 為 04h..07h)，供沒有電芯電壓的讀取重新計算
+uint16_t counterAnomalyFlags(int charge_cycles, uint8_t over_discharge, uint8_t over_load,
+                             const uint8_t err_cnt[4], uint8_t lock_status, uint8_t fuse_blown);
+
+class PackAnalytics
+{
+public:
+    // 加入一筆新的動態樣本 (t_ms 為 millis() 時基)，並把結果寫入 data 的分析欄位
+    void update(BatteryData &data, uint32_t t_ms);
+    // 只寫入目前的結果 (靜態讀取、快取命中等沒有新樣本的情況)
+    void apply(BatteryData &data) const;
+    void reset();
+
+    uint32_t samples() const { return _samples; }
+
+private:
+    uint8_t _rom[8] = {};
+    uint32_t _samples = 0;
+    uint32_t _lastMs = 0;
+    int32_t _diffFast = 0; // 壓差 EWMA (mV × 16)
+    int32_t _diffSlow = 0;
+
+    bool tracks(const BatteryData &data) const;
+};
+
+#endif
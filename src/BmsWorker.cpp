@@ -0,0 +1,516 @@
+#include "BmsWorker.h"
+
+BmsWorker::BmsWorker(MakitaBus &bus, uint8_t enable_pin, int8_t relay_pin)
+    : _bms(bus, enable_pin, relay_pin)
+{
+}
+
+bool BmsWorker::begin(BaseType_t core, UBaseType_t priority)
+{
+    if (_task)
+        return true;
+
+    _cmdQueue = xQueueCreate(8, sizeof(BmsCommand));
+    _resultQueue = xQueueCreate(RESULT_QUEUE_LEN, sizeof(BmsResult));
+    _sampleQueue = xQueueCreate(SAMPLE_QUEUE_LEN, sizeof(DynamicSample));
+    _dataMutex = xSemaphoreCreateMutex();
+    if (!_cmdQueue || !_resultQueue || !_sampleQueue || !_dataMutex)
+        return false;
+
+    // MakitaBMS 的日誌在工作任務中產生：不直接送往 WebSocket，改經結果佇列交給 loop
+    _bms.setLogCallback([this](const String &message, LogLevel level) { postLog(message, level); });
+    _bms.begin();
+    if (!_timingStore.begin())
+        Serial.println("[BMS] Timing store unavailable, using safe timing only");
+    return xTaskCreatePinnedToCore(taskEntry, "bms_worker", 6144, this, priority, &_task, core) == pdPASS;
+}
+
+bool BmsWorker::post(const BmsCommand &cmd)
+{
+    if (!_cmdQueue)
+        return false;
+    return xQueueSend(_cmdQueue, &cmd, 0) == pdTRUE;
+}
+
+bool BmsWorker::poll(BmsResult &result)
+{
+    if (!_resultQueue)
+        return false;
+    return xQueueReceive(_resultQueue, &result, 0) == pdTRUE;
+}
+
+bool BmsWorker::pollSample(DynamicSample &sample)
+{
+    if (!_sampleQueue)
+        return false;
+    return xQueueReceive(_sampleQueue, &sample, 0) == pdTRUE;
+}
+
+bool BmsWorker::startLoadTest(const LoadTest::Config &cfg)
+{
+    portENTER_CRITICAL(&_stateLock);
+    _loadConfig = cfg;
+    portEXIT_CRITICAL(&_stateLock);
+    return post(BMS_CMD_LOAD_TEST, true);
+}
+
+void BmsWorker::loadTestResult(LoadTest::Result &out)
+{
+    xSemaphoreTake(_dataMutex, portMAX_DELAY);
+    out = _loadResult;
+    xSemaphoreGive(_dataMutex);
+}
+
+BmsRequestOutcome BmsWorker::requestDynamic(uint32_t max_age_ms, bool skip_log)
+{
+    portENTER_CRITICAL(&_stateLock);
+    if (max_age_ms > 0 && _hasDynamic && millis() - _lastDynamicMs <= max_age_ms)
+    {
+        _stats.cache_hits++;
+        portEXIT_CRITICAL(&_stateLock);
+
+        BmsResult result = {};
+        result.type = BMS_CMD_READ_DYNAMIC;
+        result.ok = true;
+        result.skip_log = true; // 快取數據已在讀取當下紀錄過
+        result.from_cache = true;
+        return xQueueSend(_resultQueue, &result, 0) == pdTRUE ? BMS_REQ_CACHED : BMS_REQ_BUSY;
+    }
+    if (_dynamicPending)
+    {
+        _stats.coalesced_hits++;
+        _pendingWaiters++;
+        _pendingSkipLog = _pendingSkipLog && skip_log;
+        portEXIT_CRITICAL(&_stateLock);
+        return BMS_REQ_COALESCED;
+    }
+    _dynamicPending = true;
+    _pendingSkipLog = skip_log;
+    _pendingWaiters = 0;
+    portEXIT_CRITICAL(&_stateLock);
+
+    if (post(BMS_CMD_READ_DYNAMIC, skip_log))
+        return BMS_REQ_QUEUED;
+
+    portENTER_CRITICAL(&_stateLock);
+    _dynamicPending = false;
+    portEXIT_CRITICAL(&_stateLock);
+    return BMS_REQ_BUSY;
+}
+
+BmsWorkerStats BmsWorker::stats()
+{
+    portENTER_CRITICAL(&_stateLock);
+    BmsWorkerStats copy = _stats;
+    portEXIT_CRITICAL(&_stateLock);
+    return copy;
+}
+
+BmsStreamStats BmsWorker::streamStats()
+{
+    portENTER_CRITICAL(&_stateLock);
+    BmsStreamStats copy = _streamStats;
+    unsigned long elapsed = millis() - _streamStartMs;
+    portEXIT_CRITICAL(&_stateLock);
+    if (copy.active && elapsed > 0)
+        copy.achieved_centi_hz = (uint32_t)((uint64_t)copy.samples * 100000 / elapsed);
+    return copy;
+}
+
+void BmsWorker::snapshot(BatteryData &data, SupportedFeatures *features)
+{
+    xSemaphoreTake(_dataMutex, portMAX_DELAY);
+    data = _published;
+    if (features)
+        *features = _features;
+    xSemaphoreGive(_dataMutex);
+}
+
+void BmsWorker::publish(const SupportedFeatures *features, bool dynamic)
+{
+    xSemaphoreTake(_dataMutex, portMAX_DELAY);
+    _published = _work;
+    if (features)
+        _features = *features;
+    xSemaphoreGive(_dataMutex);
+
+    portENTER_CRITICAL(&_stateLock);
+    _hasDynamic = dynamic; // 重新識別電池後，舊的動態快取即失效
+    _lastDynamicMs = millis();
+    _stats.verify = _bms.readStats();
+    portEXIT_CRITICAL(&_stateLock);
+}
+
+void BmsWorker::postLog(const String &message, LogLevel level)
+{
+    // 不等待：佇列快滿時只印到序列埠，不擋住匯流排工作也不擠掉指令結果
+    if (uxQueueSpacesAvailable(_resultQueue) > RESULT_QUEUE_RESERVE)
+    {
+        BmsResult result = {};
+        result.type = BMS_RESULT_LOG;
+        result.ok = true;
+        result.log_level = level;
+        strlcpy(result.message, message.c_str(), sizeof(result.message));
+        if (xQueueSend(_resultQueue, &result, 0) == pdTRUE)
+            return;
+    }
+    Serial.println(message);
+}
+
+void BmsWorker::taskEntry(void *arg)
+{
+    static_cast<BmsWorker *>(arg)->run();
+}
+
+void BmsWorker::run()
+{
+    BmsCommand cmd;
+    for (;;)
+    {
+        // 串流進行中：等待指令直到下一個取樣時槽；否則無限期等待
+        TickType_t wait = _streaming ? streamWaitTicks() : portMAX_DELAY;
+        if (xQueueReceive(_cmdQueue, &cmd, wait) != pdTRUE)
+        {
+            if (_streaming)
+                streamSample();
+            continue;
+        }
+
+        BmsResult result = {};
+        result.type = cmd.type;
+        result.skip_log = cmd.skip_log;
+        execute(cmd, result);
+
+        // 結果佇列滿時等待網路端消化，避免遺失回覆
+        xQueueSend(_resultQueue, &result, pdMS_TO_TICKS(1000));
+    }
+}
+
+// 距離下一個時槽的 tick 數 (無條件捨去，剩餘的不足 1 tick 由 streamSample 忙等補齊)
+TickType_t BmsWorker::streamWaitTicks() const
+{
+    int32_t remain = (int32_t)(_nextSampleUs - micros());
+    if (remain <= 0)
+        return 0;
+    return pdMS_TO_TICKS(remain / 1000);
+}
+
+// 等到指定的 micros()：整數毫秒交給排程器，其餘忙等
+void BmsWorker::waitUntil(uint32_t target_us)
+{
+    int32_t remain = (int32_t)(target_us - micros());
+    if (remain >= 1000)
+        vTaskDelay(pdMS_TO_TICKS(remain / 1000));
+    remain = (int32_t)(target_us - micros());
+    if (remain > 0)
+        delayMicroseconds(remain);
+}
+
+void BmsWorker::streamSample()
+{
+    int32_t late = (int32_t)(micros() - _nextSampleUs);
+    if (late < 0)
+    {
+        delayMicroseconds(-late);
+        late = 0;
+    }
+
+    // 讀取耗時超過週期時跳過已錯過的時槽，維持固定相位而不是累積延遲
+    uint32_t skipped = (uint32_t)late / _streamPeriodUs;
+    uint32_t jitter = (uint32_t)late - skipped * _streamPeriodUs;
+    _nextSampleUs += (skipped + 1) * _streamPeriodUs;
+
+    // 高速路徑：只有 0xD7，不經 String、不取資料鎖；_work 於串流結束時才發布
+    DynamicSample sample;
+    bool ok = _bms.sampleDynamic(sample);
+    if (ok)
+        applyDynamicSample(sample, _work);
+
+    _jitterSumUs += jitter;
+    portENTER_CRITICAL(&_stateLock);
+    BmsStreamStats &st = _streamStats;
+    st.missed += skipped;
+    if (ok)
+        st.samples++;
+    else
+        st.failures++;
+    if (jitter > st.jitter_max_us)
+        st.jitter_max_us = jitter;
+    uint32_t attempts = st.samples + st.failures;
+    st.jitter_avg_us = (uint32_t)(_jitterSumUs / attempts);
+    portEXIT_CRITICAL(&_stateLock);
+
+    if (ok)
+    {
+        _streamFailStreak = 0;
+        // 網路端跟不上時丟棄樣本，不拖慢取樣排程
+        if (xQueueSend(_sampleQueue, &sample, 0) != pdTRUE)
+        {
+            portENTER_CRITICAL(&_stateLock);
+            _streamStats.dropped++;
+            portEXIT_CRITICAL(&_stateLock);
+        }
+        return;
+    }
+
+    if (++_streamFailStreak < STREAM_MAX_FAILURES)
+        return;
+
+    // 連續失敗：自動停止並通知網路端
+    endStream();
+    BmsResult result = {};
+    result.type = BMS_CMD_STREAM_STOP;
+    result.skip_log = true;
+    strlcpy(result.message, "No response from battery", sizeof(result.message));
+    xQueueSend(_resultQueue, &result, pdMS_TO_TICKS(1000));
+}
+
+void BmsWorker::endStream()
+{
+    if (!_streaming)
+        return;
+    _streaming = false;
+    _bms.endSession();
+    portENTER_CRITICAL(&_stateLock);
+    _streamStats.active = false;
+    bool sampled = _streamStats.samples > 0;
+    portEXIT_CRITICAL(&_stateLock);
+    // 讓快取 (requestDynamic 的 max_age_ms) 反映最後一筆樣本
+    if (sampled)
+        publish(nullptr, true);
+}
+
+void BmsWorker::execute(const BmsCommand &cmd, BmsResult &result)
+{
+    String res;
+
+    switch (cmd.type)
+    {
+    case BMS_CMD_READ_STATIC:
+    {
+        SupportedFeatures features;
+        // 尚未知道是哪顆電池，一律以安全時序識別
+        _bms.setTimingProfile(BusTimingProfile());
+        clearDynamicFields(_work); // 可能換了電池：前一顆的電芯電壓/錯誤計數不可沿用
+        res = _bms.readStaticData(_work, features);
+        result.ok = res.indexOf("OK") != -1;
+        if (result.ok)
+        {
+            // 已校準過的電池改用它的快速時序
+            BusTimingProfile profile;
+            if (_timingStore.load(_work.rom_id, profile))
+            {
+                _bms.setTimingProfile(profile);
+                char rom[17];
+                formatRomId(_work.rom_id, rom);
+                Serial.printf("[BMS] Using calibrated timing for %s (wake %ums)\n", rom, profile.wake_ms);
+            }
+            publish(&features, false);
+            res = "";
+        }
+        break;
+    }
+
+    case BMS_CMD_READ_DYNAMIC:
+    case BMS_CMD_LED_ON:
+    case BMS_CMD_LED_OFF:
+    {
+        // LED 指令與隨後的數據刷新共用同一次喚醒
+        MakitaBMS::PowerSession session(_bms);
+        if (cmd.type != BMS_CMD_READ_DYNAMIC)
+            _bms.ledTest(cmd.type == BMS_CMD_LED_ON);
+
+        res = _bms.readDynamicData(_work);
+        // 注意：如果 readDynamicData 已經失敗，這裡可能也會失敗，但我們還是嘗試讀取
+        _bms.readAdvancedDiagnostics(_work);
+        result.ok = (res == "");
+        publish(nullptr, result.ok);
+
+        if (cmd.type == BMS_CMD_READ_DYNAMIC)
+        {
+            // 讀取完成：釋放合併狀態，之後的請求會觸發新的讀取
+            portENTER_CRITICAL(&_stateLock);
+            _stats.dynamic_reads++;
+            result.coalesced = _pendingWaiters;
+            result.skip_log = _pendingSkipLog;
+            _dynamicPending = false;
+            _pendingWaiters = 0;
+            portEXIT_CRITICAL(&_stateLock);
+        }
+        break;
+    }
+
+    case BMS_CMD_CLEAR_ERRORS:
+    {
+        // 清除與刷新在同一個電源會話內完成
+        MakitaBMS::PowerSession session(_bms);
+        res = _bms.clearErrors();
+        result.ok = (res == "");
+        if (result.ok)
+        {
+            _bms.readDynamicData(_work);
+            _bms.readAdvancedDiagnostics(_work);
+            publish(nullptr, true);
+        }
+        break;
+    }
+
+    case BMS_CMD_CALIBRATE_TIMING:
+    {
+        // 校準會反覆斷電重試，不能與串流的電源會話並存
+        if (_streaming)
+        {
+            res = "Stop streaming first.";
+            result.ok = false;
+            break;
+        }
+        BusTimingProfile profile;
+        res = _bms.calibrateTiming(profile);
+        result.ok = (res == "");
+        if (result.ok)
+        {
+            _bms.setTimingProfile(profile);
+            if (!_timingStore.save(_work.rom_id, profile))
+                Serial.println("[BMS] Failed to persist timing profile");
+            char summary[64];
+            snprintf(summary, sizeof(summary), "wake=%ums reset=%uus gap=%uus tree2=%ums",
+                     profile.wake_ms, profile.post_reset_us, profile.inter_byte_us, profile.tree2_settle_ms);
+            res = summary;
+        }
+        break;
+    }
+
+    case BMS_CMD_RESET_TIMING:
+        _timingStore.remove(_work.rom_id);
+        _bms.setTimingProfile(BusTimingProfile());
+        result.ok = true;
+        break;
+
+    case BMS_CMD_STREAM_START:
+    {
+        uint16_t hz = constrain(cmd.param, 1, STREAM_MAX_HZ);
+        _streamPeriodUs = 1000000UL / hz;
+        if (!_streaming)
+        {
+            // 整個串流期間保持喚醒，每筆取樣不再付出喚醒成本
+            _bms.beginSession();
+            _streaming = true;
+            _streamFailStreak = 0;
+            _jitterSumUs = 0;
+            _nextSampleUs = micros(); // 立即取第一筆
+
+            portENTER_CRITICAL(&_stateLock);
+            _streamStats = BmsStreamStats();
+            _streamStats.active = true;
+            _streamStartMs = millis();
+            portEXIT_CRITICAL(&_stateLock);
+        }
+        portENTER_CRITICAL(&_stateLock);
+        _streamStats.hz = hz;
+        portEXIT_CRITICAL(&_stateLock);
+        result.ok = true;
+        break;
+    }
+
+    case BMS_CMD_STREAM_STOP:
+        endStream();
+        result.ok = true;
+        break;
+
+    case BMS_CMD_LOAD_TEST:
+    {
+        // 串流與負載測試都需要獨佔取樣排程
+        if (_streaming)
+        {
+            res = "Stop streaming first.";
+            break;
+        }
+        portENTER_CRITICAL(&_stateLock);
+        LoadTest::Config cfg = _loadConfig;
+        portEXIT_CRITICAL(&_stateLock);
+        res = runLoadTest(cfg);
+        result.ok = (res == "");
+        break;
+    }
+    case BMS_RESULT_LOG: // 不是指令
+        break;
+    }
+
+    strlcpy(result.message, res.c_str(), sizeof(result.message));
+}
+
+// 負載測試：固定排程取樣，依經過時間切換繼電器；任何離開路徑都保證斷開負載
+String BmsWorker::runLoadTest(LoadTest::Config cfg)
+{
+    if (!_bms.hasRelay())
+        return "No load relay configured";
+    LoadTest::clampConfig(cfg);
+
+    MakitaBMS::PowerSession session(_bms);
+    const uint32_t period_us = 1000000UL / cfg.hz;
+    const uint32_t on_at_ms = cfg.rest_ms;
+    const uint32_t off_at_ms = on_at_ms + cfg.load_ms;
+    const uint32_t end_ms = off_at_ms + cfg.recover_ms;
+
+    size_t count = 0;
+    uint8_t fail_streak = 0;
+    uint32_t load_on_us = 0, load_off_us = 0;
+    const uint32_t start_us = micros();
+    uint32_t next_us = start_us;
+    String res;
+
+    while (count < LoadTest::MAX_SAMPLES)
+    {
+        waitUntil(next_us);
+        uint32_t elapsed_ms = (micros() - start_us) / 1000;
+        if (elapsed_ms >= end_ms)
+            break;
+        if (load_on_us == 0 && elapsed_ms >= on_at_ms)
+        {
+            _bms.setRelay(true);
+            load_on_us = micros();
+        }
+        else if (load_on_us != 0 && load_off_us == 0 && elapsed_ms >= off_at_ms)
+        {
+            _bms.setRelay(false);
+            load_off_us = micros();
+        }
+
+        DynamicSample &sample = _loadSamples[count];
+        if (_bms.sampleDynamic(sample))
+        {
+            fail_streak = 0;
+            count++;
+            sample.load_test = true;
+            xQueueSend(_sampleQueue, &sample, 0); // 即時曲線：網路端跟不上時只少畫幾點，分析不受影響
+        }
+        else if (++fail_streak >= STREAM_MAX_FAILURES)
+        {
+            res = "No response from battery";
+            break;
+        }
+
+        // 讀取超時則跳過錯過的時槽
+        next_us += period_us;
+        if ((int32_t)(micros() - next_us) > 0)
+            next_us += ((micros() - next_us) / period_us + 1) * period_us;
+    }
+    _bms.setRelay(false);
+    if (res != "")
+        return res;
+    if (load_on_us == 0 || load_off_us == 0)
+        return "Load test incomplete";
+
+    LoadTest::Result result;
+    res = LoadTest::analyze(_loadSamples, count, cfg, load_on_us, load_off_us, result);
+    if (res == "")
+    {
+        // 最後一筆樣本也更新到工作數據
+        if (count > 0)
+            applyDynamicSample(_loadSamples[count - 1], _work);
+        xSemaphoreTake(_dataMutex, portMAX_DELAY);
+        _loadResult = result;
+        xSemaphoreGive(_dataMutex);
+    }
+    return res;
+}
@@ -0,0 +1,173 @@
+#ifndef BMS_WORKER_H
+#define BMS_WORKER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "MakitaBMS.h"
+#include "TimingStore.h"
+#include "LoadTest.h"
+
+// 工作任務可接受的指令種類
+enum BmsCommandType : uint8_t
+{
+    BMS_CMD_READ_STATIC = 0,
+    BMS_CMD_READ_DYNAMIC,
+    BMS_CMD_CLEAR_ERRORS,
+    BMS_CMD_LED_ON,
+    BMS_CMD_LED_OFF,
+    BMS_CMD_CALIBRATE_TIMING, // 為目前電池校準最短可靠時序並存入 NVS
+    BMS_CMD_RESET_TIMING,     // 刪除目前電池的時序紀錄，回到安全時序
+    BMS_CMD_STREAM_START,     // 開始 (或變更取樣率) 連續取樣，param = 取樣率 Hz
+    BMS_CMD_STREAM_STOP,      // 停止連續取樣並結束電源會話 (樣本經由 pollSample() 取得)
+    BMS_CMD_LOAD_TEST,        // 負載測試 (設定見 startLoadTest，結果經由 loadTestResult() 取得)
+    BMS_RESULT_LOG            // 只出現在結果中：工作任務的日誌訊息 (message、log_level)，由 loop 轉送給客戶端
+};
+
+struct BmsCommand
+{
+    BmsCommandType type;
+    bool skip_log;  // 此次更新不寫入 MCU CSV 紀錄
+    uint16_t param; // 指令參數 (STREAM_START 的取樣率)
+};
+
+// 連續取樣限制
+static const uint16_t STREAM_MAX_HZ = 20;       // 單次 0xD7 讀取約 25ms，再快就只會錯過時槽
+static const uint8_t STREAM_MAX_FAILURES = 5;   // 連續讀取失敗 (例如電池被拔除) 後自動停止
+static const uint8_t SAMPLE_QUEUE_LEN = 32;     // 約 1.5 秒的 20Hz 樣本，吸收網路端短暫停頓
+static const uint8_t RESULT_QUEUE_LEN = 16;     // 指令結果與工作任務的日誌訊息共用
+static const uint8_t RESULT_QUEUE_RESERVE = 4;  // 日誌訊息不可佔用的最後幾格 (保留給指令結果)
+
+// 動態讀取請求的處理結果
+enum BmsRequestOutcome : uint8_t
+{
+    BMS_REQ_QUEUED = 0, // 已排入新的匯流排讀取
+    BMS_REQ_COALESCED,  // 併入已排隊或執行中的讀取，共用同一個結果
+    BMS_REQ_CACHED,     // 快取夠新，直接回覆快取 (不碰匯流排)
+    BMS_REQ_BUSY        // 指令佇列已滿
+};
+
+// 工作任務回傳給網路端的結果 (數據本體請透過 snapshot() 取得)
+struct BmsResult
+{
+    BmsCommandType type;
+    bool ok;
+    bool skip_log;
+    bool from_cache;   // 由快取直接回覆，未經匯流排
+    uint8_t coalesced; // 併入本次讀取的額外請求數
+    LogLevel log_level; // BMS_RESULT_LOG 的等級
+    char message[160];  // 失敗時的錯誤訊息 (校準成功時為結果摘要，BMS_RESULT_LOG 時為日誌內容)
+};
+
+// 匯流排流量統計
+struct BmsWorkerStats
+{
+    uint32_t dynamic_reads = 0;   // 實際執行的動態讀取次數
+    uint32_t coalesced_hits = 0;  // 併入既有讀取的請求數
+    uint32_t cache_hits = 0;      // 由快取回覆的請求數
+    ReadStats verify;             // 多數決讀取驗證統計 (於每次發布時更新)
+};
+
+// 連續取樣統計 (每次 STREAM_START 時歸零)
+struct BmsStreamStats
+{
+    bool active = false;
+    uint16_t hz = 0;                // 要求的取樣率
+    uint32_t samples = 0;           // 成功取樣數
+    uint32_t failures = 0;          // 讀取失敗數
+    uint32_t dropped = 0;           // 結果佇列已滿、未送達網路端的樣本數
+    uint32_t missed = 0;            // 讀取耗時超過週期而跳過的排程時槽數
+    uint32_t jitter_avg_us = 0;     // 實際開始時間相對排程時間的平均延遲
+    uint32_t jitter_max_us = 0;
+    uint32_t achieved_centi_hz = 0; // 實際達成的取樣率 (0.01 Hz)
+};
+
+// BMS 工作任務：獨佔 MakitaBMS 與匯流排，依序執行佇列中的指令。
+// 網路端 (AsyncTCP 回呼、loop) 只投遞指令與讀取結果，不直接碰觸匯流排。
+class BmsWorker
+{
+public:
+    BmsWorker(MakitaBus &bus, uint8_t enable_pin, int8_t relay_pin = -1);
+
+    // 啟動工作任務 (預設釘選在 APP CPU，讓 WiFi 所在的 PRO CPU 不受匯流排時序影響)
+    bool begin(BaseType_t core = 1, UBaseType_t priority = 1);
+
+    // 在任務啟動前設定 BMS (驗證模式等)。日誌由 begin() 接到結果佇列，經由 poll() 以 BMS_RESULT_LOG 取得
+    MakitaBMS &bms() { return _bms; }
+
+    // 投遞指令，不阻塞；佇列已滿時回傳 false
+    bool post(const BmsCommand &cmd);
+    bool post(BmsCommandType type, bool skip_log = false) { return post(BmsCommand{type, skip_log, 0}); }
+
+    // 連續取樣：在同一個電源會話內依固定排程只送 0xD7 指令 (高速路徑，不讀診斷、不做多數決)，
+    // 每筆樣本放入獨立的樣本佇列。串流進行中再次呼叫 startStream 只變更取樣率。
+    bool startStream(uint16_t hz) { return post(BmsCommand{BMS_CMD_STREAM_START, true, hz}); }
+    bool stopStream() { return post(BMS_CMD_STREAM_STOP, true); }
+    BmsStreamStats streamStats();
+    // 網路端取回連續取樣樣本，不阻塞
+    bool pollSample(DynamicSample &sample);
+
+    // 負載測試：執行期間 (數秒) 工作任務不處理其他指令，樣本同樣經由 pollSample() 送出
+    bool startLoadTest(const LoadTest::Config &cfg);
+    void loadTestResult(LoadTest::Result &out);
+
+    // 請求動態數據：已有讀取在排隊或執行中時直接併入；
+    // max_age_ms > 0 且快取不超過該年齡時，直接以快取回覆
+    BmsRequestOutcome requestDynamic(uint32_t max_age_ms = 0, bool skip_log = false);
+    BmsWorkerStats stats();
+
+    // 網路端取回結果，不阻塞
+    bool poll(BmsResult &result);
+
+    // 取得最新數據的複本
+    void snapshot(BatteryData &data, SupportedFeatures *features = nullptr);
+
+private:
+    MakitaBMS _bms;
+    QueueHandle_t _cmdQueue = nullptr;
+    QueueHandle_t _resultQueue = nullptr;
+    QueueHandle_t _sampleQueue = nullptr;
+    SemaphoreHandle_t _dataMutex = nullptr;
+    TaskHandle_t _task = nullptr;
+
+    BatteryData _work;           // 僅工作任務存取
+    BatteryData _published;      // 受 _dataMutex 保護
+    SupportedFeatures _features; // 受 _dataMutex 保護
+    TimingStore _timingStore;     // 僅工作任務存取 (begin 除外)
+    LoadTest::Result _loadResult; // 受 _dataMutex 保護
+    DynamicSample _loadSamples[LoadTest::MAX_SAMPLES]; // 僅工作任務存取
+
+    // --- 請求合併狀態 (受 _stateLock 保護) ---
+    portMUX_TYPE _stateLock = portMUX_INITIALIZER_UNLOCKED;
+    bool _dynamicPending = false;      // 已有動態讀取在排隊或執行中
+    bool _pendingSkipLog = true;       // 所有併入的請求都要求跳過紀錄時才跳過
+    uint8_t _pendingWaiters = 0;       // 併入的額外請求數
+    bool _hasDynamic = false;          // _published 是否含有有效的動態數據
+    unsigned long _lastDynamicMs = 0;  // 最近一次動態數據發布時間
+    BmsWorkerStats _stats;
+    BmsStreamStats _streamStats;
+    LoadTest::Config _loadConfig;      // 下一次負載測試的設定
+    unsigned long _streamStartMs = 0;  // 本次串流開始時間 (計算實際取樣率)
+
+    // --- 連續取樣排程 (僅工作任務存取) ---
+    bool _streaming = false;
+    uint32_t _streamPeriodUs = 0;
+    uint32_t _nextSampleUs = 0;        // 下一個排程時槽 (micros)
+    uint8_t _streamFailStreak = 0;
+    uint64_t _jitterSumUs = 0;
+
+    static void taskEntry(void *arg);
+    void run();
+    TickType_t streamWaitTicks() const;
+    void streamSample();
+    void endStream();
+    void waitUntil(uint32_t target_us);
+    String runLoadTest(LoadTest::Config cfg);
+    void execute(const BmsCommand &cmd, BmsResult &result);
+    void publish(const SupportedFeatures *features, bool dynamic);
+    void postLog(const String &message, LogLevel level);
+};
+
+#endif
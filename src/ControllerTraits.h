@@ -0,0 +1,65 @@
+#ifndef CONTROLLER_TRAITS_H
+#define CONTROLLER_TRAITS_H
+
+#include <stdint.h>
+
+// 控制器家族 (識別後決定，之後所有協議路徑都依此在編譯期特化)
+enum ControllerType : uint8_t
+{
+    CONTROLLER_UNKNOWN = 0,
+    CONTROLLER_STANDARD,
+    CONTROLLER_F0513
+};
+
+// 各控制器家族的協議參數：指令位元組、幀長度、欄位偏移與支援功能。
+// MakitaBMS 的讀取/控制函數以這些結構為模板參數，每條路徑只寫一次。
+// 新增控制器家族時：新增一個 traits 區塊，並在 MakitaBMS::withController() 加一個 case。
+
+// 標準控制器 (可由 0xDC 讀到型號字串)
+struct StandardController
+{
+    static constexpr ControllerType type = CONTROLLER_STANDARD;
+    static constexpr const char *name() { return "STANDARD"; }
+    static constexpr const char *tag() { return "BMS"; }    // 序列埠偵錯標籤
+    static constexpr const char *rawTag() { return "STD"; } // 原始幀日誌標籤
+
+    // 動態數據：CC + D7 00 00 FF，回應 29 位元組
+    static constexpr uint8_t DYN_OPCODE = 0xD7;
+    static constexpr uint8_t DYN_ARG0 = 0x00;
+    static constexpr uint8_t DYN_ARG1 = 0x00;
+    static constexpr uint8_t DYN_ARG2 = 0xFF;
+    static constexpr uint8_t DYN_FRAME_LEN = 29;
+
+    // 動態幀欄位偏移 (皆為 little-endian 16 位元)
+    static constexpr uint8_t PACK_V_OFFSET = 0;  // mV
+    static constexpr uint8_t CELL_V_OFFSET = 2;  // mV，每顆 2 位元組
+    static constexpr uint8_t CELL_COUNT = 5;
+    static constexpr uint8_t TEMP1_OFFSET = 14;  // 0.01°C
+    static constexpr uint8_t TEMP2_OFFSET = 16;  // 0.01°C
+
+    // 0x33 控制指令：D9 96 A5 解鎖後送 DA + 參數
+    static constexpr uint8_t ACTION_OPCODE = 0xDA;
+    static constexpr uint8_t LED_ON_ARG = 0x31;
+    static constexpr uint8_t LED_OFF_ARG = 0x34;
+    static constexpr uint8_t CLEAR_ERRORS_ARG = 0x04;
+
+    // 對前端公開的功能
+    static constexpr bool FEATURE_LED_TEST = true;
+    static constexpr bool FEATURE_CLEAR_ERRORS = true;
+};
+
+// F0513 控制器 (型號需由第二指令樹 0x31 取得)。
+// 目前協議參數與標準控制器相同，僅標籤與對外公開的功能不同；需調整時在此覆寫。
+struct F0513Controller : StandardController
+{
+    static constexpr ControllerType type = CONTROLLER_F0513;
+    static constexpr const char *name() { return "F0513"; }
+    static constexpr const char *tag() { return "F0513"; }
+    static constexpr const char *rawTag() { return "F0513"; }
+
+    // LED / 清除錯誤尚未在 F0513 實機上驗證，暫不對前端開放
+    static constexpr bool FEATURE_LED_TEST = false;
+    static constexpr bool FEATURE_CLEAR_ERRORS = false;
+};
+
+#endif
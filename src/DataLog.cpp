@@ -0,0 +1,575 @@
+#include "DataLog.h"
+#include "Analytics.h"
+
+static const uint32_t LOG_MAGIC = 0x474C4B4D; // "MKLG"
+static const uint16_t LOG_VERSION = 1;
+
+const char LOG_CSV_HEADER[] =
+    "Timestamp,Model,Serial,ROM ID,Capacity,Prod_Date,Pack Voltage (mV),Cell 1 (mV),Cell 2 (mV),Cell 3 (mV),Cell 4 (mV),Cell 5 (mV),"
+    "Cell Diff (mV),Temp 1 (0.01C),Temp 2 (0.01C),Temp 3 (0.01C),Status Code,Lock Status,Charge Cycles,Over Discharge,Over Load,"
+    "Err 04,Err 05,Err 06,Err 07,Fuse Blown,SOH (%)";
+
+// --- 紀錄轉換 ---
+
+uint16_t crc16Ccitt(const void *data, size_t len, uint16_t crc)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)p[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+bool writeFileAtomic(fs::FS &fs, const char *path, const void *head, size_t head_len, const void *body, size_t body_len)
+{
+    char tmp[32]; // SPIFFS 檔名上限 32 位元組
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    File f = fs.open(tmp, "w");
+    if (!f)
+        return false;
+    bool ok = f.write(static_cast<const uint8_t *>(head), head_len) == head_len &&
+              (body_len == 0 || f.write(static_cast<const uint8_t *>(body), body_len) == body_len);
+    f.close();
+    if (!ok)
+    {
+        fs.remove(tmp);
+        return false;
+    }
+    if (fs.exists(path) && !fs.remove(path))
+        return false;
+    return fs.rename(tmp, path);
+}
+
+void recoverTempFile(fs::FS &fs, const char *path)
+{
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!fs.exists(tmp))
+        return;
+    // 舊檔仍在表示暫存檔可能沒寫完 (或刪除舊檔前斷電)：以舊檔為準
+    if (fs.exists(path))
+        fs.remove(tmp);
+    else
+        fs.rename(tmp, path);
+}
+
+uint16_t logRecordCrc(const LogRecord &rec)
+{
+    return crc16Ccitt(&rec, offsetof(LogRecord, crc));
+}
+
+void makeLogRecord(const BatteryData &data, uint32_t time, LogRecord &out)
+{
+    memset(&out, 0, sizeof(out));
+    out.time = time;
+    memcpy(out.rom_id, data.rom_id, sizeof(out.rom_id));
+    strlcpy(out.model, data.model, sizeof(out.model));
+    out.prod_year = data.prod_year;
+    out.prod_month = data.prod_month;
+    out.prod_day = data.prod_day;
+    out.capacity_deci_ah = data.capacity_deci_ah;
+    out.pack_mv = data.pack_mv;
+    memcpy(out.cell_mv, data.cell_mv, sizeof(out.cell_mv));
+    out.cell_diff_mv = data.cell_diff_mv;
+    out.temp1_centi = data.temp1_centi;
+    out.temp2_centi = data.temp2_centi;
+    out.temp3_centi = data.temp3_centi;
+    out.status_code = data.status_code_raw;
+    out.charge_cycles = (uint16_t)data.charge_cycles;
+    out.lock_status = data.lock_status;
+    out.over_discharge = data.over_discharge;
+    out.over_load = data.over_load;
+    out.fuse_blown = data.fuse_blown;
+    out.err_cnt[0] = data.err_cnt_04;
+    out.err_cnt[1] = data.err_cnt_05;
+    out.err_cnt[2] = data.err_cnt_06;
+    out.err_cnt[3] = data.err_cnt_07;
+}
+
+void logRecordToData(const LogRecord &rec, BatteryData &out)
+{
+    out = BatteryData();
+    memcpy(out.rom_id, rec.rom_id, sizeof(out.rom_id));
+    strlcpy(out.model, rec.model, sizeof(out.model));
+    out.prod_year = rec.prod_year;
+    out.prod_month = rec.prod_month;
+    out.prod_day = rec.prod_day;
+    out.capacity_deci_ah = rec.capacity_deci_ah;
+    out.pack_mv = rec.pack_mv;
+    memcpy(out.cell_mv, rec.cell_mv, sizeof(out.cell_mv));
+    out.cell_diff_mv = rec.cell_diff_mv;
+    out.temp1_centi = rec.temp1_centi;
+    out.temp2_centi = rec.temp2_centi;
+    out.temp3_centi = rec.temp3_centi;
+    out.status_code_raw = rec.status_code;
+    out.charge_cycles = rec.charge_cycles;
+    out.lock_status = rec.lock_status;
+    out.over_discharge = rec.over_discharge;
+    out.over_load = rec.over_load;
+    out.fuse_blown = rec.fuse_blown;
+    out.err_cnt_04 = rec.err_cnt[0];
+    out.err_cnt_05 = rec.err_cnt[1];
+    out.err_cnt_06 = rec.err_cnt[2];
+    out.err_cnt_07 = rec.err_cnt[3];
+}
+
+// --- 時間戳 ---
+
+// 公曆日期換算 2000-01-01 起的天數 (Howard Hinnant 的 days_from_civil)
+static int32_t daysFromCivil(int y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 730425; // 730425 = 2000-01-01
+}
+
+uint32_t parseLogTime(const char *text)
+{
+    int y, mo, d, h, mi, s;
+    if (text == nullptr || sscanf(text, "%d/%d/%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6)
+        return 0;
+    if (y < 2000 || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 59)
+        return 0;
+    return (uint32_t)daysFromCivil(y, mo, d) * 86400UL + h * 3600UL + mi * 60UL + s;
+}
+
+void formatLogTime(uint32_t time, char *out)
+{
+    if (time == 0)
+    {
+        out[0] = '\0';
+        return;
+    }
+    // civil_from_days 的反向換算
+    int32_t z = (int32_t)(time / 86400) + 730425;
+    uint32_t secs = time % 86400;
+    const int32_t era = z / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    const int y = (int)yoe + era * 400 + (m <= 2);
+    snprintf(out, 20, "%04d/%02u/%02u %02u:%02u:%02u", y, m, d,
+             (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60));
+}
+
+// --- CSV ---
+
+size_t formatCsvRow(const LogRecord &rec, char *out, size_t len)
+{
+    BatteryData data;
+    logRecordToData(rec, data);
+    BatteryLabels labels;
+    formatBatteryLabels(data, labels);
+    char ts[20];
+    formatLogTime(rec.time, ts);
+
+    // SOH 與即時遙測使用同一個估計 (Analytics)
+    uint16_t soh = estimateSohCenti(rec.charge_cycles, rec.over_discharge, rec.over_load,
+                                    rec.err_cnt[0] + rec.err_cnt[1] + rec.err_cnt[2] + rec.err_cnt[3]);
+
+    int n = snprintf(out, len,
+                     "\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",%u,%u,%u,%u,%u,%u,%u,%d,%d,%d,\"%s\",%d,%d,%d,%d,%d,%d,%d,%d,%d,%u\n",
+                     ts, data.model, labels.serial, labels.rom_id, labels.capacity, labels.prod_date,
+                     rec.pack_mv, rec.cell_mv[0], rec.cell_mv[1], rec.cell_mv[2], rec.cell_mv[3], rec.cell_mv[4], rec.cell_diff_mv,
+                     rec.temp1_centi, rec.temp2_centi, rec.temp3_centi, labels.status_hex, rec.lock_status, rec.charge_cycles,
+                     rec.over_discharge, rec.over_load, rec.err_cnt[0], rec.err_cnt[1], rec.err_cnt[2], rec.err_cnt[3],
+                     rec.fuse_blown, (soh + 50) / 100);
+    return n < 0 ? 0 : min((size_t)n, len - 1);
+}
+
+// --- 環形紀錄檔 ---
+
+bool DataLog::begin(fs::FS &fs, uint16_t capacity)
+{
+    // 讀取端可能仍持有槽位雜湊表：容量只在第一次 begin 時決定
+    if (_romHash && capacity != _capacity)
+        return false;
+    _fs = &fs;
+    _capacity = capacity;
+    if (_groupSize > _capacity)
+        _groupSize = _capacity;
+
+    LogHeader header = {};
+    bool valid = false;
+    if (_fs->exists(_path))
+    {
+        File f = _fs->open(_path, "r");
+        valid = f && f.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                header.magic == LOG_MAGIC && header.version == LOG_VERSION &&
+                header.record_size == sizeof(LogRecord) && header.capacity == capacity &&
+                f.size() == slotOffset(capacity);
+        if (f)
+            f.close();
+    }
+    if (!valid && !create())
+        return false;
+
+    _file = _fs->open(_path, "r+");
+    if (!_file)
+        return false;
+    if (!_romHash)
+        _romHash.reset(new uint16_t[_capacity]());
+
+    // 以序號還原寫入位置：最大序號的下一個槽位即為 head；
+    // 同時建立槽位雜湊，並把目錄尚未收錄的紀錄 (提交後、目錄寫回前斷電) 補進目錄
+    portENTER_CRITICAL(&_mux);
+    memset(_romHash.get(), 0, (size_t)_capacity * sizeof(uint16_t));
+    _pending = 0;
+    _count = 0;
+    _nextSeq = 1;
+    _head = 0;
+    portEXIT_CRITICAL(&_mux);
+    uint16_t count = 0, head = 0;
+    uint32_t next_seq = 1;
+    uint32_t indexed = _index ? _index->lastSeq() : 0;
+    LogRecord rec;
+    for (uint16_t slot = 0; slot < _capacity; slot++)
+    {
+        if (!readSlot(_file, slot, rec))
+            continue;
+        uint16_t h = romHash(rec.rom_id);
+        portENTER_CRITICAL(&_mux);
+        _romHash[slot] = h;
+        portEXIT_CRITICAL(&_mux);
+        if (_index && rec.seq > indexed)
+            _index->add(rec);
+        count++;
+        if (rec.seq >= next_seq)
+        {
+            next_seq = rec.seq + 1;
+            head = (slot + 1) % _capacity;
+        }
+    }
+    portENTER_CRITICAL(&_mux);
+    _count = count;
+    _nextSeq = next_seq;
+    _head = head;
+    portEXIT_CRITICAL(&_mux);
+    if (_index)
+    {
+        _index->sync(lastSeq());
+        writeIndex(true);
+    }
+    return true;
+}
+
+// 建立空白紀錄檔 (全部槽位預先配置，之後只覆寫不增長)
+bool DataLog::create()
+{
+    File f = _fs->open(_path, "w");
+    if (!f)
+        return false;
+
+    LogHeader header = {};
+    header.magic = LOG_MAGIC;
+    header.version = LOG_VERSION;
+    header.record_size = sizeof(LogRecord);
+    header.capacity = _capacity;
+    f.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+
+    LogRecord empty;
+    memset(&empty, 0, sizeof(empty));
+    for (uint16_t slot = 0; slot < _capacity; slot++)
+        f.write(reinterpret_cast<const uint8_t *>(&empty), sizeof(empty));
+    bool ok = f.size() == slotOffset(_capacity);
+    f.close();
+    return ok;
+}
+
+uint16_t DataLog::romHash(const uint8_t *rom_id)
+{
+    uint16_t h = crc16Ccitt(rom_id, 8);
+    return h ? h : 1; // 0 保留給空槽
+}
+
+bool DataLog::readSlot(File &f, uint16_t slot, LogRecord &out) const
+{
+    if (!f || !f.seek(slotOffset(slot)) ||
+        f.read(reinterpret_cast<uint8_t *>(&out), sizeof(out)) != sizeof(out))
+        return false;
+    return out.seq != 0 && out.crc == logRecordCrc(out);
+}
+
+bool DataLog::append(const BatteryData &data, uint32_t time)
+{
+    if (!_file)
+        return false;
+
+    uint32_t start = micros();
+    LogRecord &rec = _stage[_pending];
+    makeLogRecord(data, time, rec);
+    portENTER_CRITICAL(&_mux); // 讀取端以 _nextSeq 與 _pending 計算最新已提交的序號
+    rec.seq = _nextSeq++;
+    bool first = _pending++ == 0;
+    portEXIT_CRITICAL(&_mux);
+    rec.crc = logRecordCrc(rec);
+    if (first)
+        _firstPendingMs = millis();
+
+    uint32_t elapsed = micros() - start;
+    _stats.appends++;
+    _stats.last_append_us = elapsed;
+    _stats.total_append_us += elapsed;
+    if (elapsed > _stats.max_append_us)
+        _stats.max_append_us = elapsed;
+
+    return _pending >= _groupSize ? commit() : true;
+}
+
+bool DataLog::writeSlots(uint16_t slot, const LogRecord *recs, uint16_t n)
+{
+    size_t len = (size_t)n * sizeof(LogRecord);
+    return _file.seek(slotOffset(slot)) &&
+           _file.write(reinterpret_cast<const uint8_t *>(recs), len) == len;
+}
+
+bool DataLog::commit()
+{
+    if (_pending == 0)
+        return true;
+    if (!_file)
+        return false;
+
+    uint32_t start = micros();
+    // 跨越檔尾時分成兩段，其餘情況整組一次寫入、只 flush 一次
+    uint16_t first = min<uint16_t>(_pending, _capacity - _head);
+    bool ok = writeSlots(_head, _stage, first) &&
+              (first == _pending || writeSlots(0, _stage + first, _pending - first));
+    _file.flush();
+
+    if (!ok)
+    {
+        // 捨棄這一組並收回序號：寫到一半的槽位之後會以相同序號覆寫，開機掃描仍以 CRC 為準
+        portENTER_CRITICAL(&_mux);
+        _nextSeq -= _pending;
+        _pending = 0;
+        portEXIT_CRITICAL(&_mux);
+        _stats.commit_failures++;
+        return false;
+    }
+
+    uint16_t hashes[LOG_STAGE_MAX];
+    for (uint8_t i = 0; i < _pending; i++)
+        hashes[i] = romHash(_stage[i].rom_id);
+    uint8_t committed = _pending;
+    portENTER_CRITICAL(&_mux);
+    for (uint8_t i = 0; i < committed; i++)
+        _romHash[(_head + i) % _capacity] = hashes[i];
+    _head = (_head + committed) % _capacity;
+    _count = min<uint16_t>(_count + committed, _capacity);
+    _pending = 0;
+    portEXIT_CRITICAL(&_mux);
+
+    // 目錄只在 RAM 中更新，由 commitIfDue / saveIndex 寫回
+    if (_index)
+    {
+        for (uint8_t i = 0; i < committed; i++)
+            _index->add(_stage[i]);
+    }
+    _stats.bytes_written += (uint32_t)committed * sizeof(LogRecord);
+    _stats.records_committed += committed;
+
+    uint32_t elapsed = micros() - start;
+    _stats.commits++;
+    _stats.last_commit_us = elapsed;
+    _stats.total_commit_us += elapsed;
+    if (elapsed > _stats.max_commit_us)
+        _stats.max_commit_us = elapsed;
+    return true;
+}
+
+bool DataLog::commitIfDue()
+{
+    bool ok = _pending == 0 || millis() - _firstPendingMs < _maxDelayMs || commit();
+    return writeIndex(false) && ok;
+}
+
+bool DataLog::saveIndex()
+{
+    return writeIndex(true);
+}
+
+// 寫回電池目錄，寫入量計入統計 (與紀錄本身共用 bytes_written)
+bool DataLog::writeIndex(bool force)
+{
+    if (!_index || !_index->dirty())
+        return true;
+    size_t len = _index->fileSize();
+    if (!(force ? _index->save() : _index->saveIfDue()))
+        return false;
+    if (!_index->dirty())
+    {
+        _stats.bytes_written += len;
+        _stats.index_saves++;
+    }
+    return true;
+}
+
+void DataLog::setCommitPolicy(uint8_t group_size, uint32_t max_delay_ms)
+{
+    _groupSize = constrain(group_size, 1, LOG_STAGE_MAX);
+    if (_capacity > 0 && _groupSize > _capacity)
+        _groupSize = _capacity;
+    _maxDelayMs = max_delay_ms;
+}
+
+void DataLog::clear()
+{
+    if (!_fs)
+        return;
+    portENTER_CRITICAL(&_mux);
+    _pending = 0;
+    portEXIT_CRITICAL(&_mux);
+    if (_file)
+        _file.close();
+    if (_index)
+        _index->clear();
+    // 重建空白檔再重新開啟 (begin 會沿用格式相符的既有檔案)
+    if (create())
+        begin(*_fs, _capacity);
+}
+
+File DataLog::openReader() const
+{
+    return _fs ? _fs->open(_path, "r") : File();
+}
+
+void DataLog::readerStart(uint16_t &head, uint32_t &last_seq) const
+{
+    portENTER_CRITICAL(&_mux);
+    head = _head;
+    last_seq = lastSeq();
+    portEXIT_CRITICAL(&_mux);
+}
+
+uint16_t DataLog::slotRomHash(uint16_t slot) const
+{
+    portENTER_CRITICAL(&_mux);
+    uint16_t h = (_romHash && slot < _capacity) ? _romHash[slot] : 0;
+    portEXIT_CRITICAL(&_mux);
+    return h;
+}
+
+// --- 篩選與分塊 CSV ---
+
+bool LogFilter::matches(const LogRecord &rec) const
+{
+    // 未知時間的紀錄只在未指定時間範圍時輸出
+    if ((from != 0 || to != 0xFFFFFFFF) && (rec.time == 0 || rec.time < from || rec.time > to))
+        return false;
+    size_t len = strlen(rom);
+    if (len == 0)
+        return true;
+    char hex[17];
+    formatRomId(rec.rom_id, hex);
+    return strcmp(hex + 16 - len, rom) == 0;
+}
+
+bool parseLogTimeArg(const char *text, bool end_of_day, uint32_t &out)
+{
+    out = end_of_day ? 0xFFFFFFFF : 0;
+    if (text == nullptr || text[0] == '\0')
+        return true;
+    char buf[20];
+    strlcpy(buf, text, sizeof(buf));
+    for (char *p = buf; *p; p++)
+        if (*p == '-' || *p == 'T')
+            *p = (*p == '-') ? '/' : ' ';
+    size_t len = strlen(buf);
+    if (len <= 10) // 只有日期
+        strlcpy(buf + len, end_of_day ? " 23:59:59" : " 00:00:00", sizeof(buf) - len);
+    uint32_t t = parseLogTime(buf);
+    if (t == 0)
+        return false;
+    out = t;
+    return true;
+}
+
+bool parseRomArg(const char *text, char *out17)
+{
+    out17[0] = '\0';
+    if (text == nullptr)
+        return true;
+    if (strncasecmp(text, "ID-", 3) == 0)
+        text += 3;
+    size_t len = strlen(text);
+    if (len > 16)
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isxdigit((unsigned char)text[i]))
+            return false;
+        out17[i] = (char)toupper((unsigned char)text[i]);
+    }
+    out17[len] = '\0';
+    return true;
+}
+
+LogCsvStream::LogCsvStream(const DataLog &log, const LogFilter &filter)
+    : _log(log), _filter(filter), _reader(log.openReader())
+{
+    _log.readerStart(_start, _maxSeq);
+    uint8_t rom_id[8];
+    if (strlen(_filter.rom) == 16)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            char byte[3] = {_filter.rom[i * 2], _filter.rom[i * 2 + 1], '\0'};
+            rom_id[i] = (uint8_t)strtoul(byte, nullptr, 16);
+        }
+        _hash = DataLog::romHash(rom_id);
+        _useHash = true;
+    }
+}
+
+// 取下一筆符合條件的紀錄並格式化到 _line；沒有更多紀錄時回傳 false
+bool LogCsvStream::nextLine()
+{
+    LogRecord rec;
+    while (_pos < _log.capacity())
+    {
+        uint16_t slot = (_start + _pos++) % _log.capacity();
+        if (_useHash && _log.slotRomHash(slot) != _hash)
+            continue;
+        if (!_log.readSlot(_reader, slot, rec) || rec.seq > _maxSeq || !_filter.matches(rec))
+            continue;
+        _lineLen = formatCsvRow(rec, _line, sizeof(_line));
+        _lineOff = 0;
+        _rows++;
+        return true;
+    }
+    return false;
+}
+
+size_t LogCsvStream::read(uint8_t *buf, size_t max_len)
+{
+    if (!_headerDone)
+    {
+        // UTF-8 BOM 解決 Excel 中文亂碼
+        _lineLen = snprintf(_line, sizeof(_line), "\xEF\xBB\xBF%s\n", LOG_CSV_HEADER);
+        _lineLen = min(_lineLen, sizeof(_line) - 1);
+        _lineOff = 0;
+        _headerDone = true;
+    }
+
+    size_t n = 0;
+    while (n < max_len)
+    {
+        if (_lineOff >= _lineLen && (!_reader || !nextLine()))
+            break;
+        size_t chunk = min(_lineLen - _lineOff, max_len - n);
+        memcpy(buf + n, _line + _lineOff, chunk);
+        _lineOff += chunk;
+        n += chunk;
+    }
+    return n;
+}
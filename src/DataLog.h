@@ -0,0 +1,216 @@
+#ifndef DATA_LOG_H
+#define DATA_LOG_H
+
+#include <Arduino.h>
+#include <memory>
+#include "FS.h"
+#include "MakitaBMS.h"
+#include "LogIndex.h"
+
+// MCU 紀錄：SPIFFS 上的固定長度環形紀錄檔，取代逐行改寫的 /datalog.csv。
+//
+// 檔案格式：
+//   [0..15]  LogHeader (格式、紀錄長度、容量；建立時寫入一次)
+//   [16..]   capacity 個 LogRecord 槽位，第 n 筆寫入槽位 (seq - 1) % capacity
+//
+// 新增紀錄只覆寫一個槽位 (O(1))。每筆紀錄自帶序號與 CRC：
+// 斷電造成的半筆紀錄會因 CRC 不符而被略過，開機時掃描序號即可還原 head/tail，
+// 不需要每次寫入都改寫標頭 (那會讓寫入量加倍，且標頭本身也可能寫到一半)。
+//
+// 寫入採延後提交 (write-behind)：append 只把紀錄放進 RAM 暫存區，累積到 group_size 筆、
+// 最舊一筆等待超過 max_delay_ms (由 commitIfDue 檢查) 或呼叫 commit() 時，
+// 才把連續的槽位一次寫入並 flush。讀取端只看得到已提交的紀錄；斷電最多遺失暫存區內的紀錄。
+//
+// 可選的 LogIndex (電池目錄) 在提交時同步更新 (只改 RAM；目錄檔由 commitIfDue 延遲寫回、saveIndex 立即寫回)；
+// 另在 RAM 中保存每個槽位的 ROM ID 雜湊，
+// 查詢單一電池的紀錄時只需讀取雜湊相符的槽位，不必讀遍整個檔案。
+
+struct LogHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint16_t capacity;
+    uint8_t reserved[6];
+};
+static_assert(sizeof(LogHeader) == 16, "LogHeader layout");
+
+// 一筆紀錄：由 BatteryData 取出 CSV 需要的欄位 (原始整數單位)
+struct LogRecord
+{
+    uint32_t seq;  // 寫入序號 (從 1 開始遞增)，0 表示空槽
+    uint32_t time; // 客戶端時間 (2000-01-01 起的秒數，本地時間)，0 表示未知
+    uint8_t rom_id[8];
+    char model[16];
+    uint8_t prod_year;
+    uint8_t prod_month;
+    uint8_t prod_day;
+    uint8_t capacity_deci_ah;
+    uint16_t pack_mv;
+    uint16_t cell_mv[5];
+    uint16_t cell_diff_mv;
+    int16_t temp1_centi;
+    int16_t temp2_centi;
+    int16_t temp3_centi;
+    uint16_t status_code;
+    uint16_t charge_cycles;
+    uint8_t lock_status;
+    uint8_t over_discharge;
+    uint8_t over_load;
+    uint8_t fuse_blown;
+    uint8_t err_cnt[4]; // 04h..07h
+    uint16_t reserved;
+    uint16_t crc; // 以上所有位元組的 CRC-16/CCITT
+};
+static_assert(sizeof(LogRecord) == 72, "LogRecord layout is stored on flash");
+
+static const uint8_t LOG_STAGE_MAX = 16; // RAM 暫存區容量 (筆)
+
+// 寫入統計 (供效能比較)
+struct DataLogStats
+{
+    uint32_t appends = 0;
+    uint32_t last_append_us = 0; // append 只放入暫存區的耗時 (不含提交)
+    uint32_t max_append_us = 0;
+    uint64_t total_append_us = 0;
+    uint32_t commits = 0;
+    uint32_t records_committed = 0;
+    uint32_t last_commit_us = 0; // 一次提交 (寫入 + flush) 的耗時
+    uint32_t max_commit_us = 0;
+    uint64_t total_commit_us = 0;
+    uint32_t commit_failures = 0; // 寫入失敗而捨棄暫存紀錄的次數
+    uint64_t bytes_written = 0; // 應用層寫入的位元組數 (含電池目錄的寫回，不含 SPIFFS 頁面的額外開銷)
+    uint32_t index_saves = 0;   // 電池目錄寫回次數
+};
+
+class DataLog
+{
+public:
+    explicit DataLog(const char *path) : _path(path) {}
+
+    // 須在 begin 之前設定 (begin 掃描時會補上尚未索引的紀錄)
+    void setIndex(LogIndex *index) { _index = index; }
+    // 開啟或建立紀錄檔 (格式或容量不符時重建)，並掃描還原寫入位置
+    bool begin(fs::FS &fs, uint16_t capacity);
+
+    // 放入暫存區；達到 group_size 筆時立即提交 (回傳值為提交結果)
+    bool append(const BatteryData &data, uint32_t time);
+    // 將暫存區寫入檔案；沒有暫存紀錄時直接回傳 true
+    bool commit();
+    // 最舊的暫存紀錄已等待超過 max_delay_ms 時提交，電池目錄變動逾時後寫回 (由 loop 定期呼叫)
+    bool commitIfDue();
+    // 立即寫回變動過的電池目錄 (重新開機前、明確要求提交時)
+    bool saveIndex();
+    // 提交條件：group_size 1 即每筆直接寫入 (上限 LOG_STAGE_MAX)
+    void setCommitPolicy(uint8_t group_size, uint32_t max_delay_ms);
+    // 清除所有紀錄 (含尚未提交的暫存紀錄)
+    void clear();
+
+    uint16_t capacity() const { return _capacity; }
+    uint16_t count() const { return _count; }                  // 已提交的筆數
+    uint8_t pending() const { return _pending; }               // 暫存區內尚未提交的筆數
+    uint32_t lastSeq() const { return _nextSeq - 1 - _pending; } // 最新一筆已提交紀錄的序號
+    uint32_t lastStagedSeq() const { return _nextSeq - 1; }
+    const DataLogStats &stats() const { return _stats; }
+
+    // 讀取端 (可在寫入端開啟時由其他任務使用獨立的檔案代碼讀取)：
+    // 由 head 起依序讀取 capacity 個槽位即為由舊到新；空槽或損毀時回傳 false。
+    File openReader() const;
+    // 同時取得最舊紀錄的槽位與最新已提交的序號 (兩者需一致，以 portMUX 保護)
+    void readerStart(uint16_t &head, uint32_t &last_seq) const;
+    bool readSlot(File &f, uint16_t slot, LogRecord &out) const;
+    // 槽位紀錄的 ROM ID 雜湊 (空槽為 0)；雜湊相符仍須讀出紀錄比對完整 ROM ID
+    uint16_t slotRomHash(uint16_t slot) const;
+    static uint16_t romHash(const uint8_t *rom_id);
+
+private:
+    bool writeIndex(bool force);
+    const char *_path;
+    fs::FS *_fs = nullptr;
+    File _file;
+    uint16_t _capacity = 0;
+    uint16_t _count = 0;
+    uint16_t _head = 0; // 下一個寫入的槽位 (同時也是最舊紀錄的槽位)
+    uint32_t _nextSeq = 1;
+    DataLogStats _stats;
+    LogIndex *_index = nullptr;
+    // 只在第一次 begin 時配置 (之後清除紀錄只就地歸零)：分塊下載進行中的讀取端仍會查詢此表
+    std::unique_ptr<uint16_t[]> _romHash;
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // 暫存區：_stage[0.._pending) 依序對應 _head 起的連續槽位
+    LogRecord _stage[LOG_STAGE_MAX];
+    uint8_t _pending = 0;
+    uint8_t _groupSize = LOG_STAGE_MAX;
+    uint32_t _maxDelayMs = 10000;
+    uint32_t _firstPendingMs = 0;
+
+    bool create();
+    bool writeSlots(uint16_t slot, const LogRecord *recs, uint16_t n);
+    static size_t slotOffset(uint16_t slot) { return sizeof(LogHeader) + (size_t)slot * sizeof(LogRecord); }
+};
+
+// 紀錄與 BatteryData 互轉 (不含的欄位保持預設值)
+void makeLogRecord(const BatteryData &data, uint32_t time, LogRecord &out);
+void logRecordToData(const LogRecord &rec, BatteryData &out);
+uint16_t logRecordCrc(const LogRecord &rec);
+// CRC-16/CCITT (多項式 0x1021)，crc 可傳入前一段的結果以串接計算
+uint16_t crc16Ccitt(const void *data, size_t len, uint16_t crc = 0xFFFF);
+
+// 以暫存檔 (path + ".tmp") 取代整個檔案：寫完暫存檔才刪除舊檔並改名 (SPIFFS 的 rename 不能覆蓋既有檔案)。
+// 寫到一半斷電時舊檔仍完整；刪除與改名之間斷電時只剩暫存檔，由 recoverTempFile 在開機載入前補完改名。
+bool writeFileAtomic(fs::FS &fs, const char *path, const void *head, size_t head_len, const void *body, size_t body_len);
+void recoverTempFile(fs::FS &fs, const char *path);
+
+// 時間戳："YYYY/MM/DD HH:mm:ss" (前端 getFormattedTimestamp 格式) 與 2000-01-01 起秒數互轉
+uint32_t parseLogTime(const char *text);
+void formatLogTime(uint32_t time, char *out); // out 至少 20 位元組；0 輸出空字串
+
+// CSV：標頭與單行 (與舊版 /datalog.csv 欄位相同)
+extern const char LOG_CSV_HEADER[];
+size_t formatCsvRow(const LogRecord &rec, char *out, size_t len);
+
+// 下載篩選條件 (/datalog.csv?from=&to=&rom=)
+struct LogFilter
+{
+    uint32_t from = 0;          // 含；0 表示不限
+    uint32_t to = 0xFFFFFFFF;   // 含
+    char rom[17] = "";          // ROM ID 後綴 (十六進位，不分大小寫)；可給完整 ROM ID 或序號的 ID- 部分
+    bool matches(const LogRecord &rec) const;
+};
+
+// 篩選參數："YYYY/MM/DD HH:mm:ss"、"YYYY-MM-DD HH:mm:ss" 或只有日期 (end_of_day 時取當天 23:59:59)；
+// 空字串表示不限，格式錯誤時回傳 false
+bool parseLogTimeArg(const char *text, bool end_of_day, uint32_t &out);
+// 篩選參數：去掉 "ID-" 前綴並轉大寫，非十六進位字元時回傳 false
+bool parseRomArg(const char *text, char *out17);
+
+// 逐段產生 CSV (供分塊 HTTP 回應使用)：一次只保留一行的緩衝區，與紀錄數量無關。
+// 建立時記下目前的最新序號，之後寫入的紀錄 (以及因環形覆寫而變新的槽位) 不會混入。
+class LogCsvStream
+{
+public:
+    LogCsvStream(const DataLog &log, const LogFilter &filter);
+    // 填入最多 max_len 位元組，回傳 0 表示結束
+    size_t read(uint8_t *buf, size_t max_len);
+    uint32_t rows() const { return _rows; }
+
+private:
+    const DataLog &_log;
+    LogFilter _filter;
+    File _reader;
+    uint16_t _start;     // 起始槽位 (建立當下最舊的紀錄)
+    uint16_t _pos = 0;   // 已掃描的槽位數
+    uint32_t _maxSeq;    // 只輸出序號不超過此值的紀錄
+    uint32_t _rows = 0;
+    bool _useHash = false; // 篩選完整 ROM ID 時，先以槽位雜湊略過其他電池的紀錄
+    uint16_t _hash = 0;
+    bool _headerDone = false;
+    char _line[384];     // 需容納 BOM + 標頭列
+    size_t _lineLen = 0;
+    size_t _lineOff = 0;
+
+    bool nextLine();
+};
+
+#endif
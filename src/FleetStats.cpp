@@ -0,0 +1,373 @@
+#include "FleetStats.h"
+#include "Analytics.h"
+#include "DataLog.h"
+
+static const uint32_t FLEET_MAGIC = 0x4C464B4D; // "MKFL"
+static const uint16_t FLEET_VERSION = 1;
+static const uint32_t FLEET_SAVE_DELAY_MS = 30000;  // 狀態變動後的寫回延遲
+static const uint32_t FLEET_TOUCH_SAVE_MS = 600000; // 只有讀取次數/時間變動時的寫回間隔
+
+const uint16_t FLEET_CYCLE_EDGES[FLEET_CYCLE_BUCKETS] = {0, 50, 100, 200, 300, 500, 750, 1000};
+const uint16_t FLEET_EVENT_EDGES[FLEET_EVENT_BUCKETS] = {0, 1, 5, 10, 20, 50};
+const uint16_t FLEET_IMBALANCE_EDGES[FLEET_IMBALANCE_BUCKETS] = {0, 10, 20, 50, 100, 200};
+
+const uint16_t FLEET_FAIL_FLAGS = ANOMALY_LOCKED | ANOMALY_FUSE_BLOWN | ANOMALY_ERROR_COUNTS |
+                                  ANOMALY_LOW_SOH | ANOMALY_CELL_IMBALANCE;
+
+static uint8_t bucketOf(uint16_t value, const uint16_t *edges, uint8_t n)
+{
+    uint8_t i = n - 1;
+    while (i > 0 && value < edges[i])
+        i--;
+    return i;
+}
+
+static void bump(uint16_t &counter, int sign)
+{
+    if (sign > 0)
+        counter++;
+    else if (counter > 0)
+        counter--;
+}
+
+static uint8_t capAt(uint8_t value, uint8_t last)
+{
+    return value < last ? value : last;
+}
+
+static bool hasCellVoltages(const BatteryData &data)
+{
+    for (int i = 0; i < 5; i++)
+        if (data.cell_mv[i] > CELL_VALID_MV)
+            return true;
+    return false;
+}
+
+// 不含讀取次數與時間的內容是否相同 (決定是否需要盡快寫回)
+static bool sameState(FleetEntry a, FleetEntry b)
+{
+    a.reads = b.reads = 0;
+    a.touched = b.touched = 0;
+    a.last_time = b.last_time = 0;
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+bool FleetStats::begin(fs::FS &fs)
+{
+    _fs = &fs;
+    _count = 0;
+    _touched = 0;
+    _dirty = false;
+    _touchedOnly = false;
+
+    uint32_t evicted = 0;
+    bool valid = true;
+    recoverTempFile(fs, _path);
+    File f = _fs->open(_path, "r");
+    if (f)
+    {
+        FleetFileHeader header = {};
+        valid = f.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                header.magic == FLEET_MAGIC && header.version == FLEET_VERSION &&
+                header.entry_size == sizeof(FleetEntry) && header.count <= FLEET_MAX;
+        size_t len = valid ? (size_t)header.count * sizeof(FleetEntry) : 0;
+        valid = valid && f.read(reinterpret_cast<uint8_t *>(_entries), len) == len &&
+                crc16Ccitt(_entries, len) == header.crc;
+        f.close();
+        if (valid)
+        {
+            _count = header.count;
+            _touched = header.touched;
+            evicted = header.evicted;
+        }
+    }
+
+    portENTER_CRITICAL(&_mux);
+    rebuild();
+    _sum.evicted = evicted;
+    portEXIT_CRITICAL(&_mux);
+    _lastSaveMs = millis();
+    if (!valid)
+    {
+        // 下次寫回時以空表覆寫損毀的檔案
+        _dirty = true;
+        _dirtySinceMs = millis();
+    }
+    return valid;
+}
+
+uint16_t FleetStats::lowerBound(const uint8_t *rom_id) const
+{
+    uint16_t lo = 0, hi = _count;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (memcmp(_entries[mid].rom_id, rom_id, 8) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// 取得 data 對應的項目位置；新電池插入空白項目 (尚未計入統計，touched 為 0)
+uint16_t FleetStats::locate(const BatteryData &data)
+{
+    if (_cached < _count && memcmp(_entries[_cached].rom_id, data.rom_id, 8) == 0)
+        return _cached;
+
+    uint16_t i = lowerBound(data.rom_id);
+    if (i < _count && memcmp(_entries[i].rom_id, data.rom_id, 8) == 0)
+        return _cached = i;
+
+    if (_count == FLEET_MAX)
+    {
+        // 淘汰最久未讀取的電池 (它的貢獻一併從統計中扣除)
+        uint16_t oldest = 0;
+        for (uint16_t n = 1; n < _count; n++)
+            if (_entries[n].touched < _entries[oldest].touched)
+                oldest = n;
+        bool wasWorst = memcmp(_entries[oldest].rom_id, _sum.worst_rom, 8) == 0;
+        contribute(_entries[oldest], -1);
+        memmove(&_entries[oldest], &_entries[oldest + 1], (_count - oldest - 1) * sizeof(FleetEntry));
+        _count--;
+        _sum.evicted++;
+        if (wasWorst)
+            refreshWorst();
+        i = lowerBound(data.rom_id);
+    }
+    memmove(&_entries[i + 1], &_entries[i], (_count - i) * sizeof(FleetEntry));
+    _count++;
+    memset(&_entries[i], 0, sizeof(FleetEntry));
+    memcpy(_entries[i].rom_id, data.rom_id, 8);
+    return _cached = i;
+}
+
+void FleetStats::contribute(const FleetEntry &e, int sign)
+{
+    bool fail = failed(e);
+    bump(_sum.packs, sign);
+    if (fail)
+        bump(_sum.failed, sign);
+    bump(_sum.cycles[bucketOf(e.charge_cycles, FLEET_CYCLE_EDGES, FLEET_CYCLE_BUCKETS)], sign);
+    bump(_sum.over_discharge[bucketOf(e.over_discharge, FLEET_EVENT_EDGES, FLEET_EVENT_BUCKETS)], sign);
+    bump(_sum.over_load[bucketOf(e.over_load, FLEET_EVENT_EDGES, FLEET_EVENT_BUCKETS)], sign);
+    for (int n = 0; n < 4; n++)
+        bump(_sum.err_cnt[n][capAt(e.err_cnt[n], FLEET_ERR_BUCKETS - 1)], sign);
+    bump(_sum.lock_status[capAt(e.lock_status, FLEET_LOCK_STATES - 1)], sign);
+    if (e.fuse_blown)
+        bump(_sum.fuse_blown, sign);
+    bump(_sum.imbalance[bucketOf(e.worst_diff_mv, FLEET_IMBALANCE_EDGES, FLEET_IMBALANCE_BUCKETS)], sign);
+
+    // 依型號：型號數量有限 (約數十種)，線性搜尋即可
+    FleetModelStat *stat = &_sum.other_models;
+    for (uint8_t n = 0; n < _sum.models; n++)
+    {
+        if (strncmp(_sum.model[n].model, e.model, sizeof(e.model)) == 0)
+        {
+            stat = &_sum.model[n];
+            break;
+        }
+    }
+    if (stat == &_sum.other_models && sign > 0 && _sum.models < FLEET_MODELS_MAX)
+    {
+        stat = &_sum.model[_sum.models++];
+        memset(stat, 0, sizeof(*stat));
+        memcpy(stat->model, e.model, sizeof(stat->model));
+    }
+    bump(stat->packs, sign);
+    if (fail)
+        bump(stat->failed, sign);
+    if (stat != &_sum.other_models && stat->packs == 0)
+        *stat = _sum.model[--_sum.models]; // 以最後一個型號補上空位
+}
+
+void FleetStats::refreshWorst()
+{
+    _sum.worst_diff_mv = 0;
+    memset(_sum.worst_rom, 0, sizeof(_sum.worst_rom));
+    memset(_sum.worst_model, 0, sizeof(_sum.worst_model));
+    for (uint16_t i = 0; i < _count; i++)
+    {
+        const FleetEntry &e = _entries[i];
+        if (e.worst_diff_mv <= _sum.worst_diff_mv)
+            continue;
+        _sum.worst_diff_mv = e.worst_diff_mv;
+        memcpy(_sum.worst_rom, e.rom_id, sizeof(_sum.worst_rom));
+        memcpy(_sum.worst_model, e.model, sizeof(_sum.worst_model));
+    }
+}
+
+void FleetStats::rebuild()
+{
+    uint32_t evicted = _sum.evicted;
+    memset(&_sum, 0, sizeof(_sum));
+    _sum.evicted = evicted;
+    for (uint16_t i = 0; i < _count; i++)
+        contribute(_entries[i], +1);
+    refreshWorst();
+    _cached = 0;
+}
+
+void FleetStats::update(const BatteryData &data, uint32_t time)
+{
+    if (!hasRomId(data))
+        return;
+
+    portENTER_CRITICAL(&_mux);
+    uint16_t i = locate(data);
+    FleetEntry &e = _entries[i];
+    FleetEntry before = e;
+    bool created = (e.touched == 0);
+    if (!created)
+        contribute(e, -1);
+
+    memset(e.model, 0, sizeof(e.model));
+    strlcpy(e.model, data.model, sizeof(e.model));
+    e.charge_cycles = data.charge_cycles > 0 ? (uint16_t)data.charge_cycles : 0;
+    e.over_discharge = data.over_discharge;
+    e.over_load = data.over_load;
+    e.lock_status = data.lock_status;
+    // 靜態讀取沒有電芯電壓，也不讀診斷暫存器 (錯誤計數、熔斷)：這些欄位與需要它們的旗標沿用先前的結果
+    bool dynamic = hasCellVoltages(data);
+    if (dynamic || created)
+    {
+        e.err_cnt[0] = data.err_cnt_04;
+        e.err_cnt[1] = data.err_cnt_05;
+        e.err_cnt[2] = data.err_cnt_06;
+        e.err_cnt[3] = data.err_cnt_07;
+        e.fuse_blown = data.fuse_blown;
+    }
+    if (dynamic)
+    {
+        e.flags = data.anomaly_flags;
+        if (data.cell_diff_ewma_mv > e.worst_diff_mv)
+            e.worst_diff_mv = data.cell_diff_ewma_mv;
+    }
+    else
+    {
+        e.flags = counterAnomalyFlags(e.charge_cycles, e.over_discharge, e.over_load, e.err_cnt, e.lock_status, e.fuse_blown) |
+                  (e.flags & ~ANOMALY_COUNTER_FLAGS);
+    }
+    if (e.reads < 0xFFFFFFFF)
+        e.reads++;
+    if (time != 0)
+        e.last_time = time;
+    e.touched = ++_touched;
+
+    contribute(e, +1);
+    if (e.worst_diff_mv > _sum.worst_diff_mv || memcmp(e.rom_id, _sum.worst_rom, 8) == 0)
+    {
+        _sum.worst_diff_mv = e.worst_diff_mv;
+        memcpy(_sum.worst_rom, e.rom_id, sizeof(_sum.worst_rom));
+        memcpy(_sum.worst_model, e.model, sizeof(_sum.worst_model));
+    }
+    bool changed = created || !sameState(before, e);
+    portEXIT_CRITICAL(&_mux);
+
+    if (changed)
+    {
+        if (!_dirty)
+            _dirtySinceMs = millis();
+        _dirty = true;
+    }
+    else
+    {
+        _touchedOnly = true;
+    }
+}
+
+bool FleetStats::save()
+{
+    if (!_dirty && !_touchedOnly)
+        return true;
+    if (!_fs)
+        return false;
+
+    FleetFileHeader header = {};
+    header.magic = FLEET_MAGIC;
+    header.version = FLEET_VERSION;
+    header.entry_size = sizeof(FleetEntry);
+    header.count = _count;
+    size_t len = (size_t)_count * sizeof(FleetEntry);
+    header.crc = crc16Ccitt(_entries, len);
+    header.evicted = _sum.evicted;
+    header.touched = _touched;
+
+    // 只有寫入端 (本任務) 會修改電池表，寫檔時不需鎖定
+    bool ok = writeFileAtomic(*_fs, _path, &header, sizeof(header), _entries, len);
+    _lastSaveMs = millis();
+    if (ok)
+    {
+        _dirty = false;
+        _touchedOnly = false;
+    }
+    else
+    {
+        _dirtySinceMs = millis(); // 等下一個延遲週期重試
+    }
+    return ok;
+}
+
+bool FleetStats::saveIfDue()
+{
+    if (_dirty && millis() - _dirtySinceMs >= FLEET_SAVE_DELAY_MS)
+        return save();
+    if (_touchedOnly && millis() - _lastSaveMs >= FLEET_TOUCH_SAVE_MS)
+        return save();
+    return true;
+}
+
+void FleetStats::clear()
+{
+    portENTER_CRITICAL(&_mux);
+    _count = 0;
+    _touched = 0;
+    memset(&_sum, 0, sizeof(_sum));
+    _cached = 0;
+    portEXIT_CRITICAL(&_mux);
+    _dirty = true;
+    save();
+}
+
+void FleetStats::summary(FleetSummary &out) const
+{
+    portENTER_CRITICAL(&_mux);
+    out = _sum;
+    portEXIT_CRITICAL(&_mux);
+}
+
+bool FleetStats::find(const uint8_t *rom_id, FleetEntry &out) const
+{
+    portENTER_CRITICAL(&_mux);
+    uint16_t i = lowerBound(rom_id);
+    bool found = i < _count && memcmp(_entries[i].rom_id, rom_id, 8) == 0;
+    if (found)
+        out = _entries[i];
+    portEXIT_CRITICAL(&_mux);
+    return found;
+}
+
+bool FleetStats::findSuffix(const char *hex_suffix, FleetEntry &out, bool &ambiguous) const
+{
+    ambiguous = false;
+    size_t len = strlen(hex_suffix);
+    if (len == 0 || len > 16)
+        return false;
+
+    // 後綴無法用排序鍵查詢，逐筆比對 (臨界區內不呼叫 snprintf)
+    bool found = false;
+    portENTER_CRITICAL(&_mux);
+    for (uint16_t i = 0; i < _count && !ambiguous; i++)
+    {
+        if (!romIdEndsWith(_entries[i].rom_id, hex_suffix, len))
+            continue;
+        if (found)
+            ambiguous = true;
+        else
+            out = _entries[i];
+        found = true;
+    }
+    portEXIT_CRITICAL(&_mux);
+    return found && !ambiguous;
+}
@@ -0,0 +1,137 @@
+#ifndef FLEET_STATS_H
+#define FLEET_STATS_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "MakitaBMS.h"
+
+// 所有讀取過的電池的統計 (/api/fleet)：壽命計數器與錯誤計數的分布、鎖定/熔斷狀態、
+// 最嚴重的電芯不平衡、依型號的合格/不合格數量。
+//
+// 每顆電池保存最近一次讀到的狀態 (依 rom_id 排序，二分搜尋；連續讀同一顆電池時直接命中快取)。
+// 分布統計是隨時維護的計數：更新一顆電池時先扣除它原本的貢獻、再加上新的貢獻，
+// 每次讀取只需 O(1) 的計數更新，查詢時不必重新掃描紀錄檔。計數只存在 RAM 中，開機時由電池表重建。
+//
+// 電池表存放於 SPIFFS (FleetFileHeader + count 個 FleetEntry)，狀態有變動時延遲一段時間寫回，
+// 只有讀取次數/時間變動時間隔更久才寫回，減少 flash 寫入。寫回時先寫暫存檔再改名覆蓋。
+// 寫入端 (loop) 與讀取端 (HTTP 回呼) 在不同任務：以 portMUX 保護，讀取端只取得複本。
+
+struct FleetEntry
+{
+    uint8_t rom_id[8];
+    char model[16];
+    uint32_t last_time;     // 最近一次讀取的客戶端時間 (2000-01-01 起的秒數)，0 表示未知
+    uint32_t touched;       // 最近一次更新的順序號 (表滿時淘汰最小者)
+    uint32_t reads;         // 靜態 + 動態讀取次數
+    uint16_t charge_cycles;
+    uint16_t worst_diff_mv; // 曾出現過的最大電芯壓差 (Analytics 的平滑值，不含瞬間負載尖峰)
+    uint16_t flags;         // 最近一次的 AnomalyFlag (靜態讀取只重算 ANOMALY_COUNTER_FLAGS，其餘沿用)
+    uint8_t over_discharge;
+    uint8_t over_load;
+    uint8_t err_cnt[4];     // 04h..07h (診斷暫存器，只由動態讀取更新)
+    uint8_t lock_status;
+    uint8_t fuse_blown;     // 同上
+    uint16_t reserved;
+};
+static_assert(sizeof(FleetEntry) == 52, "FleetEntry layout is stored on flash");
+
+struct FleetFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint16_t count;
+    uint16_t crc;      // 所有項目的 CRC-16/CCITT
+    uint32_t evicted;  // 因表滿而淘汰的電池數
+    uint32_t touched;  // 最後使用的順序號
+};
+static_assert(sizeof(FleetFileHeader) == 20, "FleetFileHeader layout");
+
+static const uint16_t FLEET_MAX = 256;     // 滿了之後淘汰最久未讀取的電池
+static const uint8_t FLEET_MODELS_MAX = 32; // 超過的型號併入 other_models
+
+// 分布的區間下限 (最後一個區間沒有上限)
+static const uint8_t FLEET_CYCLE_BUCKETS = 8;
+extern const uint16_t FLEET_CYCLE_EDGES[FLEET_CYCLE_BUCKETS];
+static const uint8_t FLEET_EVENT_BUCKETS = 6; // 過放/過載次數
+extern const uint16_t FLEET_EVENT_EDGES[FLEET_EVENT_BUCKETS];
+static const uint8_t FLEET_ERR_BUCKETS = 5;   // 錯誤計數 0, 1, 2, 3, 4+
+static const uint8_t FLEET_IMBALANCE_BUCKETS = 6;
+extern const uint16_t FLEET_IMBALANCE_EDGES[FLEET_IMBALANCE_BUCKETS];
+static const uint8_t FLEET_LOCK_STATES = 5;   // lock_status 0..3，其餘值計入最後一格
+
+// 不合格條件：鎖定、熔斷、有錯誤計數、SOH 過低或電芯不平衡
+extern const uint16_t FLEET_FAIL_FLAGS;
+
+struct FleetModelStat
+{
+    char model[16];
+    uint16_t packs;
+    uint16_t failed;
+};
+
+struct FleetSummary
+{
+    uint16_t packs;
+    uint16_t failed;
+    uint32_t evicted;
+    uint16_t cycles[FLEET_CYCLE_BUCKETS];
+    uint16_t over_discharge[FLEET_EVENT_BUCKETS];
+    uint16_t over_load[FLEET_EVENT_BUCKETS];
+    uint16_t err_cnt[4][FLEET_ERR_BUCKETS];
+    uint16_t lock_status[FLEET_LOCK_STATES];
+    uint16_t fuse_blown;
+    uint16_t imbalance[FLEET_IMBALANCE_BUCKETS];
+    uint16_t worst_diff_mv; // 全部電池中最大的壓差與其所屬電池
+    uint8_t worst_rom[8];
+    char worst_model[16];
+    uint8_t models;
+    FleetModelStat model[FLEET_MODELS_MAX];
+    FleetModelStat other_models;
+};
+
+class FleetStats
+{
+public:
+    explicit FleetStats(const char *path) : _path(path) {}
+
+    // 載入電池表並重建統計 (格式錯誤或 CRC 不符時從空表開始)
+    bool begin(fs::FS &fs);
+    // 一次靜態或動態讀取 (data 需已由 PackAnalytics 填入分析欄位)；time 為客戶端時間，0 表示未知
+    void update(const BatteryData &data, uint32_t time);
+    bool save();
+    // 變動過的電池表逾時後寫回 (於 loop 中呼叫)
+    bool saveIfDue();
+    void clear();
+
+    // 讀取端 (任何任務)
+    void summary(FleetSummary &out) const;
+    bool find(const uint8_t *rom_id, FleetEntry &out) const;
+    // ROM ID 後綴 (十六進位大寫)；符合多顆時 ambiguous 為 true
+    bool findSuffix(const char *hex_suffix, FleetEntry &out, bool &ambiguous) const;
+    uint16_t count() const { return _count; }
+
+    static bool failed(const FleetEntry &e) { return (e.flags & FLEET_FAIL_FLAGS) != 0; }
+
+private:
+    const char *_path;
+    fs::FS *_fs = nullptr;
+    FleetEntry _entries[FLEET_MAX];
+    uint16_t _count = 0;
+    uint16_t _cached = 0; // 最近一次更新的位置 (連續讀同一顆電池時免搜尋)
+    uint32_t _touched = 0;
+    FleetSummary _sum = {};
+    bool _dirty = false;       // 狀態有變動
+    bool _touchedOnly = false; // 只有讀取次數/時間變動
+    uint32_t _dirtySinceMs = 0;
+    uint32_t _lastSaveMs = 0;
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    uint16_t lowerBound(const uint8_t *rom_id) const;
+    uint16_t locate(const BatteryData &data);
+    void contribute(const FleetEntry &e, int sign);
+    void rebuild();
+    void refreshWorst();
+};
+
+#endif
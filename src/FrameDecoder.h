@@ -0,0 +1,209 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+// 0x33 靜態幀與 0xD7 動態幀的表格式解碼器。
+// 只依賴 <stdint.h> 與 ControllerTraits.h，不配置記憶體、不使用 Arduino API，
+// 可直接在主機端以擷取到的原始幀編譯測試、效能量測或模糊測試。
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ControllerTraits.h"
+
+// 欄位描述：位移、寬度 (1-4 位元組)、位元組序、逐位元組 nibble 交換、遮罩
+struct FieldDesc
+{
+    uint8_t offset;
+    uint8_t width;
+    bool big_endian;
+    bool nibble_swap;
+    uint32_t mask;
+};
+
+constexpr FieldDesc field(uint8_t offset, uint8_t width = 1, bool big_endian = false,
+                          bool nibble_swap = false, uint32_t mask = 0xFFFFFFFF)
+{
+    return FieldDesc{offset, width, big_endian, nibble_swap, mask};
+}
+
+constexpr uint8_t swapNibbles(uint8_t b)
+{
+    return (uint8_t)(((b & 0xF0) >> 4) | ((b & 0x0F) << 4));
+}
+
+// 依描述讀出原始整數值
+constexpr uint32_t decodeField(const uint8_t *frame, const FieldDesc &f)
+{
+    uint32_t v = 0;
+    for (uint8_t i = 0; i < f.width; i++)
+    {
+        uint8_t b = frame[f.offset + (f.big_endian ? i : f.width - 1 - i)];
+        v = (v << 8) | (f.nibble_swap ? swapNibbles(b) : b);
+    }
+    return v & f.mask;
+}
+
+// 描述是否完全落在長度為 len 的幀內
+constexpr bool fieldFits(const FieldDesc &f, size_t len)
+{
+    return f.width >= 1 && f.width <= 4 && (size_t)f.offset + f.width <= len;
+}
+
+// ---------------------------------------------------------------------------
+// 0x33 + AA 00 靜態幀 (40 位元組，各控制器家族相同)
+// ---------------------------------------------------------------------------
+
+namespace StaticLayout
+{
+    constexpr size_t FRAME_LEN = 40;
+    constexpr size_t ROM_ID_LEN = 8;          // [0..7] ROM ID (同時也是製造日期來源)
+    constexpr FieldDesc PROD_YEAR = field(0);  // 20xx
+    constexpr FieldDesc PROD_MONTH = field(1);
+    constexpr FieldDesc PROD_DAY = field(2);
+    constexpr FieldDesc VOLTAGE_CLASS = field(19, 1, false, true);   // V (18, 36...)
+    constexpr FieldDesc CAPACITY_DECI_AH = field(24, 1, false, true); // 0.1Ah
+    constexpr FieldDesc STATUS_CODE = field(27);
+    constexpr FieldDesc LOCK_CODE = field(28, 1, false, false, 0x0F);
+    constexpr FieldDesc CHARGE_CYCLES = field(35, 2, false, true, 0x0FFF);
+    constexpr FieldDesc OVER_DISCHARGE = field(37);
+    constexpr FieldDesc OVER_LOAD = field(38);
+
+    constexpr FieldDesc ALL[] = {PROD_YEAR, PROD_MONTH, PROD_DAY, VOLTAGE_CLASS, CAPACITY_DECI_AH,
+                                 STATUS_CODE, LOCK_CODE, CHARGE_CYCLES, OVER_DISCHARGE, OVER_LOAD};
+}
+
+// 靜態幀解碼結果 (原始單位)
+struct StaticFields
+{
+    uint8_t rom_id[StaticLayout::ROM_ID_LEN];
+    uint8_t prod_year;  // 兩位數年份
+    uint8_t prod_month;
+    uint8_t prod_day;
+    uint8_t voltage_class;
+    uint8_t capacity_deci_ah;
+    uint8_t status_code;
+    uint8_t lock_status; // 0:正常, 1:永久鎖定(熔斷), 2:過熱暫時鎖定, 3:過放電鎖定
+    uint16_t charge_cycles;
+    uint8_t over_discharge;
+    uint8_t over_load;
+};
+
+// 鎖定碼 (28 位元組低 4 位元) 對應到 BatteryData::lock_status，未知值一律視為鎖定
+constexpr uint8_t lockStatusFromCode(uint8_t lock_code)
+{
+    return lock_code == 0x00 ? 0 : lock_code == 0x01 ? 3 : lock_code == 0x02 ? 2 : 1;
+}
+
+constexpr StaticFields decodeStaticFrame(const uint8_t *frame)
+{
+    StaticFields s{};
+    for (size_t i = 0; i < StaticLayout::ROM_ID_LEN; i++)
+        s.rom_id[i] = frame[i];
+    s.prod_year = (uint8_t)decodeField(frame, StaticLayout::PROD_YEAR);
+    s.prod_month = (uint8_t)decodeField(frame, StaticLayout::PROD_MONTH);
+    s.prod_day = (uint8_t)decodeField(frame, StaticLayout::PROD_DAY);
+    s.voltage_class = (uint8_t)decodeField(frame, StaticLayout::VOLTAGE_CLASS);
+    s.capacity_deci_ah = (uint8_t)decodeField(frame, StaticLayout::CAPACITY_DECI_AH);
+    s.status_code = (uint8_t)decodeField(frame, StaticLayout::STATUS_CODE);
+    s.lock_status = lockStatusFromCode((uint8_t)decodeField(frame, StaticLayout::LOCK_CODE));
+    s.charge_cycles = (uint16_t)decodeField(frame, StaticLayout::CHARGE_CYCLES);
+    s.over_discharge = (uint8_t)decodeField(frame, StaticLayout::OVER_DISCHARGE);
+    s.over_load = (uint8_t)decodeField(frame, StaticLayout::OVER_LOAD);
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// CC + D7 00 00 FF 動態幀 (版面由控制器 traits 決定)
+// ---------------------------------------------------------------------------
+
+constexpr uint8_t MAX_CELLS = 5;
+// 電芯電壓高於此值才視為有效；以下為未接、不存在 (14.4V 電池的第 5 顆) 或未讀到的電芯。
+// 壓差、負載測試、分析與電池群統計共用同一門檻
+constexpr uint16_t CELL_VALID_MV = 500;
+
+struct DynamicLayout
+{
+    uint8_t frame_len;
+    uint8_t cell_count;
+    FieldDesc pack_mv;
+    FieldDesc cell_mv[MAX_CELLS];
+    FieldDesc temp1_centi;
+    FieldDesc temp2_centi;
+};
+
+template <typename C>
+constexpr DynamicLayout dynamicLayout()
+{
+    static_assert(C::CELL_COUNT <= MAX_CELLS, "too many cells for DynamicLayout");
+    DynamicLayout l{};
+    l.frame_len = C::DYN_FRAME_LEN;
+    l.cell_count = C::CELL_COUNT;
+    l.pack_mv = field(C::PACK_V_OFFSET, 2);
+    for (uint8_t i = 0; i < C::CELL_COUNT; i++)
+        l.cell_mv[i] = field(C::CELL_V_OFFSET + i * 2, 2);
+    l.temp1_centi = field(C::TEMP1_OFFSET, 2);
+    l.temp2_centi = field(C::TEMP2_OFFSET, 2);
+    return l;
+}
+
+// 版面中的所有欄位都必須落在幀內 (於編譯期以 static_assert 檢查)
+constexpr bool layoutFits(const DynamicLayout &l)
+{
+    bool ok = fieldFits(l.pack_mv, l.frame_len) && fieldFits(l.temp1_centi, l.frame_len) &&
+              fieldFits(l.temp2_centi, l.frame_len);
+    for (uint8_t i = 0; i < l.cell_count; i++)
+        ok = ok && fieldFits(l.cell_mv[i], l.frame_len);
+    return ok;
+}
+
+// 動態幀解碼結果 (原始單位：mV、0.01°C)
+struct DynamicFields
+{
+    uint16_t pack_mv;
+    uint16_t cell_mv[MAX_CELLS];
+    uint16_t cell_diff_mv; // 有效電芯 (> CELL_VALID_MV) 的最大壓差
+    uint16_t temp1_centi;
+    uint16_t temp2_centi;
+};
+
+constexpr DynamicFields decodeDynamicFrame(const uint8_t *frame, const DynamicLayout &l)
+{
+    DynamicFields d{};
+    d.pack_mv = (uint16_t)decodeField(frame, l.pack_mv);
+    uint16_t min_mv = 5000, max_mv = 0;
+    for (uint8_t i = 0; i < l.cell_count; i++)
+    {
+        uint16_t mv = (uint16_t)decodeField(frame, l.cell_mv[i]);
+        d.cell_mv[i] = mv;
+        if (mv > CELL_VALID_MV && mv < min_mv) min_mv = mv;
+        if (mv > max_mv) max_mv = mv;
+    }
+    d.cell_diff_mv = (max_mv > min_mv) ? (uint16_t)(max_mv - min_mv) : 0;
+    d.temp1_centi = (uint16_t)decodeField(frame, l.temp1_centi);
+    d.temp2_centi = (uint16_t)decodeField(frame, l.temp2_centi);
+    return d;
+}
+
+// 編譯期自我檢查：描述表與已知樣本
+namespace FrameDecoderCheck
+{
+    constexpr bool staticTableFits()
+    {
+        for (const FieldDesc &f : StaticLayout::ALL)
+            if (!fieldFits(f, StaticLayout::FRAME_LEN))
+                return false;
+        return true;
+    }
+    static_assert(staticTableFits(), "static frame descriptor out of range");
+    static_assert(layoutFits(dynamicLayout<StandardController>()), "standard dynamic layout out of range");
+    static_assert(layoutFits(dynamicLayout<F0513Controller>()), "F0513 dynamic layout out of range");
+
+    // 循環次數：35/36 兩個位元組各自 nibble 交換後以 little-endian 組合，取低 12 位元
+    constexpr uint8_t SAMPLE_CYCLES[] = {0x21, 0xF3}; // -> 0x3F12 & 0x0FFF
+    static_assert(decodeField(SAMPLE_CYCLES, field(0, 2, false, true, 0x0FFF)) == 0x0F12, "nibble-swapped LE decode");
+    // 動態幀電壓：little-endian 16 位元 (0x0E74 = 3700mV)
+    constexpr uint8_t SAMPLE_MV[] = {0x74, 0x0E};
+    static_assert(decodeField(SAMPLE_MV, field(0, 2)) == 3700, "LE16 decode");
+    static_assert(lockStatusFromCode(0x03) == 1 && lockStatusFromCode(0x01) == 3, "lock code mapping");
+}
+
+#endif
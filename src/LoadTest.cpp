@@ -0,0 +1,90 @@
+#include "LoadTest.h"
+#include "BmsWorker.h" // STREAM_MAX_HZ
+
+namespace LoadTest
+{
+    void clampConfig(Config &cfg)
+    {
+        cfg.rest_ms = constrain(cfg.rest_ms, 200, MAX_PHASE_MS);
+        cfg.load_ms = constrain(cfg.load_ms, 200, MAX_PHASE_MS);
+        cfg.recover_ms = constrain(cfg.recover_ms, 200, MAX_PHASE_MS);
+
+        // 總樣本數不可超過緩衝區：時間拉長時自動降低取樣率；也不超過匯流排能跟上的連續取樣率
+        uint32_t total_ms = (uint32_t)cfg.rest_ms + cfg.load_ms + cfg.recover_ms;
+        uint32_t max_hz = min<uint32_t>((uint32_t)MAX_SAMPLES * 1000 / total_ms, STREAM_MAX_HZ);
+        cfg.hz = constrain(cfg.hz, 1, (uint16_t)min<uint32_t>(max_hz, 0xFFFF));
+    }
+
+    String analyze(const DynamicSample *samples, size_t count, const Config &cfg,
+                   uint32_t load_on_us, uint32_t load_off_us, Result &out)
+    {
+        out = Result{};
+        out.samples = count;
+        out.hz = cfg.hz;
+        out.load_on_us = load_on_us;
+        out.load_off_us = load_off_us;
+
+        // 分段：靜置 = 吸合前；穩態 = 負載期間的後半段 (避開接上瞬間的暫態)；回復 = 釋放後
+        const uint32_t steady_us = load_on_us + (load_off_us - load_on_us) / 2;
+        uint32_t rest_sum[6] = {}, load_sum[6] = {}; // [0..4] 電芯、[5] 總電壓
+        uint16_t rest_n = 0, load_n = 0;
+        for (size_t n = 0; n < count; n++)
+        {
+            const DynamicSample &s = samples[n];
+            uint32_t *sum;
+            if ((int32_t)(s.t_us - load_on_us) < 0)
+            {
+                sum = rest_sum;
+                rest_n++;
+            }
+            else if ((int32_t)(s.t_us - steady_us) >= 0 && (int32_t)(s.t_us - load_off_us) < 0)
+            {
+                sum = load_sum;
+                load_n++;
+            }
+            else
+                continue;
+            for (int i = 0; i < 5; i++)
+                sum[i] += s.cell_mv[i];
+            sum[5] += s.pack_mv;
+        }
+        if (rest_n == 0 || load_n == 0)
+            return "Not enough samples";
+
+        out.pack_rest_mv = rest_sum[5] / rest_n;
+        out.pack_loaded_mv = load_sum[5] / load_n;
+        if (cfg.current_ma > 0)
+            out.current_ma = cfg.current_ma;
+        else if (cfg.load_mohm > 0)
+            out.current_ma = (uint32_t)((uint64_t)out.pack_loaded_mv * 1000 / cfg.load_mohm); // mV / mΩ = A
+        if (out.current_ma == 0)
+            return "Load current unknown";
+
+        uint16_t pack_sag = out.pack_rest_mv > out.pack_loaded_mv ? out.pack_rest_mv - out.pack_loaded_mv : 0;
+        out.pack_ir_uohm = (uint32_t)((uint64_t)pack_sag * 1000000 / out.current_ma);
+
+        for (int i = 0; i < 5; i++)
+        {
+            CellResult &c = out.cells[i];
+            c.rest_mv = rest_sum[i] / rest_n;
+            c.loaded_mv = load_sum[i] / load_n;
+            if (c.rest_mv <= CELL_VALID_MV) // 不存在的電芯
+                continue;
+            out.cell_count = i + 1;
+            c.sag_mv = c.rest_mv > c.loaded_mv ? c.rest_mv - c.loaded_mv : 0;
+            c.ir_uohm = (uint32_t)((uint64_t)c.sag_mv * 1000000 / out.current_ma);
+
+            // 回復時間：釋放負載後，第一筆回到驟降量 RECOVERED_PCT% 以內的樣本
+            c.recovery_ms = c.sag_mv == 0 ? 0 : -1;
+            uint16_t threshold = c.rest_mv - c.sag_mv * (100 - RECOVERED_PCT) / 100;
+            for (size_t n = 0; n < count && c.recovery_ms < 0; n++)
+            {
+                const DynamicSample &s = samples[n];
+                int32_t since_off = (int32_t)(s.t_us - load_off_us);
+                if (since_off >= 0 && s.cell_mv[i] >= threshold)
+                    c.recovery_ms = since_off / 1000;
+            }
+        }
+        return "";
+    }
+}
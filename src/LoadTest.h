@@ -0,0 +1,60 @@
+#ifndef LOAD_TEST_H
+#define LOAD_TEST_H
+
+#include <Arduino.h>
+#include "MakitaBMS.h"
+
+// 負載測試：靜置 → 繼電器接上負載 → 斷開後回復，全程以高速路徑取樣 0xD7 動態幀，
+// 由電壓驟降量與負載電流估算每顆電芯的內阻，並量測回復時間。
+//
+// 電流來源 (二擇一)：
+//   current_ma > 0：定電流負載，直接使用
+//   load_mohm  > 0：電阻負載，以負載期間的總電壓 / 電阻換算
+namespace LoadTest
+{
+    constexpr size_t MAX_SAMPLES = 256;        // 樣本緩衝區 (取樣率會依總時長自動降低以放得下)
+    constexpr uint16_t MAX_PHASE_MS = 10000;   // 每個階段的上限
+    constexpr uint8_t RECOVERED_PCT = 90;      // 回復到驟降量的 90% 即視為已回復
+
+    struct Config
+    {
+        uint16_t rest_ms = 1000;    // 接上負載前的靜置時間 (作為開路電壓基準)
+        uint16_t load_ms = 3000;    // 負載時間
+        uint16_t recover_ms = 5000; // 斷開負載後觀察回復的時間
+        uint16_t hz = 20;           // 要求的取樣率
+        uint32_t current_ma = 0;
+        uint32_t load_mohm = 0;
+    };
+
+    struct CellResult
+    {
+        uint16_t rest_mv;     // 靜置平均
+        uint16_t loaded_mv;   // 負載後半段平均 (穩態)
+        uint16_t sag_mv;      // 驟降量
+        uint32_t ir_uohm;     // 內阻 (µΩ)
+        int32_t recovery_ms;  // 斷開負載到回復的時間，-1 表示觀察期間內未回復
+    };
+
+    struct Result
+    {
+        uint8_t cell_count;
+        uint16_t samples;
+        uint16_t hz;              // 實際使用的取樣率
+        uint16_t pack_rest_mv;
+        uint16_t pack_loaded_mv;
+        uint32_t current_ma;      // 使用的負載電流
+        uint32_t pack_ir_uohm;
+        uint32_t load_on_us;      // 繼電器吸合 / 釋放的時間戳 (與樣本 t_us 同一時基)
+        uint32_t load_off_us;
+        CellResult cells[5];
+    };
+
+    // 將設定限制在可執行範圍，並回傳放得進緩衝區的取樣率
+    void clampConfig(Config &cfg);
+
+    // 分析樣本，回傳空字串表示成功 (與 MakitaBMS 相同的錯誤慣例)
+    String analyze(const DynamicSample *samples, size_t count, const Config &cfg,
+                   uint32_t load_on_us, uint32_t load_off_us, Result &out);
+}
+
+#endif
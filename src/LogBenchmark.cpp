@@ -0,0 +1,240 @@
+#include "LogBenchmark.h"
+#include "DataLog.h"
+#include "SeriesLog.h"
+
+static const char *BENCH_RING_PATH = "/bench.bin";
+static const char *BENCH_INDEX_PATH = "/bench.idx";
+static const char *BENCH_CSV_PATH = "/bench.csv";
+static const char *BENCH_TMP_PATH = "/bench.tmp";
+
+// 舊版 appendToLog + manageLogLimit 的寫法 (逐位元組數行、整檔複製修剪)，加上讀寫計數
+static void legacyAppend(fs::FS &fs, const char *row, uint16_t capacity, uint32_t &read, uint32_t &written)
+{
+    File f = fs.open(BENCH_CSV_PATH, "r");
+    if (f && f.size() >= (size_t)capacity * 100)
+    {
+        int lines = 0;
+        while (f.available())
+        {
+            if (f.read() == '\n')
+                lines++;
+            read++;
+        }
+        f.close();
+
+        if (lines >= capacity)
+        {
+            fs.rename(BENCH_CSV_PATH, BENCH_TMP_PATH);
+            File fIn = fs.open(BENCH_TMP_PATH, "r");
+            File fOut = fs.open(BENCH_CSV_PATH, "w");
+            if (fIn && fOut)
+            {
+                String header = fIn.readStringUntil('\n');
+                written += fOut.println(header);
+                read += header.length() + 1;
+                read += fIn.readStringUntil('\n').length() + 1;
+                while (fIn.available())
+                {
+                    fOut.write(fIn.read());
+                    read++;
+                    written++;
+                }
+            }
+            if (fIn)
+                fIn.close();
+            if (fOut)
+                fOut.close();
+            fs.remove(BENCH_TMP_PATH);
+        }
+    }
+    else if (f)
+        f.close();
+
+    File out = fs.open(BENCH_CSV_PATH, "a");
+    if (out)
+    {
+        written += out.print(row);
+        out.close();
+    }
+}
+
+void runLogBenchmark(fs::FS &fs, const BatteryData &sample, uint16_t n, uint16_t capacity,
+                     LogBenchResult &ring, LogBenchResult &legacy)
+{
+    ring = LogBenchResult();
+    legacy = LogBenchResult();
+    if (n == 0)
+        return;
+
+    // --- 環形紀錄檔 (含電池目錄的寫回；目錄約 5.6KB，放在堆積而非堆疊) ---
+    {
+        DataLog bench(BENCH_RING_PATH);
+        std::unique_ptr<LogIndex> index(new LogIndex(BENCH_INDEX_PATH));
+        index->begin(fs);
+        bench.setIndex(index.get());
+        if (bench.begin(fs, capacity))
+        {
+            for (uint16_t i = 0; i < n; i++)
+                bench.append(sample, 0);
+            bench.commit();
+            bench.saveIndex();
+            // 以預設的群組提交計算：每筆成本 = 放入暫存區 + 分攤的提交時間；最大值取單次提交
+            const DataLogStats &st = bench.stats();
+            ring.samples = st.appends;
+            ring.avg_us = st.appends ? (st.total_append_us + st.total_commit_us) / st.appends : 0;
+            ring.max_us = max(st.max_append_us, st.max_commit_us);
+            ring.bytes_written = st.appends ? st.bytes_written / st.appends : 0;
+        }
+    }
+    fs.remove(BENCH_RING_PATH);
+    fs.remove(BENCH_INDEX_PATH);
+
+    // --- 舊版 CSV：先填滿到上限 ---
+    LogRecord rec;
+    makeLogRecord(sample, 0, rec);
+    char row[256];
+    formatCsvRow(rec, row, sizeof(row));
+    {
+        File f = fs.open(BENCH_CSV_PATH, "w");
+        if (!f)
+            return;
+        f.println(LOG_CSV_HEADER);
+        for (uint16_t i = 0; i < capacity; i++)
+            f.print(row);
+        f.close();
+    }
+
+    uint64_t total_us = 0, total_read = 0, total_written = 0;
+    for (uint16_t i = 0; i < n; i++)
+    {
+        uint32_t read = 0, written = 0;
+        uint32_t start = micros();
+        legacyAppend(fs, row, capacity, read, written);
+        uint32_t elapsed = micros() - start;
+        total_us += elapsed;
+        total_read += read;
+        total_written += written;
+        if (elapsed > legacy.max_us)
+            legacy.max_us = elapsed;
+        yield();
+    }
+    legacy.samples = n;
+    legacy.avg_us = total_us / n;
+    legacy.bytes_read = total_read / n;
+    legacy.bytes_written = total_written / n;
+    fs.remove(BENCH_CSV_PATH);
+}
+
+// 可重現的模擬雜訊 (LCG)
+static uint32_t benchRand(uint32_t &state)
+{
+    state = state * 1664525UL + 1013904223UL;
+    return state >> 16;
+}
+
+// 解碼一個區塊並與該區塊最後一筆原樣本比對；回傳樣本數
+static uint16_t decodeBenchBlock(const uint8_t *payload, size_t len, const SeriesCodec::Sample &last, bool &match)
+{
+    SeriesCodec::Decoder decoder(payload, len);
+    SeriesCodec::BatteryHeader header;
+    SeriesCodec::Sample s = {};
+    uint16_t count = 0;
+    SeriesCodec::Decoder::Event ev;
+    match = true;
+    while ((ev = decoder.next(header, s)) != SeriesCodec::Decoder::END)
+    {
+        if (ev == SeriesCodec::Decoder::CORRUPT)
+        {
+            match = false;
+            break;
+        }
+        if (ev == SeriesCodec::Decoder::SAMPLE)
+            count++;
+    }
+    if (memcmp(&s, &last, sizeof(s)) != 0)
+        match = false;
+    return count;
+}
+
+void runSeriesBenchmark(const BatteryData &sample, uint32_t n, SeriesBenchResult &out)
+{
+    out = SeriesBenchResult();
+    if (n == 0)
+        return;
+
+    static uint8_t payload[SERIES_PAYLOAD_SIZE];
+    SeriesCodec::BatteryHeader header = {};
+    memcpy(header.rom_id, sample.rom_id, sizeof(header.rom_id));
+    strlcpy(header.model, sample.model, sizeof(header.model));
+    header.charge_cycles = sample.charge_cycles > 0 ? sample.charge_cycles : 0;
+
+    SeriesCodec::Sample s = {}, last = {};
+    s.t_ms = millis();
+    s.v[SeriesCodec::CH_PACK_MV] = sample.pack_mv;
+    for (int i = 0; i < 5; i++)
+        s.v[SeriesCodec::CH_CELL1_MV + i] = sample.cell_mv[i] ? sample.cell_mv[i] : 3700;
+    s.v[SeriesCodec::CH_TEMP1_CENTI] = sample.temp1_centi;
+    s.v[SeriesCodec::CH_TEMP2_CENTI] = sample.temp2_centi;
+    s.v[SeriesCodec::CH_TEMP3_CENTI] = sample.temp3_centi;
+
+    SeriesCodec::Encoder enc;
+    enc.reset(payload, sizeof(payload));
+    enc.header(header);
+    uint32_t rng = 12345, encode_us = 0, decode_us = 0, decoded = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        // 20Hz ±1ms 抖動；電芯 ±1mV 雜訊，總電壓為電芯總和；溫度偶爾變動 0.01°C
+        s.t_ms += 49 + benchRand(rng) % 3;
+        int32_t pack = 0;
+        for (int c = 0; c < 5; c++)
+        {
+            s.v[SeriesCodec::CH_CELL1_MV + c] += (int32_t)(benchRand(rng) % 3) - 1;
+            pack += s.v[SeriesCodec::CH_CELL1_MV + c];
+        }
+        s.v[SeriesCodec::CH_PACK_MV] = pack;
+        if (benchRand(rng) % 20 == 0)
+            s.v[SeriesCodec::CH_TEMP1_CENTI + benchRand(rng) % 3] += (int32_t)(benchRand(rng) % 3) - 1;
+
+        uint32_t start = micros();
+        bool ok = enc.sample(s);
+        encode_us += micros() - start;
+        if (ok)
+        {
+            last = s;
+            continue;
+        }
+
+        // 區塊已滿：解碼驗證後換新區塊 (與 SeriesLog 相同，新區塊重送標頭)
+        bool match;
+        start = micros();
+        decoded += decodeBenchBlock(payload, enc.size(), last, match);
+        decode_us += micros() - start;
+        out.mismatches += match ? 0 : 1;
+        out.bytes += enc.size();
+        out.blocks++;
+
+        start = micros();
+        enc.reset(payload, sizeof(payload));
+        enc.header(header);
+        enc.sample(s);
+        encode_us += micros() - start;
+        last = s;
+        yield();
+    }
+    if (enc.samples() > 0)
+    {
+        bool match;
+        uint32_t start = micros();
+        decoded += decodeBenchBlock(payload, enc.size(), last, match);
+        decode_us += micros() - start;
+        out.mismatches += match ? 0 : 1;
+        out.bytes += enc.size();
+        out.blocks++;
+    }
+
+    out.samples = n;
+    out.encode_ns = (uint32_t)((uint64_t)encode_us * 1000 / n);
+    out.decode_per_sec = decode_us ? (uint32_t)((uint64_t)decoded * 1000000 / decode_us) : 0;
+    if (decoded != n)
+        out.mismatches++;
+}
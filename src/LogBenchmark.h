@@ -0,0 +1,38 @@
+#ifndef LOG_BENCHMARK_H
+#define LOG_BENCHMARK_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "MakitaBMS.h"
+
+// MCU 紀錄寫入效能比較：環形紀錄檔 (DataLog) 與舊版「逐行 CSV + 滿了就整檔複製」的作法。
+// 兩者都在暫存檔上執行，不影響正式紀錄；舊版會先填滿到上限，量測的是穩態 (每筆都要修剪) 的成本。
+// 環形紀錄檔的寫入量含電池目錄 (結束時寫回一次，分攤到每筆)。
+struct LogBenchResult
+{
+    uint16_t samples = 0;
+    uint32_t avg_us = 0;           // 每筆寫入的平均耗時
+    uint32_t max_us = 0;
+    uint32_t bytes_written = 0;    // 每筆寫入的應用層寫入量 (位元組)
+    uint32_t bytes_read = 0;       // 每筆寫入附帶的讀取量 (位元組)
+};
+
+// 以 sample 為內容各寫入 n 筆；capacity 為兩種作法共同的紀錄上限
+void runLogBenchmark(fs::FS &fs, const BatteryData &sample, uint16_t n, uint16_t capacity,
+                     LogBenchResult &ring, LogBenchResult &legacy);
+
+// 時間序列壓縮 (SeriesCodec) 的空間與速度：只在 RAM 中編解碼，不寫入快閃記憶體
+struct SeriesBenchResult
+{
+    uint32_t samples = 0;
+    uint32_t bytes = 0;            // 編碼後總位元組數 (含每個區塊開頭的電池標頭)
+    uint32_t blocks = 0;
+    uint32_t encode_ns = 0;        // 每筆編碼的平均耗時
+    uint32_t decode_per_sec = 0;   // 解碼吞吐量 (樣本/秒)
+    uint32_t mismatches = 0;       // 解碼結果與原樣本不符的區塊數 (應為 0)
+};
+
+// 以 sample 為起點產生 n 筆 20Hz、帶少量雜訊的模擬樣本，依實際區塊大小編碼後再解碼驗證
+void runSeriesBenchmark(const BatteryData &sample, uint32_t n, SeriesBenchResult &out);
+
+#endif
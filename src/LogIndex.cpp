@@ -0,0 +1,208 @@
+#include "LogIndex.h"
+#include "DataLog.h"
+
+static const uint32_t INDEX_MAGIC = 0x58494B4D; // "MKIX"
+static const uint16_t INDEX_VERSION = 1;
+static const uint32_t INDEX_SAVE_DELAY_MS = 60000; // 目錄變動後的寫回延遲
+
+bool LogIndex::begin(fs::FS &fs)
+{
+    _fs = &fs;
+    portENTER_CRITICAL(&_mux);
+    _count = 0;
+    portEXIT_CRITICAL(&_mux);
+    _lastSeq = 0;
+    _dirty = false;
+
+    recoverTempFile(fs, _path);
+    File f = _fs->open(_path, "r");
+    if (!f)
+        return true; // 尚未建立：空目錄
+
+    LogIndexFileHeader header = {};
+    bool valid = f.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                 header.magic == INDEX_MAGIC && header.version == INDEX_VERSION &&
+                 header.entry_size == sizeof(LogIndexEntry) && header.count <= LOG_INDEX_MAX;
+    size_t len = valid ? (size_t)header.count * sizeof(LogIndexEntry) : 0;
+    valid = valid && f.read(reinterpret_cast<uint8_t *>(_entries), len) == len &&
+            crc16Ccitt(_entries, len) == header.crc;
+    f.close();
+
+    if (valid)
+    {
+        portENTER_CRITICAL(&_mux);
+        _count = header.count;
+        portEXIT_CRITICAL(&_mux);
+        _lastSeq = header.last_seq;
+    }
+    else
+    {
+        markDirty(); // 以重建的內容覆寫損毀的檔案
+    }
+    return valid;
+}
+
+uint16_t LogIndex::lowerBound(const uint8_t *rom_id) const
+{
+    uint16_t lo = 0, hi = _count;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (memcmp(_entries[mid].rom_id, rom_id, 8) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool LogIndex::find(const uint8_t *rom_id, LogIndexEntry &out) const
+{
+    portENTER_CRITICAL(&_mux);
+    uint16_t i = lowerBound(rom_id);
+    bool found = i < _count && memcmp(_entries[i].rom_id, rom_id, 8) == 0;
+    if (found)
+        out = _entries[i];
+    portEXIT_CRITICAL(&_mux);
+    return found;
+}
+
+bool LogIndex::findSuffix(const char *hex_suffix, LogIndexEntry &out, bool &ambiguous) const
+{
+    ambiguous = false;
+    size_t len = strlen(hex_suffix);
+    if (len == 0 || len > 16)
+        return false;
+
+    // 序號只取 ROM ID 的後幾碼，無法用排序鍵查詢：目錄在 RAM 中，逐筆比對即可 (臨界區內不呼叫 snprintf)
+    bool found = false;
+    portENTER_CRITICAL(&_mux);
+    for (uint16_t i = 0; i < _count && !ambiguous; i++)
+    {
+        if (!romIdEndsWith(_entries[i].rom_id, hex_suffix, len))
+            continue;
+        if (found)
+            ambiguous = true;
+        else
+            out = _entries[i];
+        found = true;
+    }
+    portEXIT_CRITICAL(&_mux);
+    return found && !ambiguous;
+}
+
+bool LogIndex::entry(uint16_t i, LogIndexEntry &out) const
+{
+    portENTER_CRITICAL(&_mux);
+    bool valid = i < _count;
+    if (valid)
+        out = _entries[i];
+    portEXIT_CRITICAL(&_mux);
+    return valid;
+}
+
+void LogIndex::add(const LogRecord &rec)
+{
+    portENTER_CRITICAL(&_mux);
+    uint16_t i = lowerBound(rec.rom_id);
+    if (i >= _count || memcmp(_entries[i].rom_id, rec.rom_id, 8) != 0)
+    {
+        if (_count == LOG_INDEX_MAX)
+        {
+            // 淘汰最久未出現的電池
+            uint16_t oldest = 0;
+            for (uint16_t n = 1; n < _count; n++)
+                if (_entries[n].last_seq < _entries[oldest].last_seq)
+                    oldest = n;
+            memmove(&_entries[oldest], &_entries[oldest + 1], (_count - oldest - 1) * sizeof(LogIndexEntry));
+            _count--;
+            i = lowerBound(rec.rom_id);
+        }
+        memmove(&_entries[i + 1], &_entries[i], (_count - i) * sizeof(LogIndexEntry));
+        _count++;
+
+        LogIndexEntry &e = _entries[i];
+        memset(&e, 0, sizeof(e));
+        memcpy(e.rom_id, rec.rom_id, 8);
+        e.first_time = rec.time;
+        e.first_seq = rec.seq;
+    }
+
+    LogIndexEntry &e = _entries[i];
+    memcpy(e.model, rec.model, sizeof(e.model));
+    e.model[sizeof(e.model) - 1] = '\0';
+    if (rec.seq >= e.last_seq)
+    {
+        e.last_seq = rec.seq;
+        if (rec.time != 0)
+            e.last_time = rec.time;
+    }
+    if (rec.seq < e.first_seq)
+    {
+        e.first_seq = rec.seq;
+        e.first_time = rec.time;
+    }
+    if (e.first_time == 0)
+        e.first_time = rec.time;
+    e.records++;
+    portEXIT_CRITICAL(&_mux);
+
+    if (rec.seq > _lastSeq)
+        _lastSeq = rec.seq;
+    markDirty();
+}
+
+void LogIndex::markDirty()
+{
+    if (!_dirty)
+        _dirtySinceMs = millis();
+    _dirty = true;
+}
+
+void LogIndex::sync(uint32_t log_last_seq)
+{
+    if (_lastSeq > log_last_seq)
+    {
+        _lastSeq = log_last_seq;
+        markDirty();
+    }
+}
+
+bool LogIndex::save()
+{
+    if (!_dirty)
+        return true;
+    if (!_fs)
+        return false;
+
+    LogIndexFileHeader header = {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.entry_size = sizeof(LogIndexEntry);
+    header.count = _count;
+    size_t len = (size_t)_count * sizeof(LogIndexEntry);
+    header.crc = crc16Ccitt(_entries, len);
+    header.last_seq = _lastSeq;
+
+    // 只有寫入端 (本任務) 會修改目錄，寫檔時不需鎖定
+    bool ok = writeFileAtomic(*_fs, _path, &header, sizeof(header), _entries, len);
+    _dirty = !ok;
+    return ok;
+}
+
+bool LogIndex::saveIfDue()
+{
+    if (!_dirty || millis() - _dirtySinceMs < INDEX_SAVE_DELAY_MS)
+        return true;
+    return save();
+}
+
+void LogIndex::clear()
+{
+    portENTER_CRITICAL(&_mux);
+    _count = 0;
+    portEXIT_CRITICAL(&_mux);
+    _lastSeq = 0;
+    markDirty();
+    save();
+}
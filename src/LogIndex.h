@@ -0,0 +1,88 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+struct LogRecord;
+
+// 依 ROM ID 排序的電池目錄 (MCU 紀錄的索引)，存放於 SPIFFS，以二分搜尋 O(log n) 查詢。
+// 每顆電池記下首次/最近一次紀錄的時間與序號、累計紀錄筆數；即使舊紀錄已被環形檔覆寫，
+// 回廠的電池仍查得到曾經出現過。DataLog 每次提交時逐筆更新 (add)；目錄有變動後延遲一段時間才寫回
+// (saveIfDue)，不隨每次提交整檔重寫。未寫回的部分不會遺失：開機時由 DataLog 依 last_seq 補上。
+//
+// 檔案格式：LogIndexFileHeader + count 個 LogIndexEntry (依 rom_id 遞增排序)
+// 寫回前先更新 last_seq：開機時序號大於 last_seq 的紀錄視為尚未索引，由 DataLog 掃描時補上。
+// 寫回時先寫暫存檔再改名覆蓋，寫到一半斷電仍保留舊目錄。
+// 寫入端 (loop) 與讀取端 (HTTP 回呼) 在不同任務：以 portMUX 保護，讀取端只取得複本。
+
+struct LogIndexEntry
+{
+    uint8_t rom_id[8];
+    char model[16];
+    uint32_t first_time; // 2000-01-01 起的秒數，0 表示未知
+    uint32_t last_time;
+    uint32_t first_seq;  // 對應 LogRecord::seq
+    uint32_t last_seq;
+    uint32_t records;    // 累計紀錄筆數 (含已被覆寫的)
+};
+static_assert(sizeof(LogIndexEntry) == 44, "LogIndexEntry layout is stored on flash");
+
+struct LogIndexFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint16_t count;
+    uint16_t crc;       // 所有項目的 CRC-16/CCITT
+    uint32_t last_seq;  // 已索引的最大紀錄序號
+};
+static_assert(sizeof(LogIndexFileHeader) == 16, "LogIndexFileHeader layout");
+
+static const uint16_t LOG_INDEX_MAX = 128; // 滿了之後淘汰最久未出現的電池
+
+class LogIndex
+{
+public:
+    explicit LogIndex(const char *path) : _path(path) {}
+
+    // 載入目錄 (格式錯誤或 CRC 不符時從空目錄開始，由 DataLog 掃描重建)
+    bool begin(fs::FS &fs);
+    void add(const LogRecord &rec);
+    bool save();
+    // 變動過的目錄逾時後寫回 (由 DataLog::commitIfDue 呼叫)
+    bool saveIfDue();
+    void clear();
+
+    // 紀錄檔被重建 (序號重新開始) 時呼叫，避免新紀錄被誤認為已索引
+    void sync(uint32_t log_last_seq);
+
+    // 讀取端 (任何任務)
+    bool find(const uint8_t *rom_id, LogIndexEntry &out) const;
+    // ROM ID 後綴 (十六進位大寫，例如序號的後 6 碼)；符合多顆時 ambiguous 為 true
+    bool findSuffix(const char *hex_suffix, LogIndexEntry &out, bool &ambiguous) const;
+    // 依 rom_id 排序的第 i 筆；i 超出目前筆數時回傳 false (逐筆列舉期間目錄可能變動)
+    bool entry(uint16_t i, LogIndexEntry &out) const;
+
+    uint16_t count() const { return _count; }
+    uint32_t lastSeq() const { return _lastSeq; }
+    bool dirty() const { return _dirty; }
+    // 寫回時的檔案大小 (標頭 + 目前的所有項目)
+    size_t fileSize() const { return sizeof(LogIndexFileHeader) + (size_t)_count * sizeof(LogIndexEntry); }
+
+private:
+    const char *_path;
+    fs::FS *_fs = nullptr;
+    LogIndexEntry _entries[LOG_INDEX_MAX];
+    uint16_t _count = 0;
+    uint32_t _lastSeq = 0;
+    bool _dirty = false;
+    uint32_t _dirtySinceMs = 0;
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // 二分搜尋：回傳第一個 rom_id >= key 的位置
+    uint16_t lowerBound(const uint8_t *rom_id) const;
+    void markDirty();
+};
+
+#endif
@@ -1,12 +1,22 @@
 #include "MakitaBMS.h"
 
-MakitaBMS::MakitaBMS(uint8_t onewire_pin, uint8_t enable_pin)
-    : makita(onewire_pin), _enable_pin(enable_pin)
+MakitaBMS::MakitaBMS(MakitaBus &bus, uint8_t enable_pin, int8_t relay_pin)
+    : makita(bus), _enable_pin(enable_pin), _relay_pin(relay_pin)
 {
     pinMode(_enable_pin, OUTPUT);
     digitalWrite(_enable_pin, HIGH); // NPN: HIGH = OFF
 }
 
+void MakitaBMS::setRelay(bool on)
+{
+    if (_relay_pin < 0)
+        return;
+    pinMode(_relay_pin, OUTPUT);
+    digitalWrite(_relay_pin, on ? HIGH : LOW);
+    _relay_on = on;
+    logger(String("Load relay ") + (on ? "ON" : "OFF"), LOG_LEVEL_DEBUG);
+}
+
 // --- 工具函數 ---
 
 void MakitaBMS::setLogCallback(LogCallback callback) { _log = callback; }
@@ -17,12 +27,25 @@ void MakitaBMS::logger(const String &message, LogLevel level)
         _log(message, level);
 }
 
-void MakitaBMS::setVerifyReads(bool on) {
+void MakitaBMS::setVerifyReads(bool on, uint8_t votes) {
  _verifyReads = on;
+ _verifyVotes = constrain(votes, 3, 5);
  Serial.print("setVerifyReads");
  Serial.println(on ? "true" : "false");
 }
 
+void MakitaBMS::setInterByteGap(uint16_t us)
+{
+    _timing.inter_byte_us = us;
+    makita.setInterByteGap(us);
+}
+
+void MakitaBMS::setTimingProfile(const BusTimingProfile &profile)
+{
+    _timing = profile;
+    makita.setInterByteGap(profile.inter_byte_us);
+}
+
 void MakitaBMS::log_hex(const String &prefix, const byte *data, int len)
 {
     if (_logLevel < LOG_LEVEL_DEBUG)
@@ -40,536 +63,790 @@ void MakitaBMS::log_hex(const String &prefix, const byte *data, int len)
     logger(hex_str, LOG_LEVEL_DEBUG);
 }
 
-byte MakitaBMS::nibble_swap(byte b)
+// --- 多數決讀取驗證 ---
+
+static const uint8_t VERIFY_MAX_VOTES = 5;
+static const uint8_t VERIFY_MAX_FRAME = 40;
+static const uint8_t VERIFY_MAX_RETRIES = 3;   // 無多數時最多重試幾輪
+static const uint16_t VERIFY_BACKOFF_MS = 5;   // 首次重試前的等待，之後每輪加倍
+static const uint16_t VERIFY_BACKOFF_MAX_MS = 40;
+
+// 得票數轉換為百分比
+static uint8_t votePct(uint8_t agree, uint8_t votes)
 {
-    return ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+    return votes ? (uint8_t)(agree * 100 / votes) : 0;
 }
 
-void MakitaBMS::cmd_and_read_cc(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len)
+// 多位元組欄位的可信度取各位元組的最小值
+static uint8_t fieldPct(const uint8_t *agree, const FieldDesc &f, uint8_t votes)
 {
-    makita.reset();
-    delayMicroseconds(400);
-    makita.write(0xcc);
-    if (cmd != nullptr)
-    {
-        for (int i = 0; i < cmd_len; i++)
-        {
-            makita.write(cmd[i]);
-            delayMicroseconds(90);
-        }
-    }
-    if (rsp != nullptr)
-    {
-        for (int i = 0; i < rsp_len; i++)
-        {
-            rsp[i] = makita.read();
-            delayMicroseconds(90);
-        }
-    }
+    uint8_t m = 0xFF;
+    for (uint8_t i = 0; i < f.width; i++)
+        m = min(m, agree[f.offset + i]);
+    return votePct(m, votes);
 }
 
-void MakitaBMS::cmd_and_read_33(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len)
+// 0xFF 代表讀取失敗或位址不匹配：數值歸零並將可信度標為 0 (不再靜默吞掉)
+static uint8_t filterUnread(uint8_t v, uint8_t &confidence)
 {
-    makita.reset();
-    delayMicroseconds(400);
-    makita.write(0x33);
+    if (v != 0xFF)
+        return v;
+    confidence = 0;
+    return 0;
+}
 
-    byte initial_read[8];
-    for (int i = 0; i < 8; i++)
+// 所有欄位都得到多數票 (未達多數的欄位其得票數被標為 0)
+static bool fieldsVerified(const uint8_t *agree, const FieldDesc *fields, uint8_t count)
+{
+    for (uint8_t f = 0; f < count; f++)
+        for (uint8_t i = 0; i < fields[f].width; i++)
+            if (agree[fields[f].offset + i] == 0)
+                return false;
+    return true;
+}
+
+template <typename Reader>
+uint8_t MakitaBMS::readVoted(Reader read, byte *out, uint8_t len, uint8_t *agree, const FieldDesc *fields, uint8_t field_count)
+{
+    if (!_verifyReads || len > VERIFY_MAX_FRAME)
     {
-        initial_read[i] = makita.read();
-        delayMicroseconds(90);
+        read(out);
+        memset(agree, 1, len);
+        return 1;
     }
 
-    if (cmd != nullptr)
+    // 投票單位：欄位涵蓋的位元組整段比對 (多位元組數值不會由不同樣本拼接而成)，其餘位元組各自投票。
+    // span[i] 為從 i 開始的單位寬度，0 表示 i 位於前一個單位之內。
+    uint8_t span[VERIFY_MAX_FRAME];
+    memset(span, 1, len);
+    for (uint8_t f = 0; f < field_count; f++)
     {
-        for (int i = 0; i < cmd_len; i++)
-        {
-            makita.write(cmd[i]);
-            delayMicroseconds(90);
-        }
+        const FieldDesc &d = fields[f];
+        if (d.width == 0 || d.offset + d.width > len || span[d.offset] == 0)
+            continue;
+        span[d.offset] = d.width;
+        memset(span + d.offset + 1, 0, d.width - 1);
     }
-    if (rsp != nullptr)
+
+    const uint8_t votes = _verifyVotes;
+    byte samples[VERIFY_MAX_VOTES][VERIFY_MAX_FRAME];
+    uint16_t backoff = VERIFY_BACKOFF_MS;
+    _readStats.frames++;
+
+    for (uint8_t attempt = 0;; attempt++)
     {
-        for (int i = 0; i < rsp_len; i++)
+        for (uint8_t v = 0; v < votes; v++)
+            read(samples[v]);
+
+        // 逐單位找出最多票的樣本；未達多數的單位填 0xFF (讀取失敗標記) 且得票數為 0
+        bool majority = true, unanimous = true;
+        for (uint8_t i = 0; i < len; i++)
         {
-            rsp[i] = makita.read();
-            delayMicroseconds(90);
+            const uint8_t w = span[i];
+            if (w == 0)
+                continue;
+            uint8_t best = 0, best_count = 0;
+            for (uint8_t a = 0; a < votes; a++)
+            {
+                uint8_t count = 0;
+                for (uint8_t b = 0; b < votes; b++)
+                    if (memcmp(samples[b] + i, samples[a] + i, w) == 0)
+                        count++;
+                if (count > best_count)
+                {
+                    best_count = count;
+                    best = a;
+                }
+            }
+            if (best_count < votes)
+                unanimous = false;
+            if (best_count * 2 > votes)
+            {
+                memcpy(out + i, samples[best] + i, w);
+                memset(agree + i, best_count, w);
+            }
+            else
+            {
+                majority = false;
+                memset(out + i, 0xFF, w);
+                memset(agree + i, 0, w);
+            }
         }
+
+        if (!unanimous)
+            _readStats.mismatches++;
+        if (majority)
+            return votes;
+        if (attempt >= VERIFY_MAX_RETRIES)
+        {
+            _readStats.failures++;
+            logger("Verified read: no majority after retries, fields marked unverified", LOG_LEVEL_WARN);
+            return votes;
+        }
+
+        // 有限退避後重試
+        _readStats.retries++;
+        delay(backoff);
+        backoff = min<uint16_t>(backoff * 2, VERIFY_BACKOFF_MAX_MS);
     }
 }
 
-bool MakitaBMS::isPresent()
+// --- 電源會話 ---
+
+void MakitaBMS::beginSession()
 {
+    if (_session_depth++ > 0 || _awake)
+        return;
     digitalWrite(_enable_pin, LOW); // ON
-    delay(400);
-    bool present = makita.reset();
+    delay(_timing.wake_ms);         // 等待 BMS 喚醒
+    _awake = true;
+    _wake_started = millis();
+}
+
+void MakitaBMS::endSession()
+{
+    if (_session_depth == 0 || --_session_depth > 0)
+        return;
     digitalWrite(_enable_pin, HIGH); // OFF
-    return present;
+    _awake = false;
+    logger("Power session closed after " + String(millis() - _wake_started) + " ms", LOG_LEVEL_DEBUG);
+}
+
+void MakitaBMS::cmd_and_read_cc(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len)
+{
+    makita.reset();
+    delayMicroseconds(_timing.post_reset_us);
+    makita.write(0xcc);
+    makita.transact(cmd, cmd_len, rsp, rsp_len);
+}
+
+void MakitaBMS::cmd_and_read_33(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len)
+{
+    makita.reset();
+    delayMicroseconds(_timing.post_reset_us);
+    makita.write(0x33);
+
+    byte initial_read[8]; // ROM ID，此處不使用
+    makita.readBytes(initial_read, sizeof(initial_read));
+    makita.transact(cmd, cmd_len, rsp, rsp_len);
+}
+
+bool MakitaBMS::isPresent()
+{
+    PowerSession session(*this);
+    return makita.reset();
+}
+
+bool MakitaBMS::readStaticFrame(byte *full_resp)
+{
+    const byte read_cmd[] = {0xAA, 0x00};
+    if (!makita.reset())
+        return false;
+    makita.write(0x33);
+    makita.readBytes(full_resp, 8);
+    makita.transact(read_cmd, sizeof(read_cmd), full_resp + 8, 32);
+    return true;
 }
 
 // --- 靜態數據讀取 ---
+
+// 多數決的投票單位：ROM ID (含製造日期) 整段比對，其餘為解碼用的欄位
+static const FieldDesc STATIC_VOTE_UNITS[] = {
+    field(0, StaticLayout::ROM_ID_LEN), StaticLayout::VOLTAGE_CLASS, StaticLayout::CAPACITY_DECI_AH,
+    StaticLayout::STATUS_CODE, StaticLayout::LOCK_CODE, StaticLayout::CHARGE_CYCLES,
+    StaticLayout::OVER_DISCHARGE, StaticLayout::OVER_LOAD};
+static const uint8_t STATIC_VOTE_UNIT_COUNT = sizeof(STATIC_VOTE_UNITS) / sizeof(STATIC_VOTE_UNITS[0]);
 String MakitaBMS::readStaticData(BatteryData &data, SupportedFeatures &features)
 {
     logger("--- NEW Starting Static Data Sync ---", LOG_LEVEL_INFO);
     _is_identified = false;
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
+    PowerSession session(*this);
 
-    const byte read_cmd[] = {0xAA, 0x00};
     byte full_resp[40];
-
-    if (makita.reset())
+    uint8_t agree[sizeof(full_resp)];
+    bool reset_ok = true;
+
+    uint32_t start = micros();
+    readVoted([&](byte *buf) {
+        if (!readStaticFrame(buf))
+            reset_ok = false;
+    }, full_resp, sizeof(full_resp), agree, STATIC_VOTE_UNITS, STATIC_VOTE_UNIT_COUNT);
+    if (!reset_ok)
     {
-        makita.write(0x33);
-        for (int i = 0; i < 8; i++)
-        {
-            full_resp[i] = makita.read();
-            delayMicroseconds(90);
-        }
-        for (int i = 0; i < 2; i++)
-        {
-            makita.write(read_cmd[i]);
-            delayMicroseconds(90);
-        }
-        for (int i = 8; i < 40; i++)
-        {
-            full_resp[i] = makita.read();
-            delayMicroseconds(90);
-        }
+        return "Reset failed";
     }
-    else
+    if (!fieldsVerified(agree, STATIC_VOTE_UNITS, STATIC_VOTE_UNIT_COUNT))
     {
-        digitalWrite(_enable_pin, HIGH);
-        return "Reset failed";
+        return "Static read unverified (no majority)";
     }
-
-    // ... 前段讀取 full_resp[40] 保持不變 ...
+    logger("Static frame bus time: " + String(micros() - start) + " us", LOG_LEVEL_DEBUG);
 
     log_hex("RAW_33_FULL: ", full_resp, 40);
 
-    char buf[16]; // 稍微加大緩衝區確保安全
+    // 解碼交給 FrameDecoder 描述表，這裡只保存原始數值
+    const StaticFields f = decodeStaticFrame(full_resp);
 
     // 1. 製造日期: 前 3 Byte [0]=年, [1]=月, [2]=日
-    sprintf(buf, "%02d/%02d/20%02d", full_resp[2], full_resp[1], full_resp[0]);
-    data.prod_date = String(buf);
+    data.prod_year = f.prod_year;
+    data.prod_month = f.prod_month;
+    data.prod_day = f.prod_day;
 
     // 2. 基本資訊：容量與電壓類型
-    data.capacity = String(nibble_swap(full_resp[24]) / 10.0f, 1) + "Ah";
-    data.battery_type = String(nibble_swap(full_resp[19])) + "V"; // 顯示如 18V
+    data.capacity_deci_ah = f.capacity_deci_ah;
+    data.voltage_class = f.voltage_class;
 
     // 3. 狀態碼與鎖定狀態 (對標 Status Code & State)
-    data.status_code_raw = full_resp[27]; // 存儲原始數值
-    char s_code[8];
-    sprintf(s_code, "0x%02X", full_resp[27]);
-    data.status_code_hex = String(s_code); // 修正成員名稱為 status_code_hex
-    
-    // 修正：更精確地解析鎖定狀態，對應 BatteryData 結構中的定義
-    // 0:正常, 1:永久鎖定(熔斷), 2:過熱暫時鎖定, 3:過放電鎖定
-    uint8_t lock_code = full_resp[28] & 0x0F;
-    switch(lock_code) {
-        case 0x00:
-            data.lock_status = 0; // 正常
-            break;
-        case 0x01:
-            data.lock_status = 3; // 過放電鎖定
-            break;
-        case 0x02:
-            data.lock_status = 2; // 過熱暫時鎖定
-            break;
-        case 0x03:
-            data.lock_status = 1; // 永久鎖定(熔斷)
-            break;
-        default: // 其他未知值也視為鎖定
-            data.lock_status = 1;
-            break;
-    }
+    data.status_code_raw = f.status_code; // 存儲原始數值
+    // 0:正常, 1:永久鎖定(熔斷), 2:過熱暫時鎖定, 3:過放電鎖定 (見 lockStatusFromCode)
+    data.lock_status = f.lock_status;
 
     // 4. 循環次數 (對標 Charge count*)
-    // 使用 c_low / c_high 組合，並移除後段重複定義的代碼
-    uint16_t c_low = nibble_swap(full_resp[35]);
-    uint16_t c_high = nibble_swap(full_resp[36]);
-    data.charge_cycles = ((c_high << 8) | c_low) & 0x0FFF;
+    data.charge_cycles = f.charge_cycles;
 
     // 5. 異常紀錄 (對標診斷儀：過放、過載)
-    data.over_discharge = full_resp[37];
-    data.over_load = full_resp[38];
+    data.over_discharge = f.over_discharge;
+    data.over_load = f.over_load;
 
-    // 6. 身份識別 (ROM ID 與 序號替代方案)
-    String rom_str = "";
-    for (int i = 0; i < 8; i++)
+    // 6. 身份識別 (ROM ID；序號由輸出端取後 6 碼)
+    memcpy(data.rom_id, f.rom_id, sizeof(data.rom_id));
+    // --- 識別控制器型號 ---
+    _controller = CONTROLLER_UNKNOWN;
+    if (getModel(data.model, sizeof(data.model)))
     {
-        char r_buf[3];
-        sprintf(r_buf, "%02X", full_resp[i]);
-        rom_str += r_buf;
+        _controller = CONTROLLER_STANDARD;
     }
-    data.rom_id = rom_str;
-    data.serial = "ID-" + rom_str.substring(rom_str.length() - 6);
-    // --- 識別控制器型號 ---
-    _controller_type = "UNKNOWN";
-    String model_str = getModel();
-    if (model_str != "")
+    else if (getF0513Model(data.model, sizeof(data.model)))
     {
-        _controller_type = "STANDARD";
-        data.model = model_str;
+        _controller = CONTROLLER_F0513;
     }
     else
     {
-        model_str = getF0513Model();
-        if (model_str != "")
-        {
-            _controller_type = "F0513";
-            data.model = model_str;
-        }
-        else
-        {
-            // 💡 修正處：如果都找不到，給它一個預設型號，不要直接跳出
-            _controller_type = "STANDARD";
-            data.model = "GENERIC_MAKITA";
-            logger("Unknown model string, forcing STANDARD mode", LOG_LEVEL_WARN);
-        }
+        // 💡 修正處：如果都找不到，給它一個預設型號，不要直接跳出
+        _controller = CONTROLLER_STANDARD;
+        strlcpy(data.model, "GENERIC_MAKITA", sizeof(data.model));
+        logger("Unknown model string, forcing STANDARD mode", LOG_LEVEL_WARN);
     }
     _is_identified = true;        // 強制標記為已識別
     features.read_dynamic = true; // 開啟動態更新功能
-    if (_controller_type == "STANDARD")
-    {
-        features.led_test = true;
-        features.clear_errors = true;
-    }
+    withController([&](auto c) {
+        using C = decltype(c);
+        features.led_test = C::FEATURE_LED_TEST;
+        features.clear_errors = C::FEATURE_CLEAR_ERRORS;
+    });
+    features.load_test = hasRelay(); // 與控制器無關，只看硬體
     // 修正：移除此處的呼叫。此呼叫會與外部的電源管理衝突，導致通訊失敗。
     // readAdvancedDiagnostics(data); 
-    digitalWrite(_enable_pin, HIGH);
     return "OK_NEW_LOGIC";
 }
 
+// --- 控制器分派 ---
+
+// 依識別結果選擇 traits；各協議路徑由模板在編譯期展開，分派只是一個 switch
+template <typename Fn>
+auto MakitaBMS::withController(Fn fn) -> decltype(fn(StandardController()))
+{
+    switch (_controller)
+    {
+    case CONTROLLER_F0513:
+        return fn(F0513Controller());
+    case CONTROLLER_STANDARD:
+    default:
+        return fn(StandardController());
+    }
+}
+
 // --- 動態數據讀取 ---
 String MakitaBMS::readDynamicData(BatteryData &data)
 {
     if (!_is_identified)
         return "Identify battery first.";
 
-    // 建立分流機制，避免時序錯亂
-    if (_controller_type == "STANDARD")
-    {
-        return readDynamicDataStandard(data);
-    }
-    else if (_controller_type == "F0513")
-    {
-        return readDynamicDataF0513(data);
-    }
-    return "Unknown Controller Type";
+    return withController([&](auto c) { return readDynamicDataT<decltype(c)>(data); });
 }
 
-// STANDARD 專用動態讀取
-String MakitaBMS::readDynamicDataStandard(BatteryData &data)
+template <typename C>
+String MakitaBMS::readDynamicDataT(BatteryData &data)
 {
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
-    byte resp[29];
-    const byte dyn_cmd[] = {0xD7, 0x00, 0x00, 0xFF};
-    cmd_and_read_cc(dyn_cmd, 4, resp, sizeof(resp));
+    PowerSession session(*this);
+    byte resp[C::DYN_FRAME_LEN];
+    const byte dyn_cmd[] = {C::DYN_OPCODE, C::DYN_ARG0, C::DYN_ARG1, C::DYN_ARG2};
+    uint8_t agree[sizeof(resp)];
+    constexpr DynamicLayout layout = dynamicLayout<C>();
+    static_assert(layoutFits(layout), "dynamic layout exceeds frame");
+    // 每個數值欄位整段投票 (未使用的電芯欄位寬度為 0，投票時略過)
+    const FieldDesc units[] = {layout.pack_mv, layout.temp1_centi, layout.temp2_centi, layout.cell_mv[0],
+                               layout.cell_mv[1], layout.cell_mv[2], layout.cell_mv[3], layout.cell_mv[4]};
+    const uint8_t unit_count = sizeof(units) / sizeof(units[0]);
+    uint8_t votes = readVoted([&](byte *buf) { cmd_and_read_cc(dyn_cmd, sizeof(dyn_cmd), buf, sizeof(resp)); },
+                              resp, sizeof(resp), agree, units, unit_count);
 
     // 新增：將讀取到的原始動態數據輸出到日誌
-    log_hex("RAW_DYN_STD: ", resp, sizeof(resp));
-
-    data.pack_voltage = ((resp[1] << 8) | resp[0]) / 1000.0f;
-    float min_v = 5.0, max_v = 0.0;
-    for (int i = 0; i < 5; i++)
-    {
-        float v = ((resp[i * 2 + 3] << 8) | resp[i * 2 + 2]) / 1000.0f;
-        data.cell_voltages[i] = v;
-        if (v > 0.5 && v < min_v) min_v = v;
-        if (v > max_v) max_v = v;
-    }
-    data.cell_diff = (max_v > min_v) ? (max_v - min_v) : 0.0;
-    data.temp1 = ((resp[15] << 8) | resp[14]) / 100.0f;
-    data.temp2 = ((resp[17] << 8) | resp[16]) / 100.0f;
-    digitalWrite(_enable_pin, HIGH);
+    log_hex(String("RAW_DYN_") + C::rawTag() + ": ", resp, sizeof(resp));
+    logger("Dynamic frame bus time: " + String(makita.lastTransactMicros()) + " us", LOG_LEVEL_DEBUG);
+
+    // 任一欄位沒有多數：不更新數據 (保留上一次的值)，由呼叫端回報錯誤
+    if (!fieldsVerified(agree, units, unit_count))
+        return "Dynamic read unverified (no majority)";
+
+    const DynamicFields d = decodeDynamicFrame(resp, layout);
+
+    data.pack_mv = d.pack_mv;
+    for (int i = 0; i < layout.cell_count; i++)
+        data.cell_mv[i] = d.cell_mv[i];
+    data.cell_diff_mv = d.cell_diff_mv;
+    data.temp1_centi = (int16_t)d.temp1_centi;
+    data.temp2_centi = (int16_t)d.temp2_centi;
+
+    data.confidence.verified = _verifyReads;
+    data.confidence.pack_voltage = fieldPct(agree, layout.pack_mv, votes);
+    for (int i = 0; i < layout.cell_count; i++)
+        data.confidence.cell_voltages[i] = fieldPct(agree, layout.cell_mv[i], votes);
+    data.confidence.temp1 = fieldPct(agree, layout.temp1_centi, votes);
+    data.confidence.temp2 = fieldPct(agree, layout.temp2_centi, votes);
     return "";
 }
 
-// F0513 專用動態讀取 (獨立機制)
-String MakitaBMS::readDynamicDataF0513(BatteryData &data)
+bool MakitaBMS::sampleDynamic(DynamicSample &out)
 {
-    digitalWrite(_enable_pin, LOW);
-    delay(400); // F0513 可能需要不同的喚醒延遲，這裡暫時保持一致，但已隔離
-    byte resp[29];
-    const byte dyn_cmd[] = {0xD7, 0x00, 0x00, 0xFF};
-    cmd_and_read_cc(dyn_cmd, 4, resp, sizeof(resp));
+    if (!_is_identified)
+        return false;
 
-    // 新增：將讀取到的原始動態數據輸出到日誌
-    log_hex("RAW_DYN_F0513: ", resp, sizeof(resp));
-
-    data.pack_voltage = ((resp[1] << 8) | resp[0]) / 1000.0f;
-    // F0513 的數據解析邏輯與 Standard 相同
-    float min_v = 5.0, max_v = 0.0;
-    for (int i = 0; i < 5; i++) {
-        float v = ((resp[i * 2 + 3] << 8) | resp[i * 2 + 2]) / 1000.0f;
-        data.cell_voltages[i] = v;
-        if (v > 0.5 && v < min_v) min_v = v;
-        if (v > max_v) max_v = v;
-    }
-    data.cell_diff = (max_v > min_v) ? (max_v - min_v) : 0.0;
-    data.temp1 = ((resp[15] << 8) | resp[14]) / 100.0f;
-    // 修正：補上 temp2 讀取
-    data.temp2 = ((resp[17] << 8) | resp[16]) / 100.0f;
-    digitalWrite(_enable_pin, HIGH);
-    return "";
+    return withController([&](auto c) { return sampleDynamicT<decltype(c)>(out); });
+}
+
+template <typename C>
+bool MakitaBMS::sampleDynamicT(DynamicSample &out)
+{
+    PowerSession session(*this);
+    byte resp[C::DYN_FRAME_LEN];
+    const byte dyn_cmd[] = {C::DYN_OPCODE, C::DYN_ARG0, C::DYN_ARG1, C::DYN_ARG2};
+
+    if (!makita.reset())
+        return false;
+    delayMicroseconds(_timing.post_reset_us);
+    makita.write(0xcc);
+    out.t_us = micros();
+    makita.transact(dyn_cmd, sizeof(dyn_cmd), resp, sizeof(resp));
+    out.bus_us = (uint16_t)min<uint32_t>(makita.lastTransactMicros(), 0xFFFF);
+
+    constexpr DynamicLayout layout = dynamicLayout<C>();
+    const DynamicFields d = decodeDynamicFrame(resp, layout);
+    out.pack_mv = d.pack_mv;
+    for (int i = 0; i < MAX_CELLS; i++)
+        out.cell_mv[i] = i < layout.cell_count ? d.cell_mv[i] : 0;
+    out.cell_diff_mv = d.cell_diff_mv;
+    out.temp1_centi = (int16_t)d.temp1_centi;
+    out.temp2_centi = (int16_t)d.temp2_centi;
+    out.load_test = false;
+    return true;
 }
 
 void MakitaBMS::readAdvancedDiagnostics(BatteryData &data)
 {
-    // 分流處理：確保不同控制器的進階診斷邏輯互不干擾
-    if (_controller_type == "STANDARD")
-    {
-        readAdvancedDiagnosticsStandard(data);
-    }
-    else if (_controller_type == "F0513")
-    {
-        readAdvancedDiagnosticsF0513(data);
-    }
+    if (!_is_identified)
+        return;
+
+    withController([&](auto c) { readAdvancedDiagnosticsT<decltype(c)>(data); });
 }
 
-void MakitaBMS::readAdvancedDiagnosticsStandard(BatteryData &data) {
-    // 修正：在執行通訊前，確保電池電源已開啟
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
+// --- 第二指令樹暫存器快照 ---
+
+static const uint16_t F0513_MODEL_SETTLE_MS = 100; // 讀取 F0513 型號 (0x31) 前的第二指令樹穩定時間
 
-    // 1. 進入第二指令樹 (存取隱藏暫存器)
+// 進階診斷讀取的暫存器；順序即快照陣列索引 (新增暫存器時兩者一起擴充)
+static const uint8_t DIAG_REGS[] = {
+    TREE2_OVER_DISCHARGE, TREE2_OVER_LOAD,
+    TREE2_ERR_04, TREE2_ERR_05, TREE2_ERR_06, TREE2_ERR_07,
+    TREE2_FUSE, TREE2_FW_VER, TREE2_TEMP3};
+enum DiagIndex : uint8_t
+{
+    DIAG_OVER_DISCHARGE = 0,
+    DIAG_OVER_LOAD,
+    DIAG_ERR_04,
+    DIAG_ERR_05,
+    DIAG_ERR_06,
+    DIAG_ERR_07,
+    DIAG_FUSE,
+    DIAG_FW_VER,
+    DIAG_TEMP3,
+    DIAG_COUNT
+};
+static_assert(sizeof(DIAG_REGS) == DIAG_COUNT, "DIAG_REGS and DiagIndex out of sync");
+
+void MakitaBMS::enterTree2(uint16_t settle_ms)
+{
     const byte enter_tree2[] = {0x99};
     cmd_and_read_cc(enter_tree2, 1, nullptr, 0);
-    delay(150); // 修正：增加延遲，提高對不同電池的相容性
-
-    // 2. 讀取原始數據
-    uint8_t real_over_discharge = readOneWireByte(0x08);
-    uint8_t real_over_load = readOneWireByte(0x09);
-    uint8_t val04 = readOneWireByte(0x04);
-    uint8_t val05 = readOneWireByte(0x05);
-    uint8_t val06 = readOneWireByte(0x06);
-    uint8_t val07 = readOneWireByte(0x07);
-    uint8_t f_val = readOneWireByte(0x0C);
-    uint8_t val_fw = readOneWireByte(0x32); // Martin 提到的固件版本位址
-    uint8_t temp3_raw = readOneWireByte(0x0A); // 修正：讀取第三溫度地址 0x0A
- 
-    // 3. 過濾 255 亂碼並賦值給結構體
-    // 在 1-Wire 中，255 (0xFF) 通常代表讀取失敗或位址不匹配
-    data.over_discharge = (real_over_discharge == 255) ? 0 : real_over_discharge;
-    data.over_load = (real_over_load == 255) ? 0 : real_over_load;
-    data.err_cnt_04 = (val04 == 255) ? 0 : val04;
-    data.err_cnt_05 = (val05 == 255) ? 0 : val05;
-    data.err_cnt_06 = (val06 == 255) ? 0 : val06;
-    data.err_cnt_07 = (val07 == 255) ? 0 : val07;
-    data.fw_ver = (val_fw == 255) ? 0 : val_fw;
-    // 新增：處理第三溫度
-    // 0xFF 代表讀取失敗。原始值減 100 是常見的轉換公式。
-    if (temp3_raw != 255)
-    {
-        data.temp3 = (float)temp3_raw - 100.0f;
-    }
- 
-    // 4. 判定軟體保險絲狀態 (核心邏輯)
-    long s_num = data.status_code_raw;
-    // 判定條件：有值 (f_val > 0) 且 不是通訊失敗 (f_val != 255) 且 狀態碼異常 (s_num != 0x60)
-    if (f_val > 0 && f_val != 255 && s_num != 0x60)
-    {
-        data.fuse_blown = 1; // 真正的鎖定狀態
-    }
-    else
-    {
-        data.fuse_blown = 0; // 健康電池或新版協議誤讀，視為正常
-    }
-
-    // 5. 序列號輸出偵錯資訊 (方便觀察新電池版本)
-    if (val_fw != 255)
-    {
-        Serial.printf("[BMS] Advanced Diagnostic - FW Ver: %02X, FuseRaw: %02X, Status: %02X\n",
-                      val_fw, f_val, (uint8_t)s_num);
-    }
+    delay(settle_ms);
+}
 
-    // 6. 退出第二指令樹，回到主面板
+void MakitaBMS::exitTree2()
+{
     const byte exit_cmd[] = {0xF0, 0x00};
     cmd_and_read_cc(exit_cmd, 2, nullptr, 0);
-
-    // 修正：通訊結束後，關閉電池電源
-    digitalWrite(_enable_pin, HIGH);
 }
 
-void MakitaBMS::readAdvancedDiagnosticsF0513(BatteryData &data) {
-    // F0513 專用進階診斷邏輯 (目前結構與 Standard 相同，但獨立封裝以便未來調整時序)
-    
-    // 修正：在執行通訊前，確保電池電源已開啟
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
+// 依位址清單讀出暫存器快照 (呼叫端需已進入第二指令樹)
+void MakitaBMS::readTree2Registers(const uint8_t *regs, uint8_t count, uint8_t *out)
+{
+    makita.readRegisters(0xCC, regs, count, out);
+    logger("Tree-2 snapshot (" + String(count) + " regs) bus time: " + String(makita.lastTransactMicros()) +
+               " us (pulse train " + String(makita.lastPulseMicros()) + " us)", LOG_LEVEL_DEBUG);
+}
 
-    // 1. 進入第二指令樹
-    const byte enter_tree2[] = {0x99};
-    cmd_and_read_cc(enter_tree2, 1, nullptr, 0);
-    delay(150); // 修正：增加延遲，同步 Standard 版本的修改
-
-    // 2. 讀取原始數據
-    uint8_t real_over_discharge = readOneWireByte(0x08);
-    uint8_t real_over_load = readOneWireByte(0x09);
-    uint8_t val04 = readOneWireByte(0x04);
-    uint8_t val05 = readOneWireByte(0x05);
-    uint8_t val06 = readOneWireByte(0x06);
-    uint8_t val07 = readOneWireByte(0x07);
-    uint8_t f_val = readOneWireByte(0x0C);
-    uint8_t val_fw = readOneWireByte(0x32);
-    uint8_t temp3_raw = readOneWireByte(0x0A); // 新增：讀取第三溫度
-
-    // 3. 過濾與賦值
-    data.over_discharge = (real_over_discharge == 255) ? 0 : real_over_discharge;
-    data.over_load = (real_over_load == 255) ? 0 : real_over_load;
-    data.err_cnt_04 = (val04 == 255) ? 0 : val04;
-    data.err_cnt_05 = (val05 == 255) ? 0 : val05;
-    data.err_cnt_06 = (val06 == 255) ? 0 : val06;
-    data.err_cnt_07 = (val07 == 255) ? 0 : val07;
-    data.fw_ver = (val_fw == 255) ? 0 : val_fw;
-    // 新增：處理第三溫度
+// 解讀進階診斷快照；Standard 與 F0513 目前共用同一組暫存器定義
+void MakitaBMS::decodeDiagnostics(const uint8_t *snap, const uint8_t *agree, uint8_t votes, BatteryData &data, const char *tag)
+{
+    FieldConfidence &c = data.confidence;
+    c.over_discharge = votePct(agree[DIAG_OVER_DISCHARGE], votes);
+    c.over_load = votePct(agree[DIAG_OVER_LOAD], votes);
+    for (int i = 0; i < 4; i++)
+        c.err_cnt[i] = votePct(agree[DIAG_ERR_04 + i], votes);
+    c.fuse = votePct(agree[DIAG_FUSE], votes);
+    c.fw_ver = votePct(agree[DIAG_FW_VER], votes);
+    c.temp3 = votePct(agree[DIAG_TEMP3], votes);
+
+    // 過濾 255 亂碼並賦值給結構體
+    // 在 1-Wire 中，255 (0xFF) 通常代表讀取失敗或位址不匹配，以可信度 0 標示
+    data.over_discharge = filterUnread(snap[DIAG_OVER_DISCHARGE], c.over_discharge);
+    data.over_load = filterUnread(snap[DIAG_OVER_LOAD], c.over_load);
+    data.err_cnt_04 = filterUnread(snap[DIAG_ERR_04], c.err_cnt[0]);
+    data.err_cnt_05 = filterUnread(snap[DIAG_ERR_05], c.err_cnt[1]);
+    data.err_cnt_06 = filterUnread(snap[DIAG_ERR_06], c.err_cnt[2]);
+    data.err_cnt_07 = filterUnread(snap[DIAG_ERR_07], c.err_cnt[3]);
+    data.fw_ver = filterUnread(snap[DIAG_FW_VER], c.fw_ver);
+
+    // 第三溫度：0xFF 代表讀取失敗。原始值 (°C) 減 100 是常見的轉換公式，換算為 0.01°C 保存。
+    uint8_t temp3_raw = snap[DIAG_TEMP3];
     if (temp3_raw != 255)
     {
-        data.temp3 = (float)temp3_raw - 100.0f;
+        data.temp3_centi = (int16_t)((temp3_raw - 100) * 100);
+    }
+    else
+    {
+        c.temp3 = 0; // 沿用舊值，但標示本次未讀到
     }
 
-    // 4. 判定軟體保險絲狀態
+    // 判定軟體保險絲狀態 (核心邏輯)
+    // 判定條件：有值 (f_val > 0) 且 不是通訊失敗 (f_val != 255) 且 狀態碼異常 (s_num != 0x60)
+    uint8_t f_val = snap[DIAG_FUSE];
     long s_num = data.status_code_raw;
     if (f_val > 0 && f_val != 255 && s_num != 0x60)
     {
-        data.fuse_blown = 1;
+        data.fuse_blown = 1; // 真正的鎖定狀態
     }
-    else
+    else if (f_val == 255)
     {
         data.fuse_blown = 0;
+        c.fuse = 0; // 通訊失敗，無法判定
     }
-
-    // 5. 輸出偵錯資訊
-    if (val_fw != 255)
+    else
     {
-        // 使用 F0513 專屬標籤方便區分
-        Serial.printf("[F0513] Adv Diag - FW: %02X, FuseRaw: %02X, Status: %02X\n",
-                      val_fw, f_val, (uint8_t)s_num);
+        data.fuse_blown = 0; // 健康電池或新版協議誤讀，視為正常
     }
 
-    // 6. 退出第二指令樹
-    const byte exit_cmd[] = {0xF0, 0x00};
-    cmd_and_read_cc(exit_cmd, 2, nullptr, 0);
-
-    // 修正：通訊結束後，關閉電池電源
-    digitalWrite(_enable_pin, HIGH);
+    // 序列號輸出偵錯資訊 (方便觀察新電池版本)
+    if (snap[DIAG_FW_VER] != 255)
+    {
+        Serial.printf("[%s] Adv Diag - FW: %02X, FuseRaw: %02X, Status: %02X\n",
+                      tag, snap[DIAG_FW_VER], f_val, (uint8_t)s_num);
+    }
 }
 
-// 輔助函數：讀取特定指令回傳的位元組
-uint8_t MakitaBMS::readOneWireByte(byte cmd)
+template <typename C>
+void MakitaBMS::readAdvancedDiagnosticsT(BatteryData &data)
 {
-    makita.reset();
-    makita.write(0xCC);
-    makita.write(cmd);
-    return makita.read();
+    // 修正：在執行通訊前，確保電池電源已開啟 (已在外層會話中則沿用)
+    PowerSession session(*this);
+
+    // 進入第二指令樹一次，整份暫存器快照 (含多數決重讀) 都在其中完成
+    uint8_t snap[DIAG_COUNT];
+    uint8_t agree[DIAG_COUNT];
+    enterTree2(_timing.tree2_settle_ms); // 修正：增加延遲，提高對不同電池的相容性
+    uint8_t votes = readVoted([&](byte *buf) { readTree2Registers(DIAG_REGS, DIAG_COUNT, buf); }, snap, DIAG_COUNT, agree);
+    exitTree2();
+
+    decodeDiagnostics(snap, agree, votes, data, C::tag());
 }
 
-String MakitaBMS::getModel()
+bool MakitaBMS::getModel(char *out, size_t len)
 {
     byte resp[16];
     const byte model_cmd[] = {0xDC, 0x0C};
     cmd_and_read_cc(model_cmd, 2, resp, sizeof(resp));
     if (resp[0] == 0xFF || resp[0] == 0x00)
-        return "";
+        return false;
     char m[8];
     memcpy(m, resp, 7);
     m[7] = '\0';
-    return String(m);
+    strlcpy(out, m, len);
+    return true;
 }
 
-String MakitaBMS::getF0513Model()
+bool MakitaBMS::getF0513Model(char *out, size_t len)
 {
-    const byte f_cmd[] = {0x99};
-    cmd_and_read_cc(f_cmd, 1, nullptr, 0);
-    delay(100);
+    // 型號指令一向只等 100ms (與診斷快照的 tree2_settle_ms 分開；校準得到更短的值時沿用)
+    enterTree2(min<uint16_t>(F0513_MODEL_SETTLE_MS, _timing.tree2_settle_ms));
     makita.reset();
     makita.write(0xCC); // 修正：遵循 1-Wire 協議，發送 Skip ROM
     makita.write(0x31); // 然後才發送功能指令
     byte r[2];
     r[0] = makita.read();
     r[1] = makita.read();
-    const byte clr[] = {0xF0, 0x00};
-    cmd_and_read_cc(clr, 2, nullptr, 0);
+    exitTree2();
     if (r[0] == 0xFF)
-        return "";
-    char buf[8];
-    sprintf(buf, "BL%02X%02X", r[1], r[0]);
-    return String(buf);
+        return false;
+    snprintf(out, len, "BL%02X%02X", r[1], r[0]);
+    return true;
 }
 
 String MakitaBMS::ledTest(bool on)
 {
     if (!_is_identified) return "N/A";
-    
-    if (_controller_type == "STANDARD") return ledTestStandard(on);
-    if (_controller_type == "F0513") return ledTestF0513(on);
-    
-    return "N/A";
+
+    return withController([&](auto c) {
+        using C = decltype(c);
+        return sendActionT<C>(on ? C::LED_ON_ARG : C::LED_OFF_ARG);
+    });
 }
 
-String MakitaBMS::ledTestStandard(bool on)
+String MakitaBMS::clearErrors()
 {
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
-    byte dummy[9];
-    const byte unlock_cmd[] = {0xD9, 0x96, 0xA5};
-    cmd_and_read_33(unlock_cmd, 3, dummy, 9);
-    const byte action_cmd[] = {0xDA, (byte)(on ? 0x31 : 0x34)};
-    cmd_and_read_33(action_cmd, 2, dummy, 9);
-    digitalWrite(_enable_pin, HIGH);
-    return "";
+    if (!_is_identified) return "N/A";
+
+    return withController([&](auto c) {
+        using C = decltype(c);
+        return sendActionT<C>(C::CLEAR_ERRORS_ARG);
+    });
 }
 
-String MakitaBMS::ledTestF0513(bool on)
+// 0x33 控制指令：先以 D9 96 A5 解鎖，再送出 DA + 參數
+template <typename C>
+String MakitaBMS::sendActionT(uint8_t arg)
 {
-    // F0513 獨立 LED 控制邏輯
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
+    PowerSession session(*this);
     byte dummy[9];
     const byte unlock_cmd[] = {0xD9, 0x96, 0xA5};
     cmd_and_read_33(unlock_cmd, 3, dummy, 9);
-    const byte action_cmd[] = {0xDA, (byte)(on ? 0x31 : 0x34)};
+    const byte action_cmd[] = {C::ACTION_OPCODE, arg};
     cmd_and_read_33(action_cmd, 2, dummy, 9);
-    digitalWrite(_enable_pin, HIGH);
     return "";
 }
 
-String MakitaBMS::clearErrors()
+// --- 時序校準 ---
+
+// 校準用的第二指令樹暫存器 (內容固定，不含會變動的溫度)
+static const uint8_t CALIBRATION_TREE2_REGS[] = {TREE2_FW_VER, TREE2_OVER_DISCHARGE, TREE2_OVER_LOAD, TREE2_FUSE};
+static const uint8_t CALIBRATION_REPEATS = 3;     // 每個候選值需連續驗證成功的次數
+static const uint16_t CALIBRATION_POWER_OFF_MS = 300; // 喚醒測試前的斷電時間
+
+// 各項延遲的候選值，由安全值往下遞減
+static const uint16_t WAKE_STEPS_MS[] = {400, 300, 200, 150, 100, 60};
+static const uint16_t POST_RESET_STEPS_US[] = {400, 300, 200, 120, 60, 20};
+static const uint16_t GAP_STEPS_US[] = {90, 70, 50, 30, 20, 10, 0};
+static const uint16_t TREE2_STEPS_MS[] = {150, 100, 60, 30, 10};
+
+// 由安全值開始逐步縮短，直到驗證失敗或用完所有級距。
+// 保存的是最快通過值的上一級 (全部通過時也一樣)，保留一級安全餘裕給溫度與電量造成的時序漂移
+template <size_t N, typename Verify>
+static uint16_t stepDown(const uint16_t (&steps)[N], Verify verify)
 {
-    if (!_is_identified) return "N/A";
+    size_t best = 0;
+    for (size_t i = 1; i < N; i++)
+    {
+        if (!verify(steps[i]))
+            break;
+        best = i;
+    }
+    return steps[best > 0 ? best - 1 : 0];
+}
 
-    if (_controller_type == "STANDARD") return clearErrorsStandard();
-    if (_controller_type == "F0513") return clearErrorsF0513();
+// 讀取校準用的三組固定內容：0x33 靜態幀、0xDC 型號幀、第二指令樹暫存器
+bool MakitaBMS::readCalibrationFrames(byte *static_frame, byte *model_frame, uint8_t *tree2_regs)
+{
+    if (!readStaticFrame(static_frame))
+        return false;
 
-    return "N/A";
+    const byte model_cmd[] = {0xDC, 0x0C};
+    cmd_and_read_cc(model_cmd, 2, model_frame, 16);
+
+    enterTree2(_timing.tree2_settle_ms);
+    readTree2Registers(CALIBRATION_TREE2_REGS, sizeof(CALIBRATION_TREE2_REGS), tree2_regs);
+    exitTree2();
+    return true;
 }
 
-String MakitaBMS::clearErrorsStandard()
+String MakitaBMS::calibrateTiming(BusTimingProfile &result)
 {
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
-    byte dummy[9];
-    const byte unlock_cmd[] = {0xD9, 0x96, 0xA5};
-    cmd_and_read_33(unlock_cmd, 3, dummy, 9);
-    const byte reset_cmd[] = {0xDA, 0x04};
-    cmd_and_read_33(reset_cmd, 2, dummy, 9);
+    if (!_is_identified)
+        return "Identify battery first.";
+
+    logger("--- Starting Bus Timing Calibration ---", LOG_LEVEL_INFO);
+    const BusTimingProfile previous = _timing;
+    setTimingProfile(BusTimingProfile()); // 以安全時序取得參考值
+
+    PowerSession session(*this);
+
+    byte ref_static[40], ref_model[16];
+    uint8_t ref_tree2[sizeof(CALIBRATION_TREE2_REGS)];
+    if (!readCalibrationFrames(ref_static, ref_model, ref_tree2))
+    {
+        setTimingProfile(previous);
+        return "Reset failed";
+    }
+
+    // 目前時序下連續讀取 CALIBRATION_REPEATS 次，全部與參考值一致才算可靠
+    auto verify = [&]() -> bool {
+        for (uint8_t n = 0; n < CALIBRATION_REPEATS; n++)
+        {
+            byte s[40], m[16];
+            uint8_t t[sizeof(CALIBRATION_TREE2_REGS)];
+            if (!readCalibrationFrames(s, m, t) ||
+                memcmp(s, ref_static, sizeof(s)) != 0 ||
+                memcmp(m, ref_model, sizeof(m)) != 0 ||
+                memcmp(t, ref_tree2, sizeof(t)) != 0)
+                return false;
+        }
+        return true;
+    };
+
+    if (!verify())
+    {
+        setTimingProfile(previous);
+        return "Unstable at safe timing";
+    }
+
+    result = _timing;
+
+    result.inter_byte_us = stepDown(GAP_STEPS_US, [&](uint16_t v) {
+        makita.setInterByteGap(v);
+        return verify();
+    });
+    setTimingProfile(result);
+
+    result.post_reset_us = stepDown(POST_RESET_STEPS_US, [&](uint16_t v) {
+        _timing.post_reset_us = v;
+        return verify();
+    });
+    setTimingProfile(result);
+
+    result.tree2_settle_ms = stepDown(TREE2_STEPS_MS, [&](uint16_t v) {
+        _timing.tree2_settle_ms = v;
+        return verify();
+    });
+    setTimingProfile(result);
+
+    // 喚醒延遲：每次都先斷電再以候選值重新喚醒
+    result.wake_ms = stepDown(WAKE_STEPS_MS, [&](uint16_t v) {
+        for (uint8_t n = 0; n < CALIBRATION_REPEATS; n++)
+        {
+            digitalWrite(_enable_pin, HIGH);
+            delay(CALIBRATION_POWER_OFF_MS);
+            digitalWrite(_enable_pin, LOW);
+            delay(v);
+            byte s[40];
+            if (!readStaticFrame(s) || memcmp(s, ref_static, sizeof(s)) != 0)
+                return false;
+        }
+        return true;
+    });
+    setTimingProfile(result);
+
+    // 最後一次喚醒測試可能失敗，以安全喚醒時間恢復電池狀態
     digitalWrite(_enable_pin, HIGH);
+    delay(CALIBRATION_POWER_OFF_MS);
+    digitalWrite(_enable_pin, LOW);
+    delay(BusTimingProfile().wake_ms);
+
+    logger("Calibrated timing: wake=" + String(result.wake_ms) + "ms, reset=" + String(result.post_reset_us) +
+               "us, gap=" + String(result.inter_byte_us) + "us, tree2=" + String(result.tree2_settle_ms) + "ms",
+           LOG_LEVEL_INFO);
     return "";
 }
 
-String MakitaBMS::clearErrorsF0513()
+// --- 輸出端格式化 ---
+
+bool hasRomId(const BatteryData &data)
 {
-    // F0513 獨立錯誤清除邏輯
-    digitalWrite(_enable_pin, LOW);
-    delay(400);
-    byte dummy[9];
-    const byte unlock_cmd[] = {0xD9, 0x96, 0xA5};
-    cmd_and_read_33(unlock_cmd, 3, dummy, 9);
-    const byte reset_cmd[] = {0xDA, 0x04};
-    cmd_and_read_33(reset_cmd, 2, dummy, 9);
-    digitalWrite(_enable_pin, HIGH);
-    return "";
-}
\ No newline at end of file
+    for (uint8_t b : data.rom_id)
+        if (b != 0)
+            return true;
+    return false;
+}
+
+void formatRomId(const uint8_t *rom_id, char *out)
+{
+    for (int i = 0; i < 8; i++)
+        sprintf(out + i * 2, "%02X", rom_id[i]);
+}
+
+bool romIdEndsWith(const uint8_t *rom_id, const char *hex_suffix, size_t len)
+{
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    if (len > 16)
+        return false;
+    for (size_t k = 0; k < len; k++)
+    {
+        size_t pos = 16 - len + k;
+        uint8_t b = rom_id[pos / 2];
+        if (HEX_DIGITS[(pos % 2) ? (b & 0x0F) : (b >> 4)] != hex_suffix[k])
+            return false;
+    }
+    return true;
+}
+
+void formatBatteryLabels(const BatteryData &data, BatteryLabels &out)
+{
+    if (!hasRomId(data))
+    {
+        // 尚未識別：沿用舊版的預設顯示值
+        out.rom_id[0] = '\0';
+        strlcpy(out.serial, "N/A", sizeof(out.serial));
+        strlcpy(out.prod_date, "N/A", sizeof(out.prod_date));
+        strlcpy(out.capacity, "N/A", sizeof(out.capacity));
+        strlcpy(out.battery_type, "LXT", sizeof(out.battery_type));
+        strlcpy(out.status_hex, "00", sizeof(out.status_hex));
+        return;
+    }
+    formatRomId(data.rom_id, out.rom_id);
+    snprintf(out.serial, sizeof(out.serial), "ID-%s", out.rom_id + 10);
+    snprintf(out.prod_date, sizeof(out.prod_date), "%02u/%02u/20%02u", data.prod_day % 100, data.prod_month % 100, data.prod_year % 100);
+    snprintf(out.capacity, sizeof(out.capacity), "%u.%uAh", data.capacity_deci_ah / 10, data.capacity_deci_ah % 10);
+    snprintf(out.battery_type, sizeof(out.battery_type), "%uV", data.voltage_class);
+    snprintf(out.status_hex, sizeof(out.status_hex), "0x%02X", (uint8_t)data.status_code_raw);
+}
+
+void applyDynamicSample(const DynamicSample &sample, BatteryData &data)
+{
+    data.pack_mv = sample.pack_mv;
+    for (int i = 0; i < 5; i++)
+        data.cell_mv[i] = sample.cell_mv[i];
+    data.cell_diff_mv = sample.cell_diff_mv;
+    data.temp1_centi = sample.temp1_centi;
+    data.temp2_centi = sample.temp2_centi;
+}
+
+void clearDynamicFields(BatteryData &data)
+{
+    const BatteryData blank;
+    data.pack_mv = blank.pack_mv;
+    memcpy(data.cell_mv, blank.cell_mv, sizeof(data.cell_mv));
+    data.cell_diff_mv = blank.cell_diff_mv;
+    data.temp1_centi = blank.temp1_centi;
+    data.temp2_centi = blank.temp2_centi;
+    data.temp3_centi = blank.temp3_centi;
+    data.fw_ver = blank.fw_ver;
+    data.err_cnt_04 = blank.err_cnt_04;
+    data.err_cnt_05 = blank.err_cnt_05;
+    data.err_cnt_06 = blank.err_cnt_06;
+    data.err_cnt_07 = blank.err_cnt_07;
+    data.fuse_blown = blank.fuse_blown;
+    data.remaining_capacity = blank.remaining_capacity;
+    data.full_capacity = blank.full_capacity;
+    data.health_pct = blank.health_pct;
+    data.cell_diff_ewma_mv = blank.cell_diff_ewma_mv;
+    data.cell_diff_trend_mv = blank.cell_diff_trend_mv;
+    data.thermal_spread_centi = blank.thermal_spread_centi;
+    data.anomaly_flags = blank.anomaly_flags;
+    data.confidence = blank.confidence;
+}
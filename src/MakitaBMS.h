@@ -3,7 +3,10 @@
 
 #include <Arduino.h>
 #include <functional>
-#include "OneWireMakita.h"
+#include <type_traits>
+#include "MakitaBus.h"
+#include "ControllerTraits.h"
+#include "FrameDecoder.h"
 
 // 定義日誌等級
 enum LogLevel
@@ -17,33 +20,77 @@ enum LogLevel
 
 using LogCallback = std::function<void(const String &, LogLevel)>;
 
+// 第二指令樹 (0x99) 暫存器位址
+enum Tree2Register : uint8_t
+{
+    TREE2_ERR_04 = 0x04,
+    TREE2_ERR_05 = 0x05,
+    TREE2_ERR_06 = 0x06,
+    TREE2_ERR_07 = 0x07,
+    TREE2_OVER_DISCHARGE = 0x08,
+    TREE2_OVER_LOAD = 0x09,
+    TREE2_TEMP3 = 0x0A,  // 第三溫度 (原始值 - 100)
+    TREE2_FUSE = 0x0C,   // 軟體熔斷紀錄
+    TREE2_FW_VER = 0x32  // 固件版本
+};
+
+// 各欄位可信度 (0-100%)：多數決中最終值所得票數的比例。
+// 未啟用驗證時為 100；暫存器回傳 0xFF (讀取失敗) 或重試後仍無多數時為 0。
+struct FieldConfidence
+{
+    bool verified = false; // 本次數據是否經過多數決驗證
+    uint8_t pack_voltage = 100;
+    uint8_t cell_voltages[5] = {100, 100, 100, 100, 100};
+    uint8_t temp1 = 100;
+    uint8_t temp2 = 100;
+    uint8_t temp3 = 100;
+    uint8_t over_discharge = 100;
+    uint8_t over_load = 100;
+    uint8_t err_cnt[4] = {100, 100, 100, 100}; // 04, 05, 06, 07
+    uint8_t fuse = 100;
+    uint8_t fw_ver = 100;
+};
+
+// 讀取驗證的累計統計
+struct ReadStats
+{
+    uint32_t frames = 0;     // 經過多數決的讀取次數
+    uint32_t mismatches = 0; // 投票不一致 (未達全票) 的次數
+    uint32_t retries = 0;    // 因無多數而重試的次數
+    uint32_t failures = 0;   // 重試用盡仍無多數，欄位標為未驗證的次數
+};
+
+// 電池數據：純資料 (trivially copyable)，不含 String，複製時不觸碰 heap。
+// 顯示用字串 (ROM ID、序號、日期、容量...) 只在輸出端由 formatBatteryLabels() 產生。
 struct BatteryData {
     // === 靜態資訊 (Static Data - 來自 11h/EEPROM) ===
-    String model = "N/A";
-    String serial = "N/A";
-    String rom_id = "";
-    String prod_date = "N/A";     // 解析自 11h 特定偏移
-    String capacity = "N/A";
-    String battery_type = "LXT";
+    char model[16] = "N/A";
+    uint8_t rom_id[8] = {0};       // 原始 ROM ID，全 0 表示尚未識別
+    uint8_t prod_year = 0;         // 20xx (解析自 11h 特定偏移)
+    uint8_t prod_month = 0;
+    uint8_t prod_day = 0;
+    uint8_t capacity_deci_ah = 0;  // 0.1Ah
+    uint8_t voltage_class = 0;     // V；尚未識別時顯示為 LXT，識別後照原始值顯示 (0 即 "0V")
     int fw_ver = 0;
 
     // === 動態數據 (Dynamic Data - 來自 33h/3Bh) ===
-    float pack_voltage = 0.0;
-    float cell_voltages[5] = {0.0};
-    float cell_diff = 0.0;
-    float temp1 = 0.0;
-    float temp2 = 0.0;
-    float temp3 = 0.0;               // 來自 0Ah 偏移，第三溫度感測器
+    // 一律保存 BMS 回報的整數單位，換算成 V / °C 只在瀏覽器端進行
+    uint16_t pack_mv = 0;            // mV
+    uint16_t cell_mv[5] = {0};       // mV
+    uint16_t cell_diff_mv = 0;       // mV
+    int16_t temp1_centi = 0;         // 0.01°C
+    int16_t temp2_centi = 0;         // 0.01°C
+    int16_t temp3_centi = 0;         // 0.01°C，來自 0Ah 偏移，第三溫度感測器
     
     // === 壽命與健康 (Life & Health) ===
     int charge_cycles = 0;
-    uint16_t remaining_capacity = 0; // mAh (rosvall 協議)
-    uint16_t full_capacity = 0;      // mAh
+    // 以下三項 BMS 不直接回報，由 PackAnalytics 依壽命計數器與電芯電壓估計
+    uint16_t remaining_capacity = 0; // mAh
+    uint16_t full_capacity = 0;      // mAh (標稱容量 × SOH)
     uint8_t health_pct = 0;          // 0-100%
 
     // === 錯誤與鎖定狀態 (Status & Errors - 核心診斷) ===
     uint16_t status_code_raw = 0;    // 原始狀態碼
-    String status_code_hex = "00";   // 十六進制顯示
     
     // 鎖定狀態
     uint8_t lock_status = 0; //：0:正常, 1:永久鎖定(熔斷), 2:過熱暫時鎖定, 3:過放電鎖定
@@ -55,6 +102,62 @@ struct BatteryData {
     uint8_t err_cnt_06 = 0;     // 充電錯誤 ()
     uint8_t err_cnt_07 = 0;     // 錯誤計數 07 (限 2 次)
     uint8_t fuse_blown = 0;     // 軟體熔斷紀錄 0C (限 1 次)
+
+    // === 分析結果 (PackAnalytics 每筆樣本更新，見 Analytics.h) ===
+    uint16_t cell_diff_ewma_mv = 0;   // 壓差的短期平均 (時間常數 30 秒)
+    int16_t cell_diff_trend_mv = 0;   // 短期平均 - 長期平均 (10 分鐘)，正值代表不平衡在擴大
+    uint16_t thermal_spread_centi = 0; // temp1..3 有效感測器之間的最大溫差 (0.01°C)
+    uint16_t anomaly_flags = 0;       // AnomalyFlag 位元組合
+
+    FieldConfidence confidence; // 各欄位讀取可信度
+};
+static_assert(std::is_trivially_copyable<BatteryData>::value, "BatteryData must stay POD");
+
+// 高速取樣的單筆結果：只有 0xD7 動態幀的欄位，時間戳取自匯流排傳輸當下。
+// 不經多數決、不讀診斷暫存器，供電壓驟降/回升曲線使用。
+struct DynamicSample
+{
+    uint32_t t_us;   // 送出 0xD7 指令時的 micros()
+    uint16_t bus_us; // 指令+回應的匯流排耗時
+    uint16_t pack_mv;
+    uint16_t cell_mv[5];
+    uint16_t cell_diff_mv;
+    int16_t temp1_centi;
+    int16_t temp2_centi;
+    bool load_test;  // 取樣於負載測試期間 (繼電器可能吸合，壓差含負載下的尖峰)
+};
+static_assert(std::is_trivially_copyable<DynamicSample>::value, "DynamicSample is passed through a FreeRTOS queue");
+
+// 將取樣結果寫入 BatteryData 的對應欄位 (其他欄位保持不變)
+void applyDynamicSample(const DynamicSample &sample, BatteryData &data);
+// 清除只由動態讀取/診斷暫存器填入的欄位 (含分析結果)。靜態讀取不會覆寫這些欄位，
+// 換電池時若不先清除，前一顆電池的電芯電壓與錯誤計數會混入新電池的資料
+void clearDynamicFields(BatteryData &data);
+
+// 輸出端使用的顯示字串 (堆疊上的固定緩衝區)
+struct BatteryLabels
+{
+    char rom_id[17];       // 16 個十六進位字元
+    char serial[10];       // "ID-" + ROM ID 後 6 碼
+    char prod_date[11];    // DD/MM/20YY
+    char capacity[8];      // "5.0Ah"
+    char battery_type[6];  // "18V"
+    char status_hex[7];    // "0x60"
+};
+
+bool hasRomId(const BatteryData &data);
+void formatRomId(const uint8_t *rom_id, char *out); // out 至少 17 位元組
+// rom_id 的十六進位表示 (大寫) 是否以 hex_suffix 結尾；逐個半位元組比對，不需格式化 (可在臨界區內呼叫)
+bool romIdEndsWith(const uint8_t *rom_id, const char *hex_suffix, size_t len);
+void formatBatteryLabels(const BatteryData &data, BatteryLabels &out);
+
+// 匯流排時序設定檔：預設值即為相容所有電池的安全時序
+struct BusTimingProfile
+{
+    uint16_t wake_ms = 400;         // 喚醒後等待 BMS 就緒
+    uint16_t post_reset_us = 400;   // reset 後、送出 0xCC/0x33 前的等待
+    uint16_t inter_byte_us = 90;    // 位元組之間的間隔
+    uint16_t tree2_settle_ms = 150; // 進入第二指令樹 (0x99) 後的穩定時間
 };
 
 struct SupportedFeatures
@@ -62,54 +165,114 @@ struct SupportedFeatures
     bool read_dynamic = false;
     bool led_test = false;
     bool clear_errors = false;
+    bool load_test = false; // 已設定負載繼電器
 };
 
 class MakitaBMS
 {
 public:
-    MakitaBMS(uint8_t onewire_pin, uint8_t enable_pin);
+    // bus：匯流排後端 (GPIO 或 RMT)，生命週期需長於 MakitaBMS
+    // relay_pin：負載測試繼電器 (HIGH = 接上負載)，-1 表示未安裝
+    MakitaBMS(MakitaBus &bus, uint8_t enable_pin, int8_t relay_pin = -1);
     // 初始化硬體引腳
     void begin()
     {
+        makita.begin();
         pinMode(_enable_pin, OUTPUT);
         digitalWrite(_enable_pin, HIGH); // NPN: HIGH = OFF
+        _session_depth = 0;
+        _awake = false;
+        setRelay(false);
     }
+
+    // 電源會話 (RAII)：作用域內保持電池喚醒，離開作用域時斷電。
+    // 巢狀會話共用同一次喚醒，因此一連串指令只需一次 400ms 喚醒延遲。
+    class PowerSession
+    {
+    public:
+        explicit PowerSession(MakitaBMS &bms) : _bms(bms) { _bms.beginSession(); }
+        ~PowerSession() { _bms.endSession(); }
+        PowerSession(const PowerSession &) = delete;
+        PowerSession &operator=(const PowerSession &) = delete;
+
+    private:
+        MakitaBMS &_bms;
+    };
+    void beginSession();
+    void endSession();
+    bool isAwake() const { return _awake; }
+
     void setLogCallback(LogCallback callback);
     void setLogLevel(LogLevel level);
     bool isPresent();
     String readStaticData(BatteryData &data, SupportedFeatures &features);
     String readDynamicData(BatteryData &data);
+    // 高速路徑：單次 0xD7 讀取 (無多數決、無日誌字串)，無存在脈衝或需先識別時回傳 false。
+    // 呼叫端應先以 beginSession() 保持喚醒，否則每筆都要付出喚醒延遲。
+    bool sampleDynamic(DynamicSample &out);
     String ledTest(bool on);
     String clearErrors();
     String resetMessage();
-    void setRelay(bool on);
-    void setVerifyReads(bool on);
+    void setRelay(bool on); // 未安裝繼電器時不動作
+    bool hasRelay() const { return _relay_pin >= 0; }
+    bool relayOn() const { return _relay_on; }
+    void setVerifyReads(bool on, uint8_t votes = 3); // 多數決票數 (3-5)
+    const ReadStats &readStats() const { return _readStats; }
+    void setInterByteGap(uint16_t us); // 位元組間隔 (預設 90µs)
+    void setTimingProfile(const BusTimingProfile &profile);
+    const BusTimingProfile &timingProfile() const { return _timing; }
+    // 逐步縮短各項延遲直到驗證讀取不一致，回傳最短的可靠時序 (需先識別電池)
+    String calibrateTiming(BusTimingProfile &result);
     void readAdvancedDiagnostics(BatteryData &data);
+    ControllerType controllerType() const { return _controller; }
 
 private:
-    OneWireMakita makita;
+    MakitaBus &makita;
     uint8_t _enable_pin;
-    String _controller_type = "UNKNOWN";
+    int8_t _relay_pin;
+    bool _relay_on = false;
+    ControllerType _controller = CONTROLLER_UNKNOWN;
     bool _is_identified = false;
     LogCallback _log;
     LogLevel _logLevel = LOG_LEVEL_DEBUG;
   bool _verifyReads = false;
+    uint8_t _verifyVotes = 3;
+    ReadStats _readStats;
+    BusTimingProfile _timing;
+
+    // --- 電源會話狀態 ---
+    uint8_t _session_depth = 0;      // 巢狀會話深度，歸零時才真正斷電
+    bool _awake = false;             // 電池目前是否已喚醒
+    unsigned long _wake_started = 0; // 本次喚醒的起始時間 (ms)
 
     // --- 工具函數 ---
     void cmd_and_read_33(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
     void cmd_and_read_cc(const byte *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
-    byte nibble_swap(byte b);
-    String getModel();
-    String getF0513Model();
-    uint8_t readOneWireByte(byte cmd);               // 傳回值必須是 uint8_t，參數必須是 byte
-    String readDynamicDataStandard(BatteryData &data);
-    String readDynamicDataF0513(BatteryData &data);
-    void readAdvancedDiagnosticsStandard(BatteryData &data);
-    void readAdvancedDiagnosticsF0513(BatteryData &data);
-    String ledTestStandard(bool on);
-    String ledTestF0513(bool on);
-    String clearErrorsStandard();
-    String clearErrorsF0513();
+    bool getModel(char *out, size_t len);
+    bool getF0513Model(char *out, size_t len);
+    void enterTree2(uint16_t settle_ms);             // 0x99 進入第二指令樹並等待穩定
+    void exitTree2();                                // F0 00 回到主指令樹
+    void readTree2Registers(const uint8_t *regs, uint8_t count, uint8_t *out);
+    void decodeDiagnostics(const uint8_t *snap, const uint8_t *agree, uint8_t votes, BatteryData &data, const char *tag);
+    bool readStaticFrame(byte *full_resp);           // 讀取 0x33 + AA 00 完整 40 位元組
+    // 多數決讀取：重複呼叫 read 並投票，fields 涵蓋的位元組整段投票、其餘逐位元組投票。
+    // agree[i] 為第 i 個位元組所屬單位的得票數；重試後仍無多數的單位填 0xFF 且 agree 為 0 (未驗證)。回傳投票總數
+    template <typename Reader>
+    uint8_t readVoted(Reader read, byte *out, uint8_t len, uint8_t *agree,
+                      const FieldDesc *fields = nullptr, uint8_t field_count = 0);
+    bool readCalibrationFrames(byte *static_frame, byte *model_frame, uint8_t *tree2_regs);
+
+    // --- 控制器協議路徑 (C 為 ControllerTraits.h 中的 traits) ---
+    template <typename Fn>
+    auto withController(Fn fn) -> decltype(fn(StandardController()));
+    template <typename C>
+    String readDynamicDataT(BatteryData &data);
+    template <typename C>
+    bool sampleDynamicT(DynamicSample &out);
+    template <typename C>
+    void readAdvancedDiagnosticsT(BatteryData &data);
+    template <typename C>
+    String sendActionT(uint8_t arg);
 
 
 
@@ -0,0 +1,246 @@
+#include "Rollup.h"
+#include "MakitaBMS.h"
+
+using namespace SeriesCodec;
+
+const RollupTierSpec ROLLUP_TIER_SPECS[ROLLUP_TIERS] = {
+    {"1s", 1000UL, 180},
+    {"1m", 60000UL, 180},
+    {"15m", 900000UL, 96},
+};
+
+static const char *const CHANNEL_KEYS[CHANNELS] = {
+    "pack_mv",
+    "cell1_mv", "cell2_mv", "cell3_mv", "cell4_mv", "cell5_mv",
+    "temp1_centi", "temp2_centi", "temp3_centi",
+};
+
+RollupStore::RollupStore()
+{
+    // 各層共用一塊緩衝區，依序切分
+    size_t offset = 0;
+    for (uint8_t n = 0; n < ROLLUP_TIERS; n++)
+    {
+        _tiers[n].ring = _buckets + offset;
+        offset += ROLLUP_TIER_SPECS[n].buckets;
+    }
+}
+
+void RollupStore::clearTiers()
+{
+    for (Tier &t : _tiers)
+    {
+        t.head = 0;
+        t.used = 0;
+        t.open.count = 0;
+    }
+}
+
+void RollupStore::reset()
+{
+    portENTER_CRITICAL(&_mux);
+    clearTiers();
+    portEXIT_CRITICAL(&_mux);
+}
+
+void RollupStore::closeBucket(const OpenBucket &open, RollupBucket &out)
+{
+    out.start_ms = open.start_ms;
+    out.count = open.count;
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        out.min[c] = open.min[c];
+        out.max[c] = open.max[c];
+        out.avg[c] = (int16_t)(open.sum[c] / (int32_t)open.count);
+    }
+}
+
+void RollupStore::add(const uint8_t *rom_id, const Sample &s)
+{
+    portENTER_CRITICAL(&_mux);
+    if (memcmp(rom_id, _rom, sizeof(_rom)) != 0)
+    {
+        clearTiers();
+        memcpy(_rom, rom_id, sizeof(_rom));
+    }
+    for (uint8_t n = 0; n < ROLLUP_TIERS; n++)
+    {
+        Tier &t = _tiers[n];
+        const RollupTierSpec &spec = ROLLUP_TIER_SPECS[n];
+        uint32_t start = s.t_ms - s.t_ms % spec.width_ms;
+        OpenBucket &open = t.open;
+
+        // 跨入新的桶：收尾存入環形緩衝區 (時間倒退的樣本併入目前的桶)
+        if (open.count > 0 && (int32_t)(start - open.start_ms) > 0)
+        {
+            closeBucket(open, t.ring[t.head]);
+            t.head = (t.head + 1) % spec.buckets;
+            if (t.used < spec.buckets)
+                t.used++;
+            open.count = 0;
+        }
+
+        if (open.count == 0)
+        {
+            open.start_ms = start;
+            for (uint8_t c = 0; c < CHANNELS; c++)
+            {
+                open.min[c] = open.max[c] = (int16_t)s.v[c];
+                open.sum[c] = 0;
+            }
+        }
+        for (uint8_t c = 0; c < CHANNELS; c++)
+        {
+            int16_t v = (int16_t)s.v[c];
+            if (v < open.min[c])
+                open.min[c] = v;
+            if (v > open.max[c])
+                open.max[c] = v;
+            open.sum[c] += v;
+        }
+        if (open.count < 0xFFFF)
+            open.count++;
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+uint16_t RollupStore::size(uint8_t tier) const
+{
+    if (tier >= ROLLUP_TIERS)
+        return 0;
+    portENTER_CRITICAL(&_mux);
+    uint16_t n = _tiers[tier].used + (_tiers[tier].open.count > 0 ? 1 : 0);
+    portEXIT_CRITICAL(&_mux);
+    return n;
+}
+
+bool RollupStore::bucket(uint8_t tier, uint16_t i, RollupBucket &out) const
+{
+    if (tier >= ROLLUP_TIERS)
+        return false;
+    const Tier &t = _tiers[tier];
+    const uint16_t cap = ROLLUP_TIER_SPECS[tier].buckets;
+    bool ok = true;
+
+    portENTER_CRITICAL(&_mux);
+    if (i < t.used)
+        out = t.ring[(t.head + cap - t.used + i) % cap];
+    else if (i == t.used && t.open.count > 0)
+        closeBucket(t.open, out);
+    else
+        ok = false;
+    portEXIT_CRITICAL(&_mux);
+    return ok;
+}
+
+void RollupStore::source(uint8_t *rom_id) const
+{
+    portENTER_CRITICAL(&_mux);
+    memcpy(rom_id, _rom, sizeof(_rom));
+    portEXIT_CRITICAL(&_mux);
+}
+
+uint8_t RollupStore::tierForSpan(uint32_t span_ms)
+{
+    for (uint8_t n = 0; n < ROLLUP_TIERS; n++)
+        if ((uint64_t)ROLLUP_TIER_SPECS[n].width_ms * ROLLUP_TIER_SPECS[n].buckets >= span_ms)
+            return n;
+    return ROLLUP_TIERS - 1;
+}
+
+uint8_t RollupStore::tierByName(const char *name)
+{
+    for (uint8_t n = 0; n < ROLLUP_TIERS; n++)
+        if (strcmp(ROLLUP_TIER_SPECS[n].name, name) == 0)
+            return n;
+    return ROLLUP_TIERS;
+}
+
+// --- 分塊 JSON ---
+
+RollupJsonStream::RollupJsonStream(const RollupStore &store, uint8_t tier, uint32_t from_ms, uint32_t to_ms)
+    : _store(store), _tier(tier), _from(from_ms), _to(to_ms)
+{
+}
+
+// 依序產生開頭、每個桶、結尾；沒有更多內容時回傳 false
+bool RollupJsonStream::nextLine()
+{
+    const RollupTierSpec &spec = ROLLUP_TIER_SPECS[_tier];
+    int n = 0;
+    _lineLen = 0;
+    _lineOff = 0;
+
+    if (_stage == 0)
+    {
+        uint8_t rom_id[8];
+        char rom[17];
+        _store.source(rom_id);
+        formatRomId(rom_id, rom);
+        n = snprintf(_line, sizeof(_line), "{\"tier\":\"%s\",\"width_ms\":%u,\"now_ms\":%lu,\"rom\":\"%s\",\"channels\":[",
+                     spec.name, spec.width_ms, millis(), rom);
+        for (uint8_t c = 0; c < CHANNELS && n > 0 && (size_t)n < sizeof(_line); c++)
+            n += snprintf(_line + n, sizeof(_line) - n, "%s\"%s\"", c ? "," : "", CHANNEL_KEYS[c]);
+        if (n > 0 && (size_t)n < sizeof(_line))
+            n += snprintf(_line + n, sizeof(_line) - n, "],\"buckets\":[");
+        _stage = 1;
+    }
+    else if (_stage == 1)
+    {
+        RollupBucket b;
+        while (true)
+        {
+            if (!_store.bucket(_tier, _pos++, b))
+            {
+                _stage = 2;
+                return nextLine();
+            }
+            // 讀取期間有桶收尾時索引會前移一格：略過已輸出過的桶
+            if (!_first && (int32_t)(b.start_ms - _lastStart) <= 0)
+                continue;
+            if (b.start_ms + spec.width_ms > _from && b.start_ms <= _to)
+                break;
+        }
+        n = snprintf(_line, sizeof(_line), "%s[%u,%u", _first ? "" : ",", b.start_ms, b.count);
+        _first = false;
+        _lastStart = b.start_ms;
+        const int16_t *parts[3] = {b.min, b.max, b.avg};
+        for (int p = 0; p < 3 && n > 0 && (size_t)n < sizeof(_line); p++)
+        {
+            n += snprintf(_line + n, sizeof(_line) - n, ",[");
+            for (uint8_t c = 0; c < CHANNELS && (size_t)n < sizeof(_line); c++)
+                n += snprintf(_line + n, sizeof(_line) - n, "%s%d", c ? "," : "", parts[p][c]);
+            if ((size_t)n < sizeof(_line))
+                n += snprintf(_line + n, sizeof(_line) - n, "]");
+        }
+        if (n > 0 && (size_t)n < sizeof(_line))
+            n += snprintf(_line + n, sizeof(_line) - n, "]");
+    }
+    else if (_stage == 2)
+    {
+        n = snprintf(_line, sizeof(_line), "]}");
+        _stage = 3;
+    }
+    else
+    {
+        return false;
+    }
+
+    _lineLen = n < 0 ? 0 : min((size_t)n, sizeof(_line) - 1);
+    return true;
+}
+
+size_t RollupJsonStream::read(uint8_t *buf, size_t max_len)
+{
+    size_t n = 0;
+    while (n < max_len)
+    {
+        if (_lineOff >= _lineLen && !nextLine())
+            break;
+        size_t chunk = min(_lineLen - _lineOff, max_len - n);
+        memcpy(buf + n, _line + _lineOff, chunk);
+        _lineOff += chunk;
+        n += chunk;
+    }
+    return n;
+}
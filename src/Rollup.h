@@ -0,0 +1,107 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <Arduino.h>
+#include "SeriesCodec.h"
+
+// 多解析度統計 (min/max/avg)：長時間監看時不必傳送每一筆樣本，前端依時間跨度選擇合適的層級繪圖。
+//
+// 每一層是固定寬度的時間桶組成的環形緩衝區 (只保存有樣本的桶)。每筆樣本直接更新各層目前的桶
+// (O(1)，不需回頭重算)，跨入下一個時間桶時才把目前的桶收尾存入環形緩衝區，覆寫最舊的桶。
+// 通道與 SeriesCodec 相同 (總電壓、5 顆電芯、3 個溫度)；更換電池時全部重新開始。
+// 只保存在 RAM 中 (約 27KB)，重新開機後清空；原始樣本仍保存在 SeriesLog。
+//
+// 寫入端 (loop) 與讀取端 (HTTP 回呼) 在不同任務：桶的更新與複製都在 portMUX 臨界區內進行。
+
+static const uint8_t ROLLUP_TIERS = 3;
+
+struct RollupTierSpec
+{
+    const char *name;
+    uint32_t width_ms;
+    uint16_t buckets;
+};
+// 1 秒 × 180 (3 分鐘)、1 分鐘 × 180 (3 小時)、15 分鐘 × 96 (24 小時)
+extern const RollupTierSpec ROLLUP_TIER_SPECS[ROLLUP_TIERS];
+static const uint16_t ROLLUP_TOTAL_BUCKETS = 180 + 180 + 96; // 需與 ROLLUP_TIER_SPECS 一致
+
+struct RollupBucket
+{
+    uint32_t start_ms; // 桶的起點 (millis() 時基，對齊寬度)
+    uint16_t count;
+    int16_t min[SeriesCodec::CHANNELS];
+    int16_t max[SeriesCodec::CHANNELS];
+    int16_t avg[SeriesCodec::CHANNELS];
+};
+
+class RollupStore
+{
+public:
+    RollupStore();
+
+    // 加入一筆樣本；rom_id 與目前來源不同時先清空 (不同電池的數值不混在同一個桶)
+    void add(const uint8_t *rom_id, const SeriesCodec::Sample &s);
+    void reset();
+
+    // 讀取端 (任何任務)：tier 層由舊到新的第 i 個桶，最後一個為尚未收尾的桶
+    uint16_t size(uint8_t tier) const;
+    bool bucket(uint8_t tier, uint16_t i, RollupBucket &out) const;
+    void source(uint8_t *rom_id) const;
+
+    // 能涵蓋 span_ms 時間跨度的最細層級 (都不夠時回傳最粗的一層)
+    static uint8_t tierForSpan(uint32_t span_ms);
+    // 以名稱 ("1s"/"1m"/"15m") 查層級，找不到回傳 ROLLUP_TIERS
+    static uint8_t tierByName(const char *name);
+
+private:
+    struct OpenBucket
+    {
+        uint32_t start_ms;
+        uint16_t count;
+        int16_t min[SeriesCodec::CHANNELS];
+        int16_t max[SeriesCodec::CHANNELS];
+        int32_t sum[SeriesCodec::CHANNELS];
+    };
+    struct Tier
+    {
+        RollupBucket *ring;
+        uint16_t head = 0; // 下一個寫入位置
+        uint16_t used = 0;
+        OpenBucket open = {};
+    };
+
+    RollupBucket _buckets[ROLLUP_TOTAL_BUCKETS];
+    Tier _tiers[ROLLUP_TIERS];
+    uint8_t _rom[8] = {};
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void clearTiers();
+    static void closeBucket(const OpenBucket &open, RollupBucket &out);
+};
+
+// 以 JSON 逐段輸出某一層在 [from_ms, to_ms] 之間的桶 (供分塊 HTTP 回應使用)：
+// {"tier":"1m","width_ms":60000,"now_ms":...,"rom":"...","channels":[...],
+//  "buckets":[[start_ms,count,[min...],[max...],[avg...]],...]}
+class RollupJsonStream
+{
+public:
+    RollupJsonStream(const RollupStore &store, uint8_t tier, uint32_t from_ms, uint32_t to_ms);
+    size_t read(uint8_t *buf, size_t max_len);
+
+private:
+    const RollupStore &_store;
+    uint8_t _tier;
+    uint32_t _from;
+    uint32_t _to;
+    uint16_t _pos = 0;
+    uint8_t _stage = 0; // 0 = 開頭, 1 = 桶, 2 = 結尾, 3 = 結束
+    bool _first = true;
+    uint32_t _lastStart = 0;
+    char _line[320];
+    size_t _lineLen = 0;
+    size_t _lineOff = 0;
+
+    bool nextLine();
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "SeriesCodec.h"
+
+namespace SeriesCodec
+{
+    size_t putVarint(uint8_t *out, uint32_t v)
+    {
+        size_t n = 0;
+        while (v >= 0x80)
+        {
+            out[n++] = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        out[n++] = (uint8_t)v;
+        return n;
+    }
+
+    size_t getVarint(const uint8_t *in, size_t len, uint32_t &v)
+    {
+        v = 0;
+        for (size_t n = 0; n < len && n < MAX_VARINT_LEN; n++)
+        {
+            v |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+            if (!(in[n] & 0x80))
+                return n + 1;
+        }
+        return 0;
+    }
+
+    static void putLe32(uint8_t *out, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            out[i] = (uint8_t)(v >> (i * 8));
+    }
+
+    // --- 編碼 ---
+
+    void Encoder::reset(uint8_t *buf, size_t capacity)
+    {
+        _buf = buf;
+        _cap = capacity;
+        _len = 0;
+        _samples = 0;
+        _sinceKey = 0;
+        _needKey = true;
+        _prevDt = 0;
+    }
+
+    bool Encoder::header(const BatteryHeader &h)
+    {
+        uint8_t tmp[HEADER_LEN];
+        size_t n = putVarint(tmp, TAG_HEADER);
+        memcpy(tmp + n, h.rom_id, 8);
+        n += 8;
+        memcpy(tmp + n, h.model, 16);
+        n += 16;
+        tmp[n++] = h.capacity_deci_ah;
+        tmp[n++] = h.prod_year;
+        tmp[n++] = h.prod_month;
+        tmp[n++] = h.prod_day;
+        n += putVarint(tmp + n, h.charge_cycles);
+        putLe32(tmp + n, h.wall_time);
+        putLe32(tmp + n + 4, h.wall_ms);
+        n += 8;
+
+        if (_len + n > _cap)
+            return false;
+        memcpy(_buf + _len, tmp, n);
+        _len += n;
+        _needKey = true;
+        return true;
+    }
+
+    bool Encoder::sample(const Sample &s)
+    {
+        uint8_t tmp[MAX_SAMPLE_LEN];
+        size_t n = 0;
+        bool key = _needKey || _sinceKey >= KEYFRAME_EVERY;
+        int32_t dt = (int32_t)(s.t_ms - _prev.t_ms);
+
+        if (key)
+        {
+            n += putVarint(tmp, TAG_KEYFRAME);
+            n += putVarint(tmp + n, s.t_ms);
+            for (uint8_t c = 0; c < CHANNELS; c++)
+                n += putVarint(tmp + n, zigzag(s.v[c]));
+        }
+        else
+        {
+            uint32_t mask = 0;
+            for (uint8_t c = 0; c < CHANNELS; c++)
+                if (s.v[c] != _prev.v[c])
+                    mask |= 1UL << c;
+            n += putVarint(tmp, (mask << 2) | TAG_DELTA);
+            n += putVarint(tmp + n, zigzag(dt - _prevDt));
+            for (uint8_t c = 0; c < CHANNELS; c++)
+                if (mask & (1UL << c))
+                    n += putVarint(tmp + n, zigzag(s.v[c] - _prev.v[c]));
+        }
+
+        if (_len + n > _cap)
+            return false;
+        memcpy(_buf + _len, tmp, n);
+        _len += n;
+        _samples++;
+        _sinceKey = key ? 1 : _sinceKey + 1;
+        _needKey = false;
+        _prevDt = key ? 0 : dt;
+        _prev = s;
+        return true;
+    }
+
+    // --- 解碼 ---
+
+    bool Decoder::readVarint(uint32_t &v)
+    {
+        size_t n = getVarint(_buf + _pos, _len - _pos, v);
+        _pos += n;
+        return n > 0;
+    }
+
+    bool Decoder::readBytes(void *out, size_t n)
+    {
+        if (_len - _pos < n)
+            return false;
+        memcpy(out, _buf + _pos, n);
+        _pos += n;
+        return true;
+    }
+
+    Decoder::Event Decoder::next(BatteryHeader &header, Sample &sample)
+    {
+        if (_pos >= _len)
+            return END;
+
+        uint32_t tag;
+        if (!readVarint(tag))
+            return CORRUPT;
+
+        switch (tag & 0x03)
+        {
+        case TAG_HEADER:
+        {
+            uint8_t le[8];
+            uint32_t cycles;
+            if (tag != TAG_HEADER || !readBytes(header.rom_id, 8) || !readBytes(header.model, 16) ||
+                !readBytes(&header.capacity_deci_ah, 1) || !readBytes(&header.prod_year, 1) ||
+                !readBytes(&header.prod_month, 1) || !readBytes(&header.prod_day, 1) ||
+                !readVarint(cycles) || !readBytes(le, 8))
+                return CORRUPT;
+            header.model[15] = '\0';
+            header.charge_cycles = cycles;
+            header.wall_time = le[0] | (uint32_t)le[1] << 8 | (uint32_t)le[2] << 16 | (uint32_t)le[3] << 24;
+            header.wall_ms = le[4] | (uint32_t)le[5] << 8 | (uint32_t)le[6] << 16 | (uint32_t)le[7] << 24;
+            _haveKey = false;
+            return HEADER;
+        }
+        case TAG_KEYFRAME:
+        {
+            uint32_t v;
+            if (tag != TAG_KEYFRAME || !readVarint(v))
+                return CORRUPT;
+            _prev.t_ms = v;
+            for (uint8_t c = 0; c < CHANNELS; c++)
+            {
+                if (!readVarint(v))
+                    return CORRUPT;
+                _prev.v[c] = unzigzag(v);
+            }
+            _haveKey = true;
+            _prevDt = 0;
+            sample = _prev;
+            return SAMPLE;
+        }
+        case TAG_DELTA:
+        {
+            uint32_t mask = tag >> 2, v;
+            if (!_haveKey || mask >= (1UL << CHANNELS) || !readVarint(v))
+                return CORRUPT;
+            _prevDt += unzigzag(v);
+            _prev.t_ms += (uint32_t)_prevDt;
+            for (uint8_t c = 0; c < CHANNELS; c++)
+            {
+                if (!(mask & (1UL << c)))
+                    continue;
+                if (!readVarint(v))
+                    return CORRUPT;
+                _prev.v[c] += unzigzag(v);
+            }
+            sample = _prev;
+            return SAMPLE;
+        }
+        default:
+            return CORRUPT;
+        }
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef SERIES_CODEC_H
+#define SERIES_CODEC_H
+
+// 動態數據時間序列的壓縮編碼 (差分 + varint)。
+// 只依賴 <stdint.h>/<string.h>，不配置記憶體、不使用 Arduino API，可直接在主機端編譯測試。
+//
+// 編碼寫入呼叫端提供的區塊緩衝區，每個區塊可獨立解碼：以電池標頭開始，第一筆樣本為關鍵幀。
+// 每筆紀錄以一個 varint 標籤開頭，低 2 位元為類型：
+//   TAG_HEADER   電池標頭：rom_id[8]、model[16]、容量、生產日期、循環次數 (varint)、
+//                時鐘錨點 wall_time/wall_ms (各 4 位元組，little-endian)
+//   TAG_KEYFRAME 關鍵幀：t_ms (varint)，接著 CHANNELS 個 zigzag varint 絕對值
+//   TAG_DELTA    差分幀：標籤其餘位元為變動通道的遮罩；接著取樣間隔的二階差分 (zigzag varint)，
+//                再依通道順序排列變動通道的差值 (zigzag varint)
+// 每 KEYFRAME_EVERY 筆插入一次關鍵幀，限制單一損毀位元組影響的範圍。
+//
+// 靜置中的電池每筆差分幀約 2-8 位元組 (固定長度紀錄為 72 位元組)。
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace SeriesCodec
+{
+    constexpr uint8_t TAG_DELTA = 0;
+    constexpr uint8_t TAG_KEYFRAME = 1;
+    constexpr uint8_t TAG_HEADER = 2;
+
+    enum Channel : uint8_t
+    {
+        CH_PACK_MV = 0,
+        CH_CELL1_MV,
+        CH_CELL2_MV,
+        CH_CELL3_MV,
+        CH_CELL4_MV,
+        CH_CELL5_MV,
+        CH_TEMP1_CENTI,
+        CH_TEMP2_CENTI,
+        CH_TEMP3_CENTI,
+        CHANNELS
+    };
+
+    constexpr uint16_t KEYFRAME_EVERY = 64;
+    constexpr size_t MAX_VARINT_LEN = 5;
+    constexpr size_t MAX_SAMPLE_LEN = MAX_VARINT_LEN * (CHANNELS + 2); // 標籤 + 時間 + 各通道
+    constexpr size_t HEADER_LEN = 1 + 8 + 16 + 4 + MAX_VARINT_LEN + 8;
+
+    struct BatteryHeader
+    {
+        uint8_t rom_id[8];
+        char model[16];
+        uint8_t capacity_deci_ah;
+        uint8_t prod_year;
+        uint8_t prod_month;
+        uint8_t prod_day;
+        uint32_t charge_cycles;
+        uint32_t wall_time; // 錨點：t_ms == wall_ms 時的時間 (2000-01-01 起的秒數)，0 表示未知
+        uint32_t wall_ms;
+    };
+
+    struct Sample
+    {
+        uint32_t t_ms;
+        int32_t v[CHANNELS];
+    };
+
+    inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+    inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+    // 回傳寫入的位元組數 (1..MAX_VARINT_LEN)
+    size_t putVarint(uint8_t *out, uint32_t v);
+    // 回傳讀取的位元組數；資料不足或超過 MAX_VARINT_LEN 時回傳 0
+    size_t getVarint(const uint8_t *in, size_t len, uint32_t &v);
+
+    class Encoder
+    {
+    public:
+        // 開始新的區塊 (之前的差分狀態全部重置)
+        void reset(uint8_t *buf, size_t capacity);
+        // 寫入電池標頭；之後的第一筆樣本一定是關鍵幀。空間不足時回傳 false
+        bool header(const BatteryHeader &h);
+        // 空間不足時回傳 false 且不寫入任何位元組 (呼叫端應換新區塊後重送標頭與此樣本)
+        bool sample(const Sample &s);
+
+        size_t size() const { return _len; }
+        uint16_t samples() const { return _samples; }
+
+    private:
+        uint8_t *_buf = nullptr;
+        size_t _cap = 0;
+        size_t _len = 0;
+        uint16_t _samples = 0;
+        uint16_t _sinceKey = 0;
+        bool _needKey = true;
+        int32_t _prevDt = 0;
+        Sample _prev = {};
+    };
+
+    class Decoder
+    {
+    public:
+        enum Event : uint8_t
+        {
+            END = 0,
+            HEADER,
+            SAMPLE,
+            CORRUPT, // 格式錯誤或在關鍵幀之前出現差分幀；之後的內容不可信
+        };
+
+        Decoder(const uint8_t *buf, size_t len) : _buf(buf), _len(len) {}
+
+        // 依序取出下一筆紀錄：HEADER 時填入 header，SAMPLE 時填入 sample
+        Event next(BatteryHeader &header, Sample &sample);
+
+    private:
+        const uint8_t *_buf;
+        size_t _len;
+        size_t _pos = 0;
+        bool _haveKey = false;
+        int32_t _prevDt = 0;
+        Sample _prev = {};
+
+        bool readVarint(uint32_t &v);
+        bool readBytes(void *out, size_t n);
+    };
+}
+
+#endif
@@ -0,0 +1,335 @@
+#include "SeriesLog.h"
+#include "DataLog.h"
+
+using namespace SeriesCodec;
+
+static const uint32_t SERIES_MAGIC = 0x534C4B4D; // "MKLS"
+static const uint16_t SERIES_VERSION = 1;
+
+static const char SERIES_CSV_HEADER[] =
+    "Timestamp,ROM ID,Model,Time (ms),Pack Voltage (mV),Cell 1 (mV),Cell 2 (mV),Cell 3 (mV),Cell 4 (mV),Cell 5 (mV),"
+    "Temp 1 (0.01C),Temp 2 (0.01C),Temp 3 (0.01C)";
+
+static uint16_t blockCrc(const SeriesBlockHeader &hdr, const uint8_t *payload)
+{
+    return crc16Ccitt(payload, hdr.used, crc16Ccitt(&hdr, offsetof(SeriesBlockHeader, crc)));
+}
+
+static void makeBatteryHeader(const BatteryData &data, uint32_t wall_time, uint32_t wall_ms, BatteryHeader &out)
+{
+    memset(&out, 0, sizeof(out));
+    memcpy(out.rom_id, data.rom_id, sizeof(out.rom_id));
+    strlcpy(out.model, data.model, sizeof(out.model));
+    out.capacity_deci_ah = data.capacity_deci_ah;
+    out.prod_year = data.prod_year;
+    out.prod_month = data.prod_month;
+    out.prod_day = data.prod_day;
+    out.charge_cycles = data.charge_cycles > 0 ? data.charge_cycles : 0;
+    out.wall_time = wall_time;
+    out.wall_ms = wall_ms;
+}
+
+void makeSeriesSample(const BatteryData &data, uint32_t t_ms, Sample &out)
+{
+    out.t_ms = t_ms;
+    out.v[CH_PACK_MV] = data.pack_mv;
+    for (int i = 0; i < 5; i++)
+        out.v[CH_CELL1_MV + i] = data.cell_mv[i];
+    out.v[CH_TEMP1_CENTI] = data.temp1_centi;
+    out.v[CH_TEMP2_CENTI] = data.temp2_centi;
+    out.v[CH_TEMP3_CENTI] = data.temp3_centi;
+}
+
+// --- 環形區塊檔 ---
+
+bool SeriesLog::begin(fs::FS &fs, uint16_t blocks)
+{
+    _fs = &fs;
+    _blocks = blocks;
+
+    SeriesFileHeader header = {};
+    bool valid = false;
+    if (_fs->exists(_path))
+    {
+        File f = _fs->open(_path, "r");
+        valid = f && f.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                header.magic == SERIES_MAGIC && header.version == SERIES_VERSION &&
+                header.block_size == SERIES_BLOCK_SIZE && header.blocks == blocks &&
+                f.size() == slotOffset(blocks);
+        if (f)
+            f.close();
+    }
+    if (!valid && !create())
+        return false;
+
+    _file = _fs->open(_path, "r+");
+    if (!_file)
+        return false;
+
+    // 以序號還原：最大序號的下一個槽位開始新的區塊 (不接續寫到一半的區塊)
+    _usedBlocks = 0;
+    _storedSamples = 0;
+    _storedBytes = 0;
+    uint32_t maxSeq = 0;
+    uint16_t maxSlot = _blocks - 1;
+    SeriesBlockHeader hdr;
+    for (uint16_t slot = 0; slot < _blocks; slot++)
+    {
+        if (!readBlock(_file, slot, hdr, _payload))
+            continue;
+        _usedBlocks++;
+        _storedSamples += hdr.samples;
+        _storedBytes += hdr.used;
+        if (hdr.seq > maxSeq)
+        {
+            maxSeq = hdr.seq;
+            maxSlot = slot;
+        }
+    }
+    openBlock((maxSlot + 1) % _blocks, maxSeq + 1);
+    return true;
+}
+
+// 建立空白紀錄檔 (全部區塊預先配置，之後只覆寫不增長)
+bool SeriesLog::create()
+{
+    File f = _fs->open(_path, "w");
+    if (!f)
+        return false;
+
+    SeriesFileHeader header = {};
+    header.magic = SERIES_MAGIC;
+    header.version = SERIES_VERSION;
+    header.block_size = SERIES_BLOCK_SIZE;
+    header.blocks = _blocks;
+    f.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+
+    SeriesBlockHeader empty = {};
+    memset(_payload, 0, sizeof(_payload));
+    for (uint16_t slot = 0; slot < _blocks; slot++)
+    {
+        f.write(reinterpret_cast<const uint8_t *>(&empty), sizeof(empty));
+        f.write(_payload, sizeof(_payload));
+    }
+    bool ok = f.size() == slotOffset(_blocks);
+    f.close();
+    return ok;
+}
+
+bool SeriesLog::readBlock(File &f, uint16_t slot, SeriesBlockHeader &hdr, uint8_t *payload) const
+{
+    if (!f || !f.seek(slotOffset(slot)) ||
+        f.read(reinterpret_cast<uint8_t *>(&hdr), sizeof(hdr)) != sizeof(hdr))
+        return false;
+    if (hdr.seq == 0 || hdr.used > SERIES_PAYLOAD_SIZE || f.read(payload, hdr.used) != hdr.used)
+        return false;
+    return hdr.crc == blockCrc(hdr, payload);
+}
+
+// 在 slot 開始新的區塊：槽位上原有的區塊即將被覆寫，先從統計中扣除
+void SeriesLog::openBlock(uint16_t slot, uint32_t seq)
+{
+    SeriesBlockHeader old;
+    if (readBlock(_file, slot, old, _payload))
+    {
+        _usedBlocks--;
+        _storedSamples -= old.samples;
+        _storedBytes -= old.used;
+    }
+
+    portENTER_CRITICAL(&_mux);
+    _slot = slot;
+    _seq = seq;
+    portEXIT_CRITICAL(&_mux);
+    _dirty = false;
+    _committedSamples = 0;
+    _enc.reset(_payload, SERIES_PAYLOAD_SIZE);
+    if (_haveBattery)
+        _enc.header(_battery);
+}
+
+// 目前區塊已滿：寫入後換到下一個槽位 (寫入失敗時該區塊的樣本遺失，但不阻塞之後的紀錄)
+void SeriesLog::nextBlock()
+{
+    commit();
+    if (_enc.samples() > 0)
+    {
+        _usedBlocks++;
+        _storedSamples += _enc.samples();
+        _storedBytes += _enc.size();
+    }
+    openBlock((_slot + 1) % _blocks, _seq + 1);
+}
+
+bool SeriesLog::append(const BatteryData &data, uint32_t t_ms, uint32_t wall_time, uint32_t wall_ms)
+{
+    if (!_file)
+        return false;
+
+    // 更換電池，或第一次得知客戶端時間時寫入新的標頭；其餘情況錨點只在下一個區塊的標頭更新
+    BatteryHeader h;
+    makeBatteryHeader(data, wall_time, wall_ms, h);
+    bool newHeader = !_haveBattery || memcmp(h.rom_id, _battery.rom_id, sizeof(h.rom_id)) != 0 ||
+                     strcmp(h.model, _battery.model) != 0 || (_battery.wall_time == 0 && wall_time != 0);
+    _battery = h;
+    _haveBattery = true;
+    if (newHeader && !_enc.header(_battery))
+        nextBlock(); // 新區塊開頭會寫入標頭
+
+    Sample s;
+    makeSeriesSample(data, t_ms, s);
+    if (!_enc.sample(s))
+    {
+        nextBlock();
+        if (!_enc.sample(s))
+            return false;
+    }
+
+    _stats.appends++;
+    if (!_dirty)
+    {
+        _dirty = true;
+        _dirtySinceMs = millis();
+    }
+    return true;
+}
+
+bool SeriesLog::commit()
+{
+    if (!_dirty)
+        return true;
+    if (!_file)
+        return false;
+
+    uint32_t start = micros();
+    SeriesBlockHeader hdr = {};
+    hdr.seq = _seq;
+    hdr.used = _enc.size();
+    hdr.samples = _enc.samples();
+    hdr.crc = blockCrc(hdr, _payload);
+
+    bool ok = _file.seek(slotOffset(_slot)) &&
+              _file.write(reinterpret_cast<const uint8_t *>(&hdr), sizeof(hdr)) == sizeof(hdr) &&
+              _file.write(_payload, hdr.used) == hdr.used;
+    _file.flush();
+    if (!ok)
+    {
+        // 保留在 RAM 中，等下一個提交週期重試
+        _stats.commit_failures++;
+        _dirtySinceMs = millis();
+        return false;
+    }
+
+    _dirty = false;
+    _committedSamples = hdr.samples;
+    uint32_t elapsed = micros() - start;
+    _stats.commits++;
+    _stats.last_commit_us = elapsed;
+    _stats.total_commit_us += elapsed;
+    if (elapsed > _stats.max_commit_us)
+        _stats.max_commit_us = elapsed;
+    _stats.bytes_written += sizeof(hdr) + hdr.used;
+    return true;
+}
+
+bool SeriesLog::commitIfDue()
+{
+    if (!_dirty || millis() - _dirtySinceMs < _commitDelayMs)
+        return true;
+    return commit();
+}
+
+void SeriesLog::clear()
+{
+    if (!_fs)
+        return;
+    if (_file)
+        _file.close();
+    _dirty = false;
+    if (create())
+        begin(*_fs, _blocks);
+}
+
+File SeriesLog::openReader() const
+{
+    return _fs ? _fs->open(_path, "r") : File();
+}
+
+void SeriesLog::readerStart(uint16_t &slot, uint32_t &seq) const
+{
+    portENTER_CRITICAL(&_mux);
+    slot = (_slot + 1) % _blocks;
+    seq = _seq;
+    portEXIT_CRITICAL(&_mux);
+}
+
+// --- 分塊 CSV ---
+
+SeriesCsvStream::SeriesCsvStream(const SeriesLog &log)
+    : _log(log), _reader(log.openReader()), _decoder(_payload, 0)
+{
+    _log.readerStart(_start, _maxSeq);
+}
+
+bool SeriesCsvStream::nextLine()
+{
+    Sample s;
+    while (true)
+    {
+        Decoder::Event ev = _decoder.next(_battery, s);
+        if (ev == Decoder::HEADER)
+            continue;
+        if (ev == Decoder::SAMPLE)
+            break;
+
+        // 區塊結束 (或損毀)：載入下一個建立當下已存在的區塊。
+        // 目前區塊的槽位在第一次提交前仍是最舊的舊區塊，以序號範圍排除
+        bool loaded = false;
+        while (!loaded && _pos < _log.blocks())
+        {
+            uint16_t slot = (_start + _pos++) % _log.blocks();
+            loaded = _log.readBlock(_reader, slot, _block, _payload) &&
+                     _block.seq <= _maxSeq && _block.seq + _log.blocks() > _maxSeq;
+        }
+        if (!loaded)
+            return false;
+        _decoder = Decoder(_payload, _block.used);
+    }
+
+    char ts[20] = "";
+    if (_battery.wall_time != 0)
+        formatLogTime(_battery.wall_time + (int32_t)(s.t_ms - _battery.wall_ms) / 1000, ts);
+    char rom[17];
+    formatRomId(_battery.rom_id, rom);
+    int n = snprintf(_line, sizeof(_line), "%s,%s,\"%s\",%u,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+                     ts, rom, _battery.model, s.t_ms,
+                     s.v[CH_PACK_MV], s.v[CH_CELL1_MV], s.v[CH_CELL2_MV], s.v[CH_CELL3_MV], s.v[CH_CELL4_MV], s.v[CH_CELL5_MV],
+                     s.v[CH_TEMP1_CENTI], s.v[CH_TEMP2_CENTI], s.v[CH_TEMP3_CENTI]);
+    _lineLen = n < 0 ? 0 : min((size_t)n, sizeof(_line) - 1);
+    _lineOff = 0;
+    _rows++;
+    return true;
+}
+
+size_t SeriesCsvStream::read(uint8_t *buf, size_t max_len)
+{
+    if (!_headerDone)
+    {
+        _lineLen = snprintf(_line, sizeof(_line), "\xEF\xBB\xBF%s\n", SERIES_CSV_HEADER);
+        _lineLen = min(_lineLen, sizeof(_line) - 1);
+        _lineOff = 0;
+        _headerDone = true;
+    }
+
+    size_t n = 0;
+    while (n < max_len)
+    {
+        if (_lineOff >= _lineLen && (!_reader || !nextLine()))
+            break;
+        size_t chunk = min(_lineLen - _lineOff, max_len - n);
+        memcpy(buf + n, _line + _lineOff, chunk);
+        _lineOff += chunk;
+        n += chunk;
+    }
+    return n;
+}
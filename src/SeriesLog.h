@@ -0,0 +1,144 @@
+#ifndef SERIES_LOG_H
+#define SERIES_LOG_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "MakitaBMS.h"
+#include "SeriesCodec.h"
+
+// 動態數據時間序列紀錄：SPIFFS 上固定大小區塊組成的環形檔，區塊內容以 SeriesCodec 壓縮。
+// 與 DataLog (每次手動讀取一筆完整紀錄) 並存，保存每一筆動態讀取與連續取樣的數值。
+//
+// 檔案格式：
+//   [0..15]  SeriesFileHeader
+//   [16..]   blocks 個區塊，每個 SERIES_BLOCK_SIZE 位元組：SeriesBlockHeader + 編碼內容
+//
+// 目前的區塊保留在 RAM 中附加樣本；寫滿時換到下一個槽位 (覆寫最舊的區塊)，
+// 超過提交延遲或呼叫 commit() 時把未寫滿的區塊寫入它的槽位 (之後以更多內容覆寫同一槽位)。
+// 區塊標頭帶序號與 CRC，開機時掃描序號即可還原；損毀的區塊整塊略過。
+
+static const uint16_t SERIES_BLOCK_SIZE = 1024;
+
+struct SeriesFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_size;
+    uint16_t blocks;
+    uint8_t reserved[6];
+};
+static_assert(sizeof(SeriesFileHeader) == 16, "SeriesFileHeader layout");
+
+struct SeriesBlockHeader
+{
+    uint32_t seq;     // 區塊序號 (從 1 開始遞增)，0 表示空槽
+    uint16_t used;    // 編碼內容的位元組數
+    uint16_t samples; // 區塊內的樣本數
+    uint16_t crc;     // seq/used/samples 與編碼內容的 CRC-16/CCITT
+    uint16_t reserved;
+};
+static_assert(sizeof(SeriesBlockHeader) == 12, "SeriesBlockHeader layout is stored on flash");
+
+static const uint16_t SERIES_PAYLOAD_SIZE = SERIES_BLOCK_SIZE - sizeof(SeriesBlockHeader);
+
+struct SeriesLogStats
+{
+    uint32_t appends = 0;
+    uint32_t commits = 0;
+    uint32_t last_commit_us = 0;
+    uint32_t max_commit_us = 0;
+    uint64_t total_commit_us = 0;
+    uint32_t commit_failures = 0;
+    uint64_t bytes_written = 0;
+};
+
+class SeriesLog
+{
+public:
+    explicit SeriesLog(const char *path) : _path(path) {}
+
+    // 開啟或建立紀錄檔 (格式或區塊數不符時重建)，並掃描還原寫入位置
+    bool begin(fs::FS &fs, uint16_t blocks);
+
+    // 附加一筆：電池身分取自 data 的靜態欄位 (更換電池時寫入新的標頭)，數值取自動態欄位。
+    // t_ms 為 millis() 時基；(wall_time, wall_ms) 為客戶端時鐘的錨點 (未知時 wall_time 為 0)
+    bool append(const BatteryData &data, uint32_t t_ms, uint32_t wall_time, uint32_t wall_ms);
+    // 把目前區塊寫入檔案 (沒有新樣本時直接回傳 true)
+    bool commit();
+    bool commitIfDue();
+    void setCommitDelay(uint32_t ms) { _commitDelayMs = ms; }
+    void clear();
+
+    uint16_t blocks() const { return _blocks; }
+    uint16_t usedBlocks() const { return _usedBlocks + (_enc.samples() > 0 ? 1 : 0); }
+    uint32_t samples() const { return _storedSamples + _enc.samples(); } // 含尚未提交的樣本
+    uint32_t encodedBytes() const { return _storedBytes + _enc.size(); }
+    uint16_t pending() const { return _dirty ? _enc.samples() - _committedSamples : 0; }
+    const SeriesLogStats &stats() const { return _stats; }
+
+    // 讀取端：由 readerStart() 的 slot 起依序讀取 blocks 個槽位即為由舊到新；空槽或損毀時回傳 false。
+    // payload 至少 SERIES_PAYLOAD_SIZE 位元組
+    File openReader() const;
+    // 同時取得最舊區塊的槽位與目前區塊的序號 (兩者需一致，以 portMUX 保護)
+    void readerStart(uint16_t &slot, uint32_t &seq) const;
+    bool readBlock(File &f, uint16_t slot, SeriesBlockHeader &hdr, uint8_t *payload) const;
+
+private:
+    const char *_path;
+    fs::FS *_fs = nullptr;
+    File _file;
+    uint16_t _blocks = 0;
+    uint16_t _usedBlocks = 0;
+    uint16_t _slot = 0;  // 目前 (RAM 中) 區塊的槽位
+    uint32_t _seq = 1;   // 目前區塊的序號
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED; // 保護 _slot/_seq (分塊下載的讀取端在其他工作中讀取)
+    uint32_t _storedSamples = 0; // 其他區塊的樣本數與編碼位元組數
+    uint32_t _storedBytes = 0;
+    SeriesLogStats _stats;
+
+    uint8_t _payload[SERIES_PAYLOAD_SIZE];
+    SeriesCodec::Encoder _enc;
+    SeriesCodec::BatteryHeader _battery = {};
+    bool _haveBattery = false;
+    bool _dirty = false;
+    uint16_t _committedSamples = 0;
+    uint32_t _dirtySinceMs = 0;
+    uint32_t _commitDelayMs = 10000;
+
+    bool create();
+    void openBlock(uint16_t slot, uint32_t seq);
+    void nextBlock();
+    static size_t slotOffset(uint16_t slot) { return sizeof(SeriesFileHeader) + (size_t)slot * SERIES_BLOCK_SIZE; }
+};
+
+// 由 BatteryData 的動態欄位組成一筆時間序列樣本 (通道順序見 SeriesCodec::Channel)
+void makeSeriesSample(const BatteryData &data, uint32_t t_ms, SeriesCodec::Sample &out);
+
+// 逐段產生解碼後的 CSV (供分塊 HTTP 回應使用)：一次只保留一個區塊與一行的緩衝區
+class SeriesCsvStream
+{
+public:
+    explicit SeriesCsvStream(const SeriesLog &log);
+    size_t read(uint8_t *buf, size_t max_len);
+    uint32_t rows() const { return _rows; }
+
+private:
+    const SeriesLog &_log;
+    File _reader;
+    uint16_t _start;
+    uint16_t _pos = 0;
+    uint32_t _maxSeq;
+    uint32_t _rows = 0;
+    bool _headerDone = false;
+    uint8_t _payload[SERIES_PAYLOAD_SIZE];
+    SeriesBlockHeader _block = {};
+    SeriesCodec::Decoder _decoder;
+    SeriesCodec::BatteryHeader _battery = {};
+    char _line[256];
+    size_t _lineLen = 0;
+    size_t _lineOff = 0;
+
+    bool nextLine();
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "Telemetry.h"
+
+namespace Telemetry
+{
+    static const char *const FIELD_KEYS[FIELD_COUNT] = {
+        "pack_mv",
+        "cell_mv", "cell_mv", "cell_mv", "cell_mv", "cell_mv",
+        "cell_diff_mv",
+        "temp1_centi", "temp2_centi", "temp3_centi",
+        "charge_cycles",
+        "over_discharge", "over_load",
+        "err_cnt_04", "err_cnt_05", "err_cnt_06", "err_cnt_07",
+        "fuse_blown",
+        "lock_status",
+        "status_code",
+        "fw_ver",
+        "health_pct",
+        "remaining_capacity", "full_capacity",
+        "cell_diff_ewma_mv", "cell_diff_trend_mv",
+        "thermal_spread_centi",
+        "anomalies",
+    };
+
+    const char *fieldKey(uint8_t field)
+    {
+        return field < FIELD_COUNT ? FIELD_KEYS[field] : "";
+    }
+
+    uint32_t maskForKey(const char *key)
+    {
+        if (key == nullptr)
+            return 0;
+        uint32_t mask = 0;
+        for (uint8_t f = 0; f < FIELD_COUNT; f++)
+            if (strcmp(FIELD_KEYS[f], key) == 0)
+                mask |= 1UL << f;
+        return mask;
+    }
+
+    void capture(const BatteryData &data, Snapshot &out)
+    {
+        int32_t *v = out.values;
+        v[F_PACK_MV] = data.pack_mv;
+        for (int i = 0; i < 5; i++)
+            v[F_CELL1_MV + i] = data.cell_mv[i];
+        v[F_CELL_DIFF_MV] = data.cell_diff_mv;
+        v[F_TEMP1_CENTI] = data.temp1_centi;
+        v[F_TEMP2_CENTI] = data.temp2_centi;
+        v[F_TEMP3_CENTI] = data.temp3_centi;
+        v[F_CHARGE_CYCLES] = data.charge_cycles;
+        v[F_OVER_DISCHARGE] = data.over_discharge;
+        v[F_OVER_LOAD] = data.over_load;
+        v[F_ERR_04] = data.err_cnt_04;
+        v[F_ERR_05] = data.err_cnt_05;
+        v[F_ERR_06] = data.err_cnt_06;
+        v[F_ERR_07] = data.err_cnt_07;
+        v[F_FUSE_BLOWN] = data.fuse_blown;
+        v[F_LOCK_STATUS] = data.lock_status;
+        v[F_STATUS_CODE] = data.status_code_raw;
+        v[F_FW_VER] = data.fw_ver;
+        v[F_HEALTH_PCT] = data.health_pct;
+        v[F_REMAINING_CAPACITY] = data.remaining_capacity;
+        v[F_FULL_CAPACITY] = data.full_capacity;
+        v[F_CELL_DIFF_EWMA_MV] = data.cell_diff_ewma_mv;
+        v[F_CELL_DIFF_TREND_MV] = data.cell_diff_trend_mv;
+        v[F_THERMAL_SPREAD_CENTI] = data.thermal_spread_centi;
+        v[F_ANOMALY_FLAGS] = data.anomaly_flags;
+        out.flags = data.confidence.verified ? FLAG_VERIFIED : 0;
+    }
+
+    uint32_t diff(const Snapshot &prev, const Snapshot &next)
+    {
+        uint32_t mask = 0;
+        for (uint8_t f = 0; f < FIELD_COUNT; f++)
+            if (prev.values[f] != next.values[f])
+                mask |= 1UL << f;
+        return mask;
+    }
+
+    static size_t writeHeader(uint8_t flags, uint32_t mask, uint8_t *out)
+    {
+        size_t n = 0;
+        out[n++] = FRAME_DYNAMIC;
+        out[n++] = VERSION;
+        out[n++] = flags;
+        for (int i = 0; i < 4; i++)
+            out[n++] = (uint8_t)(mask >> (i * 8));
+        return n;
+    }
+
+    static size_t writeValues(const Snapshot &snap, uint32_t mask, uint8_t *out, size_t n)
+    {
+        for (uint8_t f = 0; f < FIELD_COUNT; f++)
+        {
+            if (!(mask & (1UL << f)))
+                continue;
+            uint32_t v = (uint32_t)snap.values[f];
+            out[n++] = (uint8_t)v;
+            if (FIELD_SPECS[f].width == 2)
+                out[n++] = (uint8_t)(v >> 8);
+        }
+        return n;
+    }
+
+    size_t encode(const Snapshot &snap, uint32_t mask, uint8_t extra_flags, uint8_t *out)
+    {
+        mask &= ALL_FIELDS;
+        size_t n = writeHeader(snap.flags | extra_flags, mask, out);
+        return writeValues(snap, mask, out, n);
+    }
+
+    size_t encodeStream(const Snapshot &snap, uint32_t mask, uint32_t t_us, uint8_t *out)
+    {
+        mask &= ALL_FIELDS;
+        size_t n = writeHeader(FLAG_STREAM, mask, out); // 高速取樣未經驗證，不帶 FLAG_VERIFIED
+        for (size_t i = 0; i < STREAM_TS_LEN; i++)
+            out[n++] = (uint8_t)(t_us >> (i * 8));
+        return writeValues(snap, mask, out, n);
+    }
+}
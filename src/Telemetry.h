@@ -0,0 +1,133 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "MakitaBMS.h"
+
+// 二進位遙測幀 (dynamic_data 的精簡版本，JSON 仍為預設/後備格式)。
+// 客戶端以 {"command":"hello","binary":<版本>} 協商後才會收到此格式。
+//
+// 幀格式 (little-endian)：
+//   [0]    FRAME_DYNAMIC
+//   [1]    VERSION
+//   [2]    旗標 (FLAG_*)
+//   [3..6] 欄位遮罩 (bit n = 欄位 n 有出現在後面；差異幀只含變動的欄位)
+//   [7..]  依欄位編號順序排列的數值，寬度見 FIELD_SPECS
+// FLAG_STREAM 幀在 [7..10] 多一個 uint32 取樣時間戳 (裝置 micros())，數值從 [11] 開始。
+//
+// 欄位表需與 data/ws_client.js 的 TELEMETRY_FIELDS 保持一致。
+namespace Telemetry
+{
+    constexpr uint8_t FRAME_DYNAMIC = 0xD7;
+    constexpr uint8_t VERSION = 2; // 2：加入分析欄位 (Analytics)
+    constexpr size_t HEADER_LEN = 7;
+
+    constexpr uint8_t FLAG_VERIFIED = 0x01; // 數據經過多數決驗證
+    constexpr uint8_t FLAG_KEYFRAME = 0x02; // 完整幀：客戶端應以此取代而非合併先前的數值
+    constexpr uint8_t FLAG_STREAM = 0x04;   // 連續取樣幀：只含訂閱的欄位，合併到目前數值
+
+    enum Field : uint8_t
+    {
+        F_PACK_MV = 0,
+        F_CELL1_MV,
+        F_CELL2_MV,
+        F_CELL3_MV,
+        F_CELL4_MV,
+        F_CELL5_MV,
+        F_CELL_DIFF_MV,
+        F_TEMP1_CENTI,
+        F_TEMP2_CENTI,
+        F_TEMP3_CENTI,
+        F_CHARGE_CYCLES,
+        F_OVER_DISCHARGE,
+        F_OVER_LOAD,
+        F_ERR_04,
+        F_ERR_05,
+        F_ERR_06,
+        F_ERR_07,
+        F_FUSE_BLOWN,
+        F_LOCK_STATUS,
+        F_STATUS_CODE,
+        F_FW_VER,
+        F_HEALTH_PCT,
+        F_REMAINING_CAPACITY,
+        F_FULL_CAPACITY,
+        F_CELL_DIFF_EWMA_MV,
+        F_CELL_DIFF_TREND_MV,
+        F_THERMAL_SPREAD_CENTI,
+        F_ANOMALY_FLAGS,
+        FIELD_COUNT
+    };
+
+    struct FieldSpec
+    {
+        uint8_t width; // 1 或 2 位元組
+        bool is_signed;
+    };
+
+    constexpr FieldSpec FIELD_SPECS[FIELD_COUNT] = {
+        {2, false}, // pack_mv
+        {2, false}, {2, false}, {2, false}, {2, false}, {2, false}, // cell_mv[0..4]
+        {2, false}, // cell_diff_mv
+        {2, true}, {2, true}, {2, true}, // temp1..3_centi
+        {2, false}, // charge_cycles
+        {1, false}, {1, false}, // over_discharge, over_load
+        {1, false}, {1, false}, {1, false}, {1, false}, // err_cnt_04..07
+        {1, false}, // fuse_blown
+        {1, false}, // lock_status
+        {2, false}, // status_code
+        {1, false}, // fw_ver
+        {1, false}, // health_pct
+        {2, false}, {2, false}, // remaining_capacity, full_capacity
+        {2, false}, // cell_diff_ewma_mv
+        {2, true},  // cell_diff_trend_mv
+        {2, false}, // thermal_spread_centi
+        {2, false}, // anomalies
+    };
+
+    constexpr uint32_t ALL_FIELDS = (1UL << FIELD_COUNT) - 1;
+    static_assert(FIELD_COUNT <= 32, "field mask is 32 bits");
+
+    constexpr uint32_t CELL_FIELDS = ((1UL << 5) - 1) << F_CELL1_MV;
+    // 每筆動態樣本都會重新計算的分析欄位
+    constexpr uint32_t ANALYTICS_STREAM_FIELDS = (1UL << F_CELL_DIFF_EWMA_MV) | (1UL << F_CELL_DIFF_TREND_MV) |
+                                                 (1UL << F_THERMAL_SPREAD_CENTI) | (1UL << F_ANOMALY_FLAGS);
+    // 0xD7 動態幀會更新的欄位 (連續取樣只能訂閱這些)
+    constexpr uint32_t STREAM_FIELDS = (1UL << F_PACK_MV) | CELL_FIELDS | (1UL << F_CELL_DIFF_MV) |
+                                       (1UL << F_TEMP1_CENTI) | (1UL << F_TEMP2_CENTI) | ANALYTICS_STREAM_FIELDS;
+
+    // 欄位對應的 JSON 鍵名 (電芯欄位皆為 "cell_mv" 陣列)
+    const char *fieldKey(uint8_t field);
+    // 由 JSON 鍵名取得欄位遮罩 ("cell_mv" 代表全部電芯)，未知名稱回傳 0
+    uint32_t maskForKey(const char *key);
+
+    constexpr size_t maxFrameLen()
+    {
+        size_t n = HEADER_LEN;
+        for (const FieldSpec &f : FIELD_SPECS)
+            n += f.width;
+        return n;
+    }
+    constexpr size_t MAX_FRAME_LEN = maxFrameLen();
+    constexpr size_t STREAM_TS_LEN = 4;
+    constexpr size_t MAX_STREAM_FRAME_LEN = MAX_FRAME_LEN + STREAM_TS_LEN;
+
+    // 一次取出所有欄位的整數值 (供編碼與比對差異)
+    struct Snapshot
+    {
+        int32_t values[FIELD_COUNT];
+        uint8_t flags;
+    };
+    void capture(const BatteryData &data, Snapshot &out);
+
+    // 兩份快照之間有變動的欄位遮罩
+    uint32_t diff(const Snapshot &prev, const Snapshot &next);
+
+    // 依遮罩編碼，回傳幀長度 (out 至少 MAX_FRAME_LEN)
+    size_t encode(const Snapshot &snap, uint32_t mask, uint8_t extra_flags, uint8_t *out);
+
+    // 連續取樣幀 (FLAG_STREAM + 時間戳)，回傳幀長度 (out 至少 MAX_STREAM_FRAME_LEN)
+    size_t encodeStream(const Snapshot &snap, uint32_t mask, uint32_t t_us, uint8_t *out);
+}
+
+#endif
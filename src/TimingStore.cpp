@@ -0,0 +1,79 @@
+#include "TimingStore.h"
+
+// 存放格式版本，結構變更時遞增，舊紀錄即自動失效
+static const uint8_t TIMING_RECORD_VERSION = 1;
+
+struct TimingRecord
+{
+    uint8_t version;
+    uint8_t rom_id[8]; // 鍵名只是雜湊，載入時比對完整 ROM ID
+    BusTimingProfile profile;
+};
+
+// FNV-1a 64 位元
+static uint64_t romIdHash(const uint8_t *rom_id)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; i++)
+    {
+        h ^= rom_id[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+bool TimingStore::begin()
+{
+    _ready = _prefs.begin("bms_timing", false);
+    return _ready;
+}
+
+bool TimingStore::keyFor(const uint8_t *rom_id, char *key)
+{
+    bool valid = false;
+    for (int i = 0; i < 8; i++)
+        valid = valid || rom_id[i] != 0;
+    if (!valid)
+        return false;
+    // 雜湊的低 60 位元，15 個十六進位字元
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    uint64_t h = romIdHash(rom_id);
+    for (int i = 14; i >= 0; i--, h >>= 4)
+        key[i] = HEX_DIGITS[h & 0x0F];
+    key[15] = '\0';
+    return true;
+}
+
+bool TimingStore::load(const uint8_t *rom_id, BusTimingProfile &profile)
+{
+    char key[16];
+    if (!_ready || !keyFor(rom_id, key))
+        return false;
+    TimingRecord rec;
+    if (_prefs.getBytes(key, &rec, sizeof(rec)) != sizeof(rec))
+        return false;
+    if (rec.version != TIMING_RECORD_VERSION || memcmp(rec.rom_id, rom_id, sizeof(rec.rom_id)) != 0)
+        return false;
+    profile = rec.profile;
+    return true;
+}
+
+bool TimingStore::save(const uint8_t *rom_id, const BusTimingProfile &profile)
+{
+    char key[16];
+    if (!_ready || !keyFor(rom_id, key))
+        return false;
+    TimingRecord rec = {};
+    rec.version = TIMING_RECORD_VERSION;
+    memcpy(rec.rom_id, rom_id, sizeof(rec.rom_id));
+    rec.profile = profile;
+    return _prefs.putBytes(key, &rec, sizeof(rec)) == sizeof(rec);
+}
+
+bool TimingStore::remove(const uint8_t *rom_id)
+{
+    char key[16];
+    if (!_ready || !keyFor(rom_id, key))
+        return false;
+    return _prefs.remove(key);
+}
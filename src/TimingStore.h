@@ -0,0 +1,28 @@
+#ifndef TIMING_STORE_H
+#define TIMING_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "MakitaBMS.h"
+
+// 依電池 ROM ID 保存校準後的匯流排時序 (NVS)。
+// 未校準的電池找不到紀錄，呼叫端應回退到安全時序。
+class TimingStore
+{
+public:
+    bool begin();
+    // rom_id 為 8 位元組原始 ROM ID (全 0 視為未識別)
+    bool load(const uint8_t *rom_id, BusTimingProfile &profile);
+    bool save(const uint8_t *rom_id, const BusTimingProfile &profile);
+    bool remove(const uint8_t *rom_id);
+
+private:
+    Preferences _prefs;
+    bool _ready = false;
+
+    // NVS 鍵名最長 15 字元，放不下 16 個十六進位字元的 ROM ID：改用 ROM ID 雜湊的 15 個十六進位字元，
+    // 紀錄內另存完整 ROM ID，載入時比對以排除雜湊碰撞。key 至少 16 位元組；ROM ID 無效時回傳 false
+    static bool keyFor(const uint8_t *rom_id, char *key);
+};
+
+#endif
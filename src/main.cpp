@@ -4,9 +4,22 @@
 #include <ESPAsyncWebServer.h>
 #include <DNSServer.h>
 #include <ArduinoJson.h>
+#include <memory>
 #include "FS.h"
 #include "SPIFFS.h"
 #include "MakitaBMS.h"
+#include "BmsWorker.h"
+#include "Telemetry.h"
+#include "DataLog.h"
+#include "SeriesLog.h"
+#include "Rollup.h"
+#include "Analytics.h"
+#include "FleetStats.h"
+#include "LogBenchmark.h"
+#include "OneWireMakita.h"
+#ifdef MAKITA_BUS_RMT
+#include "OneWireMakitaRMT.h"
+#endif
 #include <HardwareSerial.h> // 強制包含硬體串口定義
 #include <Update.h>
 #if !defined(Serial)
@@ -15,55 +28,200 @@
 // --- 設定和全域物件 ---
 #define ONEWIRE_PIN 4
 #define ENABLE_PIN 5
+#ifndef RELAY_PIN
+#define RELAY_PIN -1 // 負載測試繼電器 (HIGH = 接上負載)；未安裝時為 -1，可用 -DRELAY_PIN=<腳位> 指定
+#endif
 
 bool enableVerifiedRead = false; // 除錯開關：預設關閉，由 Serial 輸入控制
 
 // 優化 --- 狀態控制變數 ---
 unsigned long lastHeartbeat = 0;  // 用於偵錯變數
-bool shouldUpdateData = false;    // 控制是否需要執行讀取任務
-bool shouldClearErrors = false;   // 控制是否需要清除錯誤
-bool shouldReadStatic = false;    // 控制是否需要讀取靜態資料
-bool skipMcuCsvLog = false;       // 新增：用於跳過單次 MCU CSV 紀錄的旗標
-unsigned long lastUpdateTick = 0; // 用於計時自動更新
-static BatteryData cached_data;   // 全域資料緩存，用於避免在請求動態資料時遺失靜態數據
+unsigned long lastUpdateTick = 0; // 串流進行中最近一次送出 stream_stats 的時間
+static BatteryData cached_data;   // 網路端的資料快照 (由 BMS 工作任務發布)，避免在請求動態資料時遺失靜態數據
+static SupportedFeatures cached_features; // 最近一次識別的功能旗標 (新連線重新同步用)
 
 // --- CSV 紀錄相關 ---
 //const char *password = "12345678";   // 已關閉密碼，開放熱點Wi-Fi ，熱點密碼可由此設定
 String currentClientTime = "";    // 儲存前端傳來的時間戳記
-const char* LOG_PATH = "/datalog.csv";
-const int MAX_LOG_LINES = 800;    // 最大紀錄筆數
+static const uint16_t LOG_CAPACITY = 800;                   // 最大紀錄筆數 (環形覆寫最舊的紀錄)
+static const uint8_t LOG_GROUP_SIZE = 16;                  // 暫存滿這麼多筆就提交到 flash
+static const uint32_t LOG_COMMIT_MAX_DELAY_MS = 10000;     // 或最舊一筆暫存超過這段時間就提交
+static DataLog dataLog("/datalog.bin");
+static const char LEGACY_LOG_PATH[] = "/datalog_legacy.csv";  // 舊版 CSV 紀錄 (開機時由 /datalog.csv 改名，清除 MCU 紀錄時刪除)
+static LogIndex logIndex("/datalog.idx");                   // 依 ROM ID 排序的電池目錄 (/api/history)
+static const uint16_t SERIES_BLOCKS = 256;                  // 時間序列紀錄：256 × 1KB 區塊 (約 3 萬筆動態樣本)
+static const uint32_t SERIES_BENCH_SAMPLES = 10000;
+static SeriesLog seriesLog("/series.bin");
+static RollupStore rollups;                                 // 1s/1m/15m 的 min/max/avg (/api/rollup)
+static PackAnalytics analytics;                             // SOH、壓差趨勢、溫差與異常旗標 (隨遙測送出)
+static FleetStats fleetStats("/fleet.bin");                 // 所有讀取過的電池的分布統計 (/api/fleet)
+static volatile uint32_t clientTimeAnchor = 0;   // 最近一次前端時間戳 (2000-01-01 起秒數) 與當時的 millis()
+static volatile uint32_t clientTimeAnchorMs = 0;
+static volatile bool pendingLogClear = false;   // 由 HTTP 回呼設定，於 loop 中清除 (避免與寫入同時進行)
+static volatile bool pendingFleetClear = false; // 由 HTTP 回呼設定，於 loop 中清除電池群統計 (與紀錄檔分開)
+static volatile uint16_t pendingLogBenchmark = 0; // 由 WebSocket 指令設定的效能比較筆數，於 loop 中執行
+static volatile bool pendingLogCommit = false;  // OTA 開始時由上傳回呼設定，loop 提交暫存紀錄後清除
+static volatile bool otaInProgress = false;     // OTA 期間停止寫入紀錄 (更新 SPIFFS 映像時不可再寫檔)
+static volatile uint32_t otaLastChunkMs = 0;    // 最近一次收到上傳資料的時間 (loop 以此判斷上傳中斷)
+static volatile uint32_t pendingRestartMs = 0;  // 更新成功後由上傳回呼設定，loop 提交紀錄並送出回應後重新開機
+static const uint32_t OTA_STALL_MS = 30000;     // 超過此時間沒有新的上傳資料：視為中斷，恢復寫入紀錄
+static const uint32_t OTA_RESTART_DELAY_MS = 200; // 留時間讓 HTTP 回應送出
 // 原本
 const char *ssid = "Makita_BMS_Tool";
 DNSServer dnsServer;
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
-MakitaBMS bms(ONEWIRE_PIN, ENABLE_PIN); // 用於儲存靜態資料的全域緩存，以避免在請求動態資料時遺失靜態數據
+// 匯流排後端：預設 GPIO bit-bang；以 -DMAKITA_BUS_RMT 編譯則改用 RMT 週邊產生時序
+#ifdef MAKITA_BUS_RMT
+OneWireMakitaRMT makitaBus(ONEWIRE_PIN);
+#else
+OneWireMakita makitaBus(ONEWIRE_PIN);
+#endif
+BmsWorker bmsWorker(makitaBus, ENABLE_PIN, RELAY_PIN); // 獨佔 MakitaBMS 的工作任務，所有匯流排操作都經由它的指令佇列
 
 // --- 前向宣告 (Forward Declarations) ---
 void sendFeedback(const String &type, const String &message);
 void sendPresence(bool is_present);
 void logToClients(const String &message, LogLevel level);
 
-/// --- 透過 WebSocket 傳送訊息給客戶端的函數 ---
-void sendJsonResponse(const String &type, const BatteryData &data, const SupportedFeatures *features)
+// --- Heap 監測 (長時間浸泡測試時觀察碎片化) ---
+struct HeapStats
 {
-    if (ws.count() == 0)
-        return;
+    uint32_t free_bytes;     // 目前可用
+    uint32_t min_free_bytes; // 開機以來的最低水位
+    uint32_t max_block;      // 最大可配置連續區塊
+    uint8_t frag_pct;        // 碎片化程度：100 - 最大區塊 / 可用
+};
+
+HeapStats readHeapStats()
+{
+    HeapStats h;
+    h.free_bytes = ESP.getFreeHeap();
+    h.min_free_bytes = ESP.getMinFreeHeap();
+    h.max_block = ESP.getMaxAllocHeap();
+    h.frag_pct = h.free_bytes ? (uint8_t)(100 - (uint64_t)h.max_block * 100 / h.free_bytes) : 0;
+    return h;
+}
+
+static const uint32_t HEAP_REPORT_EVERY = 100; // 每 N 次動態刷新印出一次 heap 狀態
+static uint32_t dynamicRefreshCount = 0;
+
+// --- WebSocket 客戶端登記 (協商後的遙測格式) ---
+// 連線時登記為 JSON，送出 hello 且版本相符後改收二進位幀。
+// 於 AsyncTCP 回呼中修改、於 loop 中讀取，以 portMUX 保護。
+struct TelemetryClient
+{
+    uint32_t id;          // 0 表示空位
+    uint8_t binary_ver;   // 0 表示只接受 JSON
+    uint32_t stream_mask; // 訂閱的連續取樣欄位 (Telemetry 欄位遮罩)，0 表示未訂閱
+};
+static const size_t MAX_TELEMETRY_CLIENTS = 8; // 與 AsyncWebSocket 的預設上限相同
+static TelemetryClient telemetryClients[MAX_TELEMETRY_CLIENTS];
+static portMUX_TYPE telemetryLock = portMUX_INITIALIZER_UNLOCKED;
+
+void registerClient(uint32_t id, uint8_t binary_ver)
+{
+    portENTER_CRITICAL(&telemetryLock);
+    TelemetryClient *slot = nullptr;
+    for (TelemetryClient &c : telemetryClients)
+    {
+        if (c.id == id)
+        {
+            slot = &c;
+            break;
+        }
+        if (!slot && c.id == 0)
+            slot = &c;
+    }
+    if (slot)
+    {
+        if (slot->id != id)
+            slot->stream_mask = 0;
+        slot->id = id;
+        slot->binary_ver = binary_ver;
+    }
+    portEXIT_CRITICAL(&telemetryLock);
+}
+
+void unregisterClient(uint32_t id)
+{
+    portENTER_CRITICAL(&telemetryLock);
+    for (TelemetryClient &c : telemetryClients)
+        if (c.id == id)
+            c = TelemetryClient{0, 0, 0};
+    portEXIT_CRITICAL(&telemetryLock);
+}
+
+// 更新連線的串流訂閱 (mask = 0 為取消)，回傳更新後的訂閱者數量
+size_t setStreamMask(uint32_t id, uint32_t mask)
+{
+    size_t subscribers = 0;
+    portENTER_CRITICAL(&telemetryLock);
+    for (TelemetryClient &c : telemetryClients)
+    {
+        if (c.id == id)
+            c.stream_mask = mask;
+        if (c.id != 0 && c.stream_mask != 0)
+            subscribers++;
+    }
+    portEXIT_CRITICAL(&telemetryLock);
+    return subscribers;
+}
 
+// 串流自動停止後清除所有訂閱，避免下次有人開始串流時舊訂閱者也收到樣本
+void clearStreamMasks()
+{
+    portENTER_CRITICAL(&telemetryLock);
+    for (TelemetryClient &c : telemetryClients)
+        c.stream_mask = 0;
+    portEXIT_CRITICAL(&telemetryLock);
+}
+
+static const uint16_t STREAM_DEFAULT_HZ = 5;
+static const uint32_t STREAM_STATS_EVERY_MS = 5000; // 串流進行中 stream_stats 的推送間隔
+static uint32_t streamNetDrops = 0;                 // 連線傳送佇列已滿而略過的樣本 (網路端)
+static volatile bool loadTestRunning = false;       // 負載測試期間所有連線都收即時曲線 (WS 回呼寫入、loop 讀取/清除)
+
+// --- 差異更新狀態 (僅 loop 存取，與登記表同一位置對應) ---
+// 每個連線記住上次送出的快照：之後只送有變動的欄位，每 KEYFRAME_EVERY 幀補一個完整幀。
+struct DeltaState
+{
+    uint32_t id;          // 與登記表不同即代表新連線，需重新同步
+    uint8_t binary_ver;   // 協商結果變更時也需重新同步
+    uint8_t since_key;    // 距離上一個完整幀的幀數
+    bool has_base;        // last 是否為客戶端已知的數值
+    Telemetry::Snapshot last;
+};
+static DeltaState deltaStates[MAX_TELEMETRY_CLIENTS];
+static const uint8_t KEYFRAME_EVERY = 20;
+
+/// --- 透過 WebSocket 傳送訊息給客戶端的函數 ---
+// include_static = false 時省略識別後不會改變的靜態欄位 (已由 static_data 送出)
+void buildBatteryJson(const String &type, const BatteryData &data, const SupportedFeatures *features, String &output,
+                      bool include_static = true)
+{
     // 優化 1: 縮減緩衝區大小 (1024 bytes 對於目前的結構已足夠，節省 1KB Heap)
-    DynamicJsonDocument doc(1024);
+    // 開啟讀取驗證時需額外容納可信度欄位
+    DynamicJsonDocument doc(data.confidence.verified ? 1536 : 1024);
     doc["type"] = type;
 
     JsonObject dataObj = doc.createNestedObject("data");
 
+    // 顯示字串只在此處 (輸出端) 由原始數值格式化
+    BatteryLabels labels;
+    formatBatteryLabels(data, labels);
+
     // --- 基礎資訊 ---
-    dataObj["model"] = data.model;
-    dataObj["serial"] = data.serial;
-    dataObj["rom_id"] = data.rom_id;
+    if (include_static)
+    {
+        dataObj["model"] = data.model;
+        dataObj["serial"] = labels.serial;
+        dataObj["rom_id"] = labels.rom_id;
+        dataObj["prod_date"] = labels.prod_date;
+        dataObj["capacity"] = labels.capacity;
+        dataObj["battery_type"] = labels.battery_type;
+    }
     dataObj["fw_ver"] = data.fw_ver;
-    dataObj["prod_date"] = data.prod_date;
-    dataObj["capacity"] = data.capacity;
-    dataObj["battery_type"] = data.battery_type;
 
     // --- 狀態與診斷 (文字 + 數字整合) ---
     // 優化：直接傳送數字，讓前端透過語言包翻譯 (LOCK_0, LOCK_1)
@@ -72,7 +230,7 @@ void sendJsonResponse(const String &type, const BatteryData &data, const Support
     // 2. 狀態碼：
     // 為了配合你的 app.js (if (data.status_code))，我們統一 key 名稱
     dataObj["status_code"] = data.status_code_raw; // 傳送原始數字 (0, 10, 96...)
-    dataObj["status_hex"] = data.status_code_hex;  // 保留備用的十六進位字串
+    dataObj["status_hex"] = labels.status_hex;     // 保留備用的十六進位字串
     // 優化 2: 移除 status_raw (與 status_code 重複)，減少傳輸量
 
     // --- 計數器與健康指標 ---
@@ -86,16 +244,46 @@ void sendJsonResponse(const String &type, const BatteryData &data, const Support
     dataObj["fuse_blown"] = data.fuse_blown;
 
 
-    // --- 電壓與溫度數據 ---
-    dataObj["pack_voltage"] = data.pack_voltage;
-    JsonArray cellV = dataObj.createNestedArray("cell_voltages");
+    // --- 電壓與溫度數據 (整數 mV / 0.01°C，由前端換算) ---
+    dataObj["pack_mv"] = data.pack_mv;
+    JsonArray cellV = dataObj.createNestedArray("cell_mv");
     for (int i = 0; i < 5; i++)
-        cellV.add(data.cell_voltages[i]);
-
-    dataObj["cell_diff"] = data.cell_diff;
-    dataObj["temp1"] = data.temp1;
-    dataObj["temp2"] = data.temp2;
-    dataObj["temp3"] = data.temp3;
+        cellV.add(data.cell_mv[i]);
+
+    dataObj["cell_diff_mv"] = data.cell_diff_mv;
+    dataObj["temp1_centi"] = data.temp1_centi;
+    dataObj["temp2_centi"] = data.temp2_centi;
+    dataObj["temp3_centi"] = data.temp3_centi;
+
+    // --- 分析結果 (PackAnalytics 計算，前端只負責顯示) ---
+    dataObj["health_pct"] = data.health_pct;
+    dataObj["remaining_capacity"] = data.remaining_capacity;
+    dataObj["full_capacity"] = data.full_capacity;
+    dataObj["cell_diff_ewma_mv"] = data.cell_diff_ewma_mv;
+    dataObj["cell_diff_trend_mv"] = data.cell_diff_trend_mv;
+    dataObj["thermal_spread_centi"] = data.thermal_spread_centi;
+    dataObj["anomalies"] = data.anomaly_flags;
+
+    // --- 讀取可信度 (僅在多數決驗證開啟時傳送) ---
+    if (data.confidence.verified)
+    {
+        const FieldConfidence &c = data.confidence;
+        JsonObject conf = dataObj.createNestedObject("confidence");
+        conf["pack_voltage"] = c.pack_voltage;
+        JsonArray cellC = conf.createNestedArray("cell_voltages");
+        for (int i = 0; i < 5; i++)
+            cellC.add(c.cell_voltages[i]);
+        conf["temp1"] = c.temp1;
+        conf["temp2"] = c.temp2;
+        conf["temp3"] = c.temp3;
+        conf["over_discharge"] = c.over_discharge;
+        conf["over_load"] = c.over_load;
+        JsonArray errC = conf.createNestedArray("err_cnt");
+        for (int i = 0; i < 4; i++)
+            errC.add(c.err_cnt[i]);
+        conf["fuse_blown"] = c.fuse;
+        conf["fw_ver"] = c.fw_ver;
+    }
 
     // --- 功能支援標記 ---
     if (features)
@@ -104,107 +292,399 @@ void sendJsonResponse(const String &type, const BatteryData &data, const Support
         featuresObj["read_dynamic"] = features->read_dynamic;
         featuresObj["led_test"] = features->led_test;
         featuresObj["clear_errors"] = features->clear_errors;
+        featuresObj["load_test"] = features->load_test;
     }
 
-    String output;
     // 優化 3: 預先分配記憶體，避免序列化過程中的多次重分配 (Reallocation)
     output.reserve(1024);
     serializeJson(doc, output);
+}
+
+void sendJsonResponse(const String &type, const BatteryData &data, const SupportedFeatures *features)
+{
+    if (ws.count() == 0)
+        return;
+
+    String output;
+    buildBatteryJson(type, data, features, output);
+    ws.textAll(output);
+}
+
+// 取得登記表複本 (AsyncTCP 可能同時修改)
+static void copyClients(TelemetryClient *out)
+{
+    portENTER_CRITICAL(&telemetryLock);
+    memcpy(out, telemetryClients, sizeof(telemetryClients));
+    portEXIT_CRITICAL(&telemetryLock);
+}
+
+// 新連線或重新協商的客戶端：補送 static_data，下一個動態幀為完整幀。於 loop 中呼叫。
+void serviceTelemetryClients()
+{
+    TelemetryClient clients[MAX_TELEMETRY_CLIENTS];
+    copyClients(clients);
+
+    for (size_t i = 0; i < MAX_TELEMETRY_CLIENTS; i++)
+    {
+        const TelemetryClient &c = clients[i];
+        DeltaState &st = deltaStates[i];
+        if (c.id == st.id && c.binary_ver == st.binary_ver)
+            continue;
+
+        bool new_client = (c.id != st.id);
+        st = DeltaState{};
+        st.id = c.id;
+        st.binary_ver = c.binary_ver;
+        if (c.id != 0 && new_client && hasRomId(cached_data))
+        {
+            String json;
+            buildBatteryJson("static_data", cached_data, &cached_features, json);
+            ws.text(c.id, json);
+        }
+    }
+}
+
+// 重新識別電池後，所有客戶端的下一個動態幀改送完整幀
+void forceKeyframes()
+{
+    for (DeltaState &st : deltaStates)
+        st.has_base = false;
+}
+
+// dynamic_data 廣播：已協商的客戶端收二進位差異幀 (無 heap 配置)，其餘客戶端收 JSON。
+// JSON 只在確實有 JSON 客戶端時才建立，且不重送靜態欄位。
+void broadcastDynamic(const BatteryData &data)
+{
+    if (ws.count() == 0)
+        return;
+
+    serviceTelemetryClients();
+    TelemetryClient clients[MAX_TELEMETRY_CLIENTS];
+    copyClients(clients);
+
+    Telemetry::Snapshot snap;
+    Telemetry::capture(data, snap);
+    uint8_t frame[Telemetry::MAX_FRAME_LEN];
+    String json;
+    size_t known = 0;
+
+    for (size_t i = 0; i < MAX_TELEMETRY_CLIENTS; i++)
+    {
+        const TelemetryClient &c = clients[i];
+        DeltaState &st = deltaStates[i];
+        if (c.id == 0 || st.id != c.id)
+            continue;
+        known++;
+        if (c.binary_ver == Telemetry::VERSION)
+        {
+            // 傳送佇列已滿：這一幀不會送達，不可推進差異基準；下一幀改送完整幀
+            if (!ws.availableForWrite(c.id))
+            {
+                st.has_base = false;
+                continue;
+            }
+            bool keyframe = !st.has_base || st.since_key + 1 >= KEYFRAME_EVERY;
+            uint32_t mask = keyframe ? Telemetry::ALL_FIELDS : Telemetry::diff(st.last, snap);
+            size_t len = Telemetry::encode(snap, mask, keyframe ? Telemetry::FLAG_KEYFRAME : 0, frame);
+            ws.binary(c.id, frame, len);
+            st.last = snap;
+            st.has_base = true;
+            st.since_key = keyframe ? 0 : st.since_key + 1;
+        }
+        else
+        {
+            if (json.length() == 0)
+                buildBatteryJson("dynamic_data", data, nullptr, json, false);
+            ws.text(c.id, json);
+        }
+    }
+
+    // 登記表已滿時仍有未登記的連線：退回完整 JSON 廣播以免漏送 (已協商者會多收一份，可接受)
+    if (known < ws.count())
+    {
+        String full;
+        buildBatteryJson("dynamic_data", data, nullptr, full);
+        ws.textAll(full);
+    }
+}
+// 串流樣本：只送給訂閱者，且只含其訂閱的欄位。二進位客戶端收 FLAG_STREAM 幀，JSON 客戶端收 stream_sample。
+// 傳送佇列已滿的連線直接略過這一筆，不讓慢連線累積延遲。
+void broadcastStreamSample(const BatteryData &data, uint32_t t_us)
+{
+    TelemetryClient clients[MAX_TELEMETRY_CLIENTS];
+    copyClients(clients);
+
+    Telemetry::Snapshot snap;
+    Telemetry::capture(data, snap);
+    uint8_t frame[Telemetry::MAX_STREAM_FRAME_LEN];
+
+    for (size_t i = 0; i < MAX_TELEMETRY_CLIENTS; i++)
+    {
+        const TelemetryClient &c = clients[i];
+        uint32_t mask = c.stream_mask ? c.stream_mask : (loadTestRunning ? Telemetry::STREAM_FIELDS : 0);
+        if (c.id == 0 || mask == 0)
+            continue;
+        if (!ws.availableForWrite(c.id))
+        {
+            streamNetDrops++;
+            continue;
+        }
+
+        if (c.binary_ver == Telemetry::VERSION)
+        {
+            size_t len = Telemetry::encodeStream(snap, mask, t_us, frame);
+            ws.binary(c.id, frame, len);
+            // 客戶端已合併這些欄位：同步差異基準，之後的 dynamic_data 差異幀才不會漏送
+            DeltaState &st = deltaStates[i];
+            if (st.id == c.id && st.has_base)
+                for (uint8_t f = 0; f < Telemetry::FIELD_COUNT; f++)
+                    if (mask & (1UL << f))
+                        st.last.values[f] = snap.values[f];
+            continue;
+        }
+
+        StaticJsonDocument<512> doc;
+        doc["type"] = "stream_sample";
+        JsonObject obj = doc.createNestedObject("data");
+        obj["t_us"] = t_us;
+        for (uint8_t f = 0; f < Telemetry::FIELD_COUNT; f++)
+        {
+            if (!(mask & (1UL << f)))
+                continue;
+            if (Telemetry::CELL_FIELDS & (1UL << f))
+            {
+                // 電芯一律整組送出，前端才能直接沿用 cell_mv 陣列
+                if (!obj.containsKey("cell_mv"))
+                {
+                    JsonArray cells = obj.createNestedArray("cell_mv");
+                    for (int n = 0; n < 5; n++)
+                        cells.add(data.cell_mv[n]);
+                }
+                continue;
+            }
+            obj[Telemetry::fieldKey(f)] = snap.values[f];
+        }
+        char json[320];
+        size_t len = serializeJson(doc, json, sizeof(json));
+        ws.text(c.id, json, len);
+    }
+}
+
+// 負載測試結果：JSON 給前端，並逐顆電芯寫入日誌
+void sendLoadTestResult()
+{
+    LoadTest::Result r;
+    bmsWorker.loadTestResult(r);
+
+    DynamicJsonDocument doc(1024);
+    doc["type"] = "load_test";
+    doc["samples"] = r.samples;
+    doc["hz"] = r.hz;
+    doc["current_ma"] = r.current_ma;
+    doc["pack_rest_mv"] = r.pack_rest_mv;
+    doc["pack_loaded_mv"] = r.pack_loaded_mv;
+    doc["pack_ir_uohm"] = r.pack_ir_uohm;
+    doc["load_on_us"] = r.load_on_us;
+    doc["load_off_us"] = r.load_off_us;
+    JsonArray cells = doc.createNestedArray("cells");
+    for (uint8_t i = 0; i < r.cell_count; i++)
+    {
+        const LoadTest::CellResult &c = r.cells[i];
+        JsonObject cell = cells.createNestedObject();
+        cell["rest_mv"] = c.rest_mv;
+        cell["loaded_mv"] = c.loaded_mv;
+        cell["sag_mv"] = c.sag_mv;
+        cell["ir_uohm"] = c.ir_uohm;
+        cell["recovery_ms"] = c.recovery_ms;
+
+        char buf[112];
+        snprintf(buf, sizeof(buf), "Load test C%u: %umV -> %umV (sag %umV), IR=%u.%ummOhm, recovery=%dms",
+                 i + 1, c.rest_mv, c.loaded_mv, c.sag_mv, c.ir_uohm / 1000, (c.ir_uohm % 1000) / 100, c.recovery_ms);
+        logToClients(String(buf), LOG_LEVEL_INFO);
+    }
+    String output;
+    serializeJson(doc, output);
+    if (ws.count() > 0)
+        ws.textAll(output);
+}
+
+void sendStreamStats()
+{
+    if (ws.count() == 0)
+        return;
+    BmsStreamStats st = bmsWorker.streamStats();
+    StaticJsonDocument<384> doc;
+    doc["type"] = "stream_stats";
+    doc["active"] = st.active;
+    doc["hz"] = st.hz;
+    doc["achieved_centi_hz"] = st.achieved_centi_hz;
+    doc["samples"] = st.samples;
+    doc["failures"] = st.failures;
+    doc["dropped"] = st.dropped;
+    doc["net_dropped"] = streamNetDrops;
+    doc["missed"] = st.missed;
+    doc["jitter_avg_us"] = st.jitter_avg_us;
+    doc["jitter_max_us"] = st.jitter_max_us;
+    String output;
+    serializeJson(doc, output);
     ws.textAll(output);
 }
+
 // 封裝 WebSocket 通知邏輯
 
 void notifyClients()
 {
 
-    // 這裡調用您原有的 sendJsonResponse
     // 第二個參數傳入緩存的 cached_data
-    sendJsonResponse("dynamic_data", cached_data, nullptr);
+    broadcastDynamic(cached_data);
 }
 
 // --- CSV 檔案處理函數 ---
-void manageLogLimit() {
-    if (!SPIFFS.exists(LOG_PATH)) return;
+// 寫入一筆 MCU 紀錄：先放入 RAM 暫存區，由 DataLog 依筆數/時間成組提交到環形紀錄檔
+void appendToLog(const BatteryData &data, const String &ts) {
+    if (otaInProgress)
+        return;
+    if (!dataLog.append(data, parseLogTime(ts.c_str()))) {
+        Serial.println("[LOG] Failed to write log record");
+        return;
+    }
+    Serial.printf("[LOG] Record #%u staged (%u pending)\n", dataLog.lastStagedSeq(), dataLog.pending());
+}
 
-    File f = SPIFFS.open(LOG_PATH, "r");
-    if (!f) return;
+// 記錄一筆動態樣本：更新多解析度統計，並寫入壓縮時間序列紀錄 (只在 RAM 中編碼，區塊寫滿或逾時才寫入 flash)
+void recordDynamicSample(const BatteryData &data, uint32_t t_ms) {
+    SeriesCodec::Sample sample;
+    makeSeriesSample(data, t_ms, sample);
+    rollups.add(data.rom_id, sample);
 
-    // 簡單檢查：如果檔案太小，就不需要花時間算行數 (假設每行約 200 bytes, 800行約 160KB)
-    if (f.size() < (MAX_LOG_LINES * 100)) {
-        f.close();
+    if (otaInProgress)
         return;
+    if (!seriesLog.append(data, t_ms, clientTimeAnchor, clientTimeAnchorMs))
+        Serial.println("[LOG] Failed to append series sample");
+}
+
+// --- 電池群統計 JSON (/api/fleet) ---
+// 分布：{"edges":[區間下限...],"counts":[...]}
+static void appendHistogram(String &json, const char *key, const uint16_t *edges, const uint16_t *counts, uint8_t n)
+{
+    char item[16];
+    json += "\"";
+    json += key;
+    json += "\":{\"edges\":[";
+    for (uint8_t i = 0; i < n; i++) {
+        snprintf(item, sizeof(item), "%s%u", i ? "," : "", edges[i]);
+        json += item;
     }
+    json += "],\"counts\":[";
+    for (uint8_t i = 0; i < n; i++) {
+        snprintf(item, sizeof(item), "%s%u", i ? "," : "", counts[i]);
+        json += item;
+    }
+    json += "]}";
+}
 
-    int lines = 0;
-    while (f.available()) {
-        if (f.read() == '\n') lines++;
+void buildFleetJson(const FleetSummary &sum, String &json)
+{
+    static const uint16_t ERR_EDGES[FLEET_ERR_BUCKETS] = {0, 1, 2, 3, 4};
+    static const char *const ERR_KEYS[4] = {"err_cnt_04", "err_cnt_05", "err_cnt_06", "err_cnt_07"};
+    char item[160], rom[17];
+
+    json.reserve(2048);
+    snprintf(item, sizeof(item), "{\"packs\":%u,\"passed\":%u,\"failed\":%u,\"evicted\":%u,",
+             sum.packs, sum.packs - sum.failed, sum.failed, sum.evicted);
+    json = item;
+    appendHistogram(json, "charge_cycles", FLEET_CYCLE_EDGES, sum.cycles, FLEET_CYCLE_BUCKETS);
+    json += ",";
+    appendHistogram(json, "over_discharge", FLEET_EVENT_EDGES, sum.over_discharge, FLEET_EVENT_BUCKETS);
+    json += ",";
+    appendHistogram(json, "over_load", FLEET_EVENT_EDGES, sum.over_load, FLEET_EVENT_BUCKETS);
+    for (int n = 0; n < 4; n++) {
+        json += ",";
+        appendHistogram(json, ERR_KEYS[n], ERR_EDGES, sum.err_cnt[n], FLEET_ERR_BUCKETS);
     }
-    f.close();
 
-    // 如果超過限制 (保留 header，所以是 MAX + 1)
-    if (lines >= MAX_LOG_LINES) {
-        Serial.println("[LOG] Log full, trimming oldest record...");
-        SPIFFS.rename(LOG_PATH, "/datalog.tmp");
-        File fIn = SPIFFS.open("/datalog.tmp", "r");
-        File fOut = SPIFFS.open(LOG_PATH, "w");
-        
-        if (fIn && fOut) {
-            // 1. 保留標頭
-            String header = fIn.readStringUntil('\n');
-            fOut.println(header);
-            
-            // 2. 丟棄第一筆資料 (最舊的)
-            fIn.readStringUntil('\n');
-            
-            // 3. 複製剩餘資料
-            while (fIn.available()) {
-                fOut.write(fIn.read());
-            }
-        }
-        if (fIn) fIn.close();
-        if (fOut) fOut.close();
-        SPIFFS.remove("/datalog.tmp");
+    // 鎖定狀態 0..3 與其他值、熔斷數量
+    snprintf(item, sizeof(item), ",\"lock_status\":[%u,%u,%u,%u,%u],\"fuse_blown\":%u,",
+             sum.lock_status[0], sum.lock_status[1], sum.lock_status[2], sum.lock_status[3], sum.lock_status[4],
+             sum.fuse_blown);
+    json += item;
+    appendHistogram(json, "cell_imbalance_mv", FLEET_IMBALANCE_EDGES, sum.imbalance, FLEET_IMBALANCE_BUCKETS);
+    formatRomId(sum.worst_rom, rom);
+    snprintf(item, sizeof(item), ",\"worst_imbalance\":{\"mv\":%u,\"rom\":\"%s\",\"model\":\"%.16s\"},\"models\":[",
+             sum.worst_diff_mv, sum.worst_diff_mv ? rom : "", sum.worst_model);
+    json += item;
+    for (uint8_t i = 0; i < sum.models; i++) {
+        const FleetModelStat &m = sum.model[i];
+        snprintf(item, sizeof(item), "%s{\"model\":\"%.16s\",\"packs\":%u,\"failed\":%u}",
+                 i ? "," : "", m.model, m.packs, m.failed);
+        json += item;
     }
+    snprintf(item, sizeof(item), "],\"other_models\":{\"packs\":%u,\"failed\":%u}}",
+             sum.other_models.packs, sum.other_models.failed);
+    json += item;
+}
+
+// 單顆電池的最近狀態
+void buildFleetEntryJson(const FleetEntry &e, String &json)
+{
+    char item[320], rom[17], ts[20];
+    formatRomId(e.rom_id, rom);
+    formatLogTime(e.last_time, ts);
+    snprintf(item, sizeof(item),
+             "{\"rom\":\"%s\",\"model\":\"%.16s\",\"last\":\"%s\",\"reads\":%u,\"charge_cycles\":%u,"
+             "\"over_discharge\":%u,\"over_load\":%u,\"err_cnt\":[%u,%u,%u,%u],\"lock_status\":%u,\"fuse_blown\":%u,"
+             "\"worst_imbalance_mv\":%u,\"anomalies\":%u,\"pass\":%s}",
+             rom, e.model, ts, e.reads, e.charge_cycles, e.over_discharge, e.over_load,
+             e.err_cnt[0], e.err_cnt[1], e.err_cnt[2], e.err_cnt[3], e.lock_status, e.fuse_blown,
+             e.worst_diff_mv, e.flags, FleetStats::failed(e) ? "false" : "true");
+    json = item;
 }
 
-void appendToLog(const BatteryData &data, String ts) {
-    // 1. 先檢查並處理容量限制
-    manageLogLimit();
-
-    // 修正：在開啟檔案前先檢查是否存在，確保標頭寫入邏輯正確
-    bool isNewFile = !SPIFFS.exists(LOG_PATH);
-
-    File f = SPIFFS.open(LOG_PATH, "a");
-    if (!f) return;
-
-    // 2. 如果是新檔案 (或空檔案)，寫入標頭
-    if (isNewFile || f.size() == 0) {
-        Serial.println("[LOG] Writing CSV Header...");
-        const uint8_t BOM[] = {0xEF, 0xBB, 0xBF}; // 加入 UTF-8 BOM 解決 Excel 中文亂碼
-        f.write(BOM, 3);
-        f.println("Timestamp,Model,Serial,ROM ID,Capacity,Prod_Date,Pack Voltage,Cell 1,Cell 2,Cell 3,Cell 4,Cell 5,Cell Diff,Temp 1,Temp 2,Temp 3,Status Code,Lock Status,Charge Cycles,Over Discharge,Over Load,Err 04,Err 05,Err 06,Err 07,Fuse Blown,SOH (%)");
-    }
-
-    // 3. 計算 SOH (複製 JS 邏輯)
-    float soh = 100.0;
-    soh -= data.charge_cycles * 0.05;
-    soh -= data.over_discharge * 0.1;
-    soh -= data.over_load * 0.1;
-    soh -= (data.err_cnt_04 + data.err_cnt_05 + data.err_cnt_06 + data.err_cnt_07) * 20.0;
-    if (soh < 0) soh = 0;
-
-    // 4. 寫入資料
-    f.printf("\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f,%.1f,\"%s\",%d,%d,%d,%d,%d,%d,%d,%d,%d,%.0f\n",
-        ts.c_str(), data.model.c_str(), data.serial.c_str(), data.rom_id.c_str(), data.capacity.c_str(), data.prod_date.c_str(),
-        data.pack_voltage, data.cell_voltages[0], data.cell_voltages[1], data.cell_voltages[2], data.cell_voltages[3], data.cell_voltages[4], data.cell_diff,
-        data.temp1, data.temp2, data.temp3, data.status_code_hex.c_str(), data.lock_status, data.charge_cycles, data.over_discharge, data.over_load,
-        data.err_cnt_04, data.err_cnt_05, data.err_cnt_06, data.err_cnt_07, data.fuse_blown, soh);
-    f.close();
-    Serial.println("[LOG] Data saved to SPIFFS.");
+// 紀錄寫入效能比較 (log_benchmark 指令)，以目前快取的數據為內容
+void runPendingLogBenchmark(uint16_t n)
+{
+    LogBenchResult ring, legacy;
+    Serial.printf("[LOG] Benchmark: %u appends, ring log vs legacy CSV (%u lines)...\n", n, LOG_CAPACITY);
+    runLogBenchmark(SPIFFS, cached_data, n, LOG_CAPACITY, ring, legacy);
+    Serial.printf("[LOG] ring:   avg=%uus max=%uus written=%uB read=%uB per sample\n",
+                  ring.avg_us, ring.max_us, ring.bytes_written, ring.bytes_read);
+    Serial.printf("[LOG] legacy: avg=%uus max=%uus written=%uB read=%uB per sample\n",
+                  legacy.avg_us, legacy.max_us, legacy.bytes_written, legacy.bytes_read);
+    SeriesBenchResult series;
+    runSeriesBenchmark(cached_data, SERIES_BENCH_SAMPLES, series);
+    Serial.printf("[LOG] series: %u samples in %u blocks, %u.%02u B/sample (record %uB), encode=%uns decode=%u/s mismatches=%u\n",
+                  series.samples, series.blocks, series.bytes / series.samples, series.bytes * 100 / series.samples % 100,
+                  (unsigned)sizeof(LogRecord), series.encode_ns, series.decode_per_sec, series.mismatches);
+
+    if (ws.count() == 0)
+        return;
+    DynamicJsonDocument doc(768);
+    doc["type"] = "log_benchmark";
+    doc["samples"] = n;
+    const LogBenchResult *results[] = {&ring, &legacy};
+    const char *names[] = {"ring", "legacy"};
+    for (int i = 0; i < 2; i++)
+    {
+        JsonObject o = doc.createNestedObject(names[i]);
+        o["avg_us"] = results[i]->avg_us;
+        o["max_us"] = results[i]->max_us;
+        o["bytes_written"] = results[i]->bytes_written;
+        o["bytes_read"] = results[i]->bytes_read;
+    }
+    JsonObject o = doc.createNestedObject("series");
+    o["samples"] = series.samples;
+    o["bytes"] = series.bytes;
+    o["record_bytes"] = sizeof(LogRecord);
+    o["encode_ns"] = series.encode_ns;
+    o["decode_per_sec"] = series.decode_per_sec;
+    o["mismatches"] = series.mismatches;
+    String output;
+    serializeJson(doc, output);
+    ws.textAll(output);
 }
 
 // 優化 修正後的 WebSocket 事件處理
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len)
+void handleWebSocketMessage(AsyncWebSocketClient *client, void *arg, uint8_t *data, size_t len)
 {
     AwsFrameInfo *info = (AwsFrameInfo *)arg;
     if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT)
@@ -224,37 +704,111 @@ void handleWebSocketMessage(void *arg, uint8_t *data, size_t len)
         // 擷取時間戳記 (如果有的話)
         if (doc.containsKey("timestamp")) {
             currentClientTime = doc["timestamp"].as<String>();
+            uint32_t t = parseLogTime(currentClientTime.c_str());
+            if (t != 0) {
+                clientTimeAnchor = t;
+                clientTimeAnchorMs = millis();
+            }
         }
         // 修正：若指令沒帶時間，保留舊值，避免變成 N/A
 
+        // 此處運行於 AsyncTCP 回呼：只投遞指令給 BMS 工作任務，不直接操作匯流排
+        bool queued = true;
         if (cmd == "read_static")
         {
-            shouldReadStatic = true;
-            Serial.println("[DEBUG] 已標記 shouldReadStatic = true");
+            queued = bmsWorker.post(BMS_CMD_READ_STATIC);
+            Serial.println("[DEBUG] 已投遞 BMS_CMD_READ_STATIC");
         }
         else if (cmd == "read_dynamic")
         {
-            shouldUpdateData = true;
-            Serial.println("[DEBUG] 已標記 shouldUpdateData = true");
+            // 多個客戶端同時請求時併入同一次匯流排讀取；結果以 textAll 廣播給所有人
+            // 可選參數 max_age_ms：快取不超過此年齡時直接回覆快取
+            uint32_t maxAge = doc["max_age_ms"] | 0;
+            BmsRequestOutcome outcome = bmsWorker.requestDynamic(maxAge);
+            queued = (outcome != BMS_REQ_BUSY);
+            Serial.printf("[DEBUG] read_dynamic -> %s\n",
+                          outcome == BMS_REQ_QUEUED ? "queued" : outcome == BMS_REQ_COALESCED ? "coalesced" : outcome == BMS_REQ_CACHED ? "cached" : "busy");
         }
         else if (cmd == "clear_errors")
         {
-            shouldClearErrors = true;
-            Serial.println("[DEBUG] 已標記 shouldClearErrors = true");
+            queued = bmsWorker.post(BMS_CMD_CLEAR_ERRORS);
+            Serial.println("[DEBUG] 已投遞 BMS_CMD_CLEAR_ERRORS");
         }
         else if (cmd == "led_on")
         {
-            // 修正：不直接發送舊數據，而是觸發一次數據更新
-            bms.ledTest(true);
-            skipMcuCsvLog = true; // 標記下一次更新跳過紀錄
-            shouldUpdateData = true;
+            // 修正：不直接發送舊數據，而是觸發一次數據更新 (該次更新跳過 CSV 紀錄)
+            queued = bmsWorker.post(BMS_CMD_LED_ON, true);
         }
         else if (cmd == "led_off")
         {
-            // 修正：不直接發送舊數據，而是觸發一次數據更新
-            bms.ledTest(false);
-            skipMcuCsvLog = true; // 標記下一次更新跳過紀錄
-            shouldUpdateData = true;
+            // 修正：不直接發送舊數據，而是觸發一次數據更新 (該次更新跳過 CSV 紀錄)
+            queued = bmsWorker.post(BMS_CMD_LED_OFF, true);
+        }
+        else if (cmd == "calibrate_timing")
+        {
+            // 需先讀取資訊識別電池；結果以 ROM ID 保存，下次插入同一顆電池時自動套用
+            queued = bmsWorker.post(BMS_CMD_CALIBRATE_TIMING);
+        }
+        else if (cmd == "reset_timing")
+        {
+            queued = bmsWorker.post(BMS_CMD_RESET_TIMING);
+        }
+        else if (cmd == "stream_start")
+        {
+            // {"command":"stream_start","hz":5,"fields":["pack_mv","cell_mv",...]}
+            // 取樣率由最後一個請求決定；fields 省略時訂閱 0xD7 幀的全部欄位
+            uint16_t hz = doc["hz"] | STREAM_DEFAULT_HZ;
+            uint32_t mask = 0;
+            JsonArray fields = doc["fields"];
+            for (JsonVariant f : fields)
+                mask |= Telemetry::maskForKey(f.as<const char *>());
+            mask = fields.isNull() ? Telemetry::STREAM_FIELDS : (mask & Telemetry::STREAM_FIELDS);
+            if (mask == 0)
+            {
+                sendFeedback("error", "No streamable fields");
+                return;
+            }
+            setStreamMask(client->id(), mask);
+            queued = bmsWorker.startStream(hz);
+        }
+        else if (cmd == "stream_stop")
+        {
+            // 最後一個訂閱者離開時才真正停止取樣
+            if (setStreamMask(client->id(), 0) == 0)
+                queued = bmsWorker.stopStream();
+        }
+        else if (cmd == "load_test")
+        {
+            // {"command":"load_test","load_mohm":500} 或 {"current_ma":10000}，另可指定 rest_ms/load_ms/recover_ms/hz
+            LoadTest::Config cfg;
+            cfg.rest_ms = doc["rest_ms"] | cfg.rest_ms;
+            cfg.load_ms = doc["load_ms"] | cfg.load_ms;
+            cfg.recover_ms = doc["recover_ms"] | cfg.recover_ms;
+            cfg.hz = doc["hz"] | cfg.hz;
+            cfg.current_ma = doc["current_ma"] | 0;
+            cfg.load_mohm = doc["load_mohm"] | 0;
+            if (cfg.current_ma == 0 && cfg.load_mohm == 0)
+            {
+                sendFeedback("error", "load_mohm or current_ma required");
+                return;
+            }
+            queued = bmsWorker.startLoadTest(cfg);
+            loadTestRunning = queued;
+        }
+        else if (cmd == "hello")
+        {
+            // 格式協商：客戶端支援的二進位遙測版本與伺服器相同時才啟用
+            uint8_t wanted = doc["binary"] | 0;
+            uint8_t accepted = (wanted == Telemetry::VERSION) ? wanted : 0;
+            registerClient(client->id(), accepted);
+            char reply[40];
+            snprintf(reply, sizeof(reply), "{\"type\":\"hello\",\"binary\":%u}", accepted);
+            client->text(reply, strlen(reply));
+        }
+        else if (cmd == "log_benchmark")
+        {
+            // 會暫時佔用約數秒的快閃記憶體頻寬，於 loop 中執行
+            pendingLogBenchmark = constrain((int)(doc["n"] | 20), 1, 200);
         }
         else if (cmd == "ping")
         {
@@ -265,10 +819,28 @@ void handleWebSocketMessage(void *arg, uint8_t *data, size_t len)
         else if (cmd == "get_fs_info")
         {
             if (ws.count() > 0) {
-                DynamicJsonDocument doc(256);
+                DynamicJsonDocument doc(512);
                 doc["type"] = "fs_info";
                 doc["total"] = SPIFFS.totalBytes();
                 doc["used"] = SPIFFS.usedBytes();
+                HeapStats heap = readHeapStats();
+                doc["heap_free"] = heap.free_bytes;
+                doc["heap_min"] = heap.min_free_bytes;
+                doc["heap_max_block"] = heap.max_block;
+                doc["heap_frag"] = heap.frag_pct;
+                doc["log_records"] = dataLog.count();
+                doc["log_capacity"] = dataLog.capacity();
+                const DataLogStats &logStats = dataLog.stats();
+                doc["log_append_avg_us"] = logStats.appends ? (uint32_t)(logStats.total_append_us / logStats.appends) : 0;
+                doc["log_append_max_us"] = logStats.max_append_us;
+                doc["log_pending"] = dataLog.pending();
+                doc["log_commit_avg_us"] = logStats.commits ? (uint32_t)(logStats.total_commit_us / logStats.commits) : 0;
+                doc["log_commit_max_us"] = logStats.max_commit_us;
+                doc["series_samples"] = seriesLog.samples();
+                doc["series_bytes"] = seriesLog.encodedBytes();
+                doc["series_blocks"] = seriesLog.usedBlocks();
+                doc["series_capacity"] = seriesLog.blocks();
+                doc["fleet_packs"] = fleetStats.count();
                 String output;
                 serializeJson(doc, output);
                 ws.textAll(output);
@@ -278,6 +850,11 @@ void handleWebSocketMessage(void *arg, uint8_t *data, size_t len)
         {
             Serial.println("[WARNING] 指令欄位匹配失敗！");
         }
+
+        if (!queued)
+        {
+            sendFeedback("error", "BMS busy");
+        }
     }
 }
 
@@ -410,9 +987,16 @@ void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsE
     {
     case WS_EVT_CONNECT:
         Serial.printf("WebSocket client #%u connected\n", client->id());
+        registerClient(client->id(), 0); // 協商前一律使用 JSON
+        break;
+    case WS_EVT_DISCONNECT:
+        // 最後一個訂閱者斷線時停止串流，讓電池斷電
+        if (setStreamMask(client->id(), 0) == 0 && bmsWorker.streamStats().active)
+            bmsWorker.stopStream();
+        unregisterClient(client->id());
         break;
     case WS_EVT_DATA:
-        handleWebSocketMessage(arg, data, len);
+        handleWebSocketMessage(client, arg, data, len);
         break;
     default:
         break;
@@ -455,7 +1039,7 @@ void setup()
 
     // --- 新增：開機時詢問是否開啟雙重驗證 ---
     Serial.println("\n\n--- Boot Configuration ---");
-    Serial.println("Enable Double-Read Verification? (Input 'Y' for Yes, 'N' for No)");
+    Serial.println("Enable Majority-Vote Read Verification (3 reads)? (Input 'Y' for Yes, 'N' for No)");
     Serial.println("Waiting 3 seconds... (Default: No)");
     
     unsigned long startWait = millis();
@@ -465,12 +1049,12 @@ void setup()
             char c = Serial.read();
             if(c == 'Y' || c == 'y') {
                 enableVerifiedRead = true;
-                Serial.println("[Config] Double-Read Verification: ENABLED");
+                Serial.println("[Config] Majority-Vote Verification: ENABLED");
                 inputReceived = true;
                 break;
             } else if (c == 'N' || c == 'n') {
                 enableVerifiedRead = false;
-                Serial.println("[Config] Double-Read Verification: DISABLED");
+                Serial.println("[Config] Majority-Vote Verification: DISABLED");
                 inputReceived = true;
                 break;
             } else if (c == '\r' || c == '\n') {
@@ -488,7 +1072,7 @@ void setup()
     }
     
     // 將設定傳遞給 BMS 物件
-    bms.setVerifyReads(enableVerifiedRead);
+    bmsWorker.bms().setVerifyReads(enableVerifiedRead);
  
     Serial.println("\nStarting Makita BMS Tool...");
 
@@ -498,8 +1082,35 @@ void setup()
         return;
     }
     Serial.println("SPIFFS mounted successfully.");
-
-    bms.setLogCallback(logToClients);
+    // 舊版逐行改寫的 /datalog.csv 會被靜態檔案處理器搶先送出 (蓋過環形紀錄的下載)：改名保留
+    if (SPIFFS.exists("/datalog.csv")) {
+        SPIFFS.remove(LEGACY_LOG_PATH);
+        if (SPIFFS.rename("/datalog.csv", LEGACY_LOG_PATH))
+            Serial.printf("[LOG] Legacy CSV moved to %s\n", LEGACY_LOG_PATH);
+        else
+            SPIFFS.remove("/datalog.csv");
+    }
+    if (!logIndex.begin(SPIFFS))
+        Serial.println("[LOG] Battery index missing or invalid, rebuilding from log");
+    dataLog.setIndex(&logIndex);
+    dataLog.setCommitPolicy(LOG_GROUP_SIZE, LOG_COMMIT_MAX_DELAY_MS);
+    if (dataLog.begin(SPIFFS, LOG_CAPACITY))
+        Serial.printf("[LOG] Ring log: %u/%u records, %u batteries indexed\n", dataLog.count(), dataLog.capacity(), logIndex.count());
+    else
+        Serial.println("[LOG] Failed to open ring log");
+    seriesLog.setCommitDelay(LOG_COMMIT_MAX_DELAY_MS);
+    if (seriesLog.begin(SPIFFS, SERIES_BLOCKS))
+        Serial.printf("[LOG] Series log: %u samples in %u/%u blocks\n", seriesLog.samples(), seriesLog.usedBlocks(), seriesLog.blocks());
+    else
+        Serial.println("[LOG] Failed to open series log");
+    if (!fleetStats.begin(SPIFFS))
+        Serial.println("[LOG] Fleet stats missing or invalid, starting empty");
+    Serial.printf("[LOG] Fleet stats: %u batteries\n", fleetStats.count());
+
+    if (!bmsWorker.begin())
+    {
+        Serial.println("Failed to start BMS worker task");
+    }
 
     WiFi.softAP(ssid); // 設定 WiFi.softAP(ssid, password); 
     Serial.print("Access Point '");
@@ -510,32 +1121,192 @@ void setup()
     ws.onEvent(onWebSocketEvent);
     server.addHandler(&ws);
 
-    server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
-    
     // 修正：強制下載 CSV 檔案並指定編碼，解決直接開啟與亂碼問題
+    // 紀錄以二進位存放，下載時逐段轉成 CSV 以分塊回應送出 (不落地暫存檔，RAM 用量與紀錄筆數無關)
+    // 可選篩選：?from=YYYY-MM-DD[ HH:mm:ss]&to=...&rom=<ROM ID 或序號>
     server.on("/datalog.csv", HTTP_GET, [](AsyncWebServerRequest *request) {
-        if (SPIFFS.exists(LOG_PATH)) {
-            AsyncWebServerResponse *response = request->beginResponse(SPIFFS, LOG_PATH, "text/csv; charset=utf-8");
-            response->addHeader("Content-Disposition", "attachment; filename=\"datalog.csv\"");
-            request->send(response);
-        } else {
+        if (dataLog.count() == 0) {
             request->send(404, "text/plain", "Log file not found");
+            return;
+        }
+        LogFilter filter;
+        bool valid = true;
+        if (request->hasParam("from"))
+            valid &= parseLogTimeArg(request->getParam("from")->value().c_str(), false, filter.from);
+        if (request->hasParam("to"))
+            valid &= parseLogTimeArg(request->getParam("to")->value().c_str(), true, filter.to);
+        if (request->hasParam("rom"))
+            valid &= parseRomArg(request->getParam("rom")->value().c_str(), filter.rom);
+        if (!valid) {
+            request->send(400, "text/plain", "Invalid filter");
+            return;
         }
+
+        std::shared_ptr<LogCsvStream> stream = std::make_shared<LogCsvStream>(dataLog, filter);
+        AsyncWebServerResponse *response = request->beginChunkedResponse("text/csv; charset=utf-8",
+            [stream](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+                return stream->read(buf, maxLen);
+            });
+        response->addHeader("Content-Disposition", "attachment; filename=\"datalog.csv\"");
+        request->send(response);
     });
     
+    // 壓縮時間序列紀錄 (每筆動態讀取與連續取樣)，解碼成 CSV 以分塊回應送出
+    server.on("/series.csv", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (seriesLog.usedBlocks() == 0) {
+            request->send(404, "text/plain", "Log file not found");
+            return;
+        }
+        std::shared_ptr<SeriesCsvStream> stream = std::make_shared<SeriesCsvStream>(seriesLog);
+        AsyncWebServerResponse *response = request->beginChunkedResponse("text/csv; charset=utf-8",
+            [stream](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+                return stream->read(buf, maxLen);
+            });
+        response->addHeader("Content-Disposition", "attachment; filename=\"series.csv\"");
+        request->send(response);
+    });
+
+    // 多解析度統計：?tier=1s|1m|15m 或 ?span=<毫秒> (自動選擇能涵蓋該跨度的最細層級)，
+    // 可選 ?from=&to= (裝置 millis() 時基；回應中的 now_ms 供前端換算成實際時間)
+    server.on("/api/rollup", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint8_t tier = 1;
+        if (request->hasParam("tier"))
+            tier = RollupStore::tierByName(request->getParam("tier")->value().c_str());
+        else if (request->hasParam("span"))
+            tier = RollupStore::tierForSpan(strtoul(request->getParam("span")->value().c_str(), nullptr, 10));
+        if (tier >= ROLLUP_TIERS) {
+            request->send(400, "text/plain", "Invalid tier");
+            return;
+        }
+        uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), nullptr, 10) : 0;
+        uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), nullptr, 10) : 0xFFFFFFFF;
+
+        std::shared_ptr<RollupJsonStream> stream = std::make_shared<RollupJsonStream>(rollups, tier, from, to);
+        AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+            [stream](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+                return stream->read(buf, maxLen);
+            });
+        request->send(response);
+    });
+
+    // 單顆電池的歷史紀錄：?rom=<完整 ROM ID> 以二分搜尋查目錄，或 ?rom=ID-xxxxxx (序號後綴)；
+    // 只讀取槽位雜湊相符的紀錄並以 CSV 分塊送出。不帶參數時回傳目錄 (JSON)
+    server.on("/api/history", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char ts[20], first[20], rom[17];
+        if (!request->hasParam("rom")) {
+            String json = "[";
+            char item[160];
+            LogIndexEntry e;
+            for (uint16_t i = 0; logIndex.entry(i, e); i++) {
+                formatRomId(e.rom_id, rom);
+                formatLogTime(e.first_time, first);
+                formatLogTime(e.last_time, ts);
+                snprintf(item, sizeof(item), "%s{\"rom\":\"%s\",\"model\":\"%s\",\"first\":\"%s\",\"last\":\"%s\",\"records\":%u}",
+                         i ? "," : "", rom, e.model, first, ts, e.records);
+                json += item;
+            }
+            json += "]";
+            request->send(200, "application/json", json);
+            return;
+        }
+
+        LogFilter filter;
+        if (!parseRomArg(request->getParam("rom")->value().c_str(), filter.rom) || filter.rom[0] == '\0') {
+            request->send(400, "text/plain", "Invalid rom");
+            return;
+        }
+        LogIndexEntry entry;
+        bool found, ambiguous = false;
+        if (strlen(filter.rom) == 16) {
+            uint8_t rom_id[8];
+            for (int i = 0; i < 8; i++) {
+                char byte[3] = {filter.rom[i * 2], filter.rom[i * 2 + 1], '\0'};
+                rom_id[i] = (uint8_t)strtoul(byte, nullptr, 16);
+            }
+            found = logIndex.find(rom_id, entry);
+        } else {
+            found = logIndex.findSuffix(filter.rom, entry, ambiguous);
+        }
+        if (ambiguous) {
+            request->send(409, "text/plain", "Ambiguous rom, use the full ROM ID");
+            return;
+        }
+        if (!found) {
+            request->send(404, "text/plain", "Battery not found");
+            return;
+        }
+        formatRomId(entry.rom_id, filter.rom); // 後綴查詢改以完整 ROM ID 篩選 (啟用槽位雜湊)
+        formatLogTime(entry.first_time, first);
+        formatLogTime(entry.last_time, ts);
+        uint32_t records = entry.records;
+
+        std::shared_ptr<LogCsvStream> stream = std::make_shared<LogCsvStream>(dataLog, filter);
+        AsyncWebServerResponse *response = request->beginChunkedResponse("text/csv; charset=utf-8",
+            [stream](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+                return stream->read(buf, maxLen);
+            });
+        char disposition[64];
+        snprintf(disposition, sizeof(disposition), "attachment; filename=\"history_%s.csv\"", filter.rom);
+        response->addHeader("Content-Disposition", disposition);
+        response->addHeader("X-Battery-First-Seen", first);
+        response->addHeader("X-Battery-Last-Seen", ts);
+        response->addHeader("X-Battery-Records", String(records));
+        request->send(response);
+    });
+
+    // 所有讀取過的電池的統計 (隨每次讀取更新，不掃描紀錄檔)；?rom=<ROM ID 或 ID-xxxxxx> 查詢單顆電池
+    server.on("/api/fleet", HTTP_GET, [](AsyncWebServerRequest *request) {
+        String json;
+        if (!request->hasParam("rom")) {
+            FleetSummary sum;
+            fleetStats.summary(sum);
+            buildFleetJson(sum, json);
+            request->send(200, "application/json", json);
+            return;
+        }
+
+        char hex[17];
+        if (!parseRomArg(request->getParam("rom")->value().c_str(), hex) || hex[0] == '\0') {
+            request->send(400, "text/plain", "Invalid rom");
+            return;
+        }
+        FleetEntry entry;
+        bool found, ambiguous = false;
+        if (strlen(hex) == 16) {
+            uint8_t rom_id[8];
+            for (int i = 0; i < 8; i++) {
+                char byte[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+                rom_id[i] = (uint8_t)strtoul(byte, nullptr, 16);
+            }
+            found = fleetStats.find(rom_id, entry);
+        } else {
+            found = fleetStats.findSuffix(hex, entry, ambiguous);
+        }
+        if (ambiguous) {
+            request->send(409, "text/plain", "Ambiguous rom, use the full ROM ID");
+            return;
+        }
+        if (!found) {
+            request->send(404, "text/plain", "Battery not found");
+            return;
+        }
+        buildFleetEntryJson(entry, json);
+        request->send(200, "application/json", json);
+    });
+
     // 新增：刪除 CSV 檔案的 API
     server.on("/api/delete_log", HTTP_GET, [](AsyncWebServerRequest *request) {
-        SPIFFS.remove(LOG_PATH);
+        pendingLogClear = true;
         request->send(200, "text/plain", "Log deleted");
         Serial.println("[LOG] Log file deleted by user.");
     });
 
-    dnsServer.start(53, "*", WiFi.softAPIP());
-    server.addHandler(new CaptiveRequestHandler());
-
-    server.begin();
-
-    Serial.println("HTTP server with WebSocket is ready.");
+    // 清除電池群統計 (/api/delete_log 只刪紀錄檔，不影響此統計)
+    server.on("/api/fleet_clear", HTTP_GET, [](AsyncWebServerRequest *request) {
+        pendingFleetClear = true;
+        request->send(200, "text/plain", "Fleet stats cleared");
+        Serial.println("[FLEET] Fleet stats cleared by user.");
+    });
 
     // --- 新增：自動掃描語言包 API ---
     // 前端呼叫此 API 時，會回傳 SPIFFS 中所有 "lang_*.json" 的檔案列表
@@ -568,19 +1339,26 @@ void setup()
     server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
         // 上傳完成後的回應
         bool shouldReboot = !Update.hasError();
+        if (!shouldReboot)
+            otaInProgress = false; // 更新失敗：恢復寫入紀錄
         AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", shouldReboot ? "OK" : "FAIL");
         response->addHeader("Connection", "close");
         request->send(response);
-        if (shouldReboot) {
-            delay(100);
-            ESP.restart();
-        }
+        // 不在 AsyncTCP 回呼中等待：重新開機交給 loop (先提交紀錄，再留時間送出回應)
+        if (shouldReboot)
+            pendingRestartMs = millis() | 1;
     }, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
         // 處理上傳過程
+        otaLastChunkMs = millis();
         if (!index) {
             Serial.printf("Update Start: %s\n", filename.c_str());
             // 如果檔名是 spiffs.bin 則更新檔案系統，否則更新韌體
             int cmd = (filename == "spiffs.bin") ? U_SPIFFS : U_FLASH;
+            // 之後停止寫入紀錄。韌體更新時由 loop 把暫存的紀錄寫入 flash (不在此等待)；
+            // 檔案系統映像會被整個覆蓋，不再寫檔，以免與新映像同時寫入同一個分割區
+            otaInProgress = true;
+            if (cmd == U_FLASH)
+                pendingLogCommit = true;
             if (!Update.begin(UPDATE_SIZE_UNKNOWN, cmd)) {
                 Update.printError(Serial);
             }
@@ -596,6 +1374,16 @@ void setup()
             }
         }
     });
+
+    // 靜態檔案最後註冊：處理器依註冊順序比對，SPIFFS 上的同名檔案不會蓋過上面的動態路由
+    server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
+
+    dnsServer.start(53, "*", WiFi.softAPIP());
+    server.addHandler(new CaptiveRequestHandler());
+
+    server.begin();
+
+    Serial.println("HTTP server with WebSocket is ready.");
 }
 
 // 優化前
@@ -606,116 +1394,224 @@ void loop()
 }
     */
 
-// 優化後
-void loop()
+// 處理 BMS 工作任務回傳的結果 (於 loop 內執行，負責所有網路與檔案輸出)
+void handleBmsResult(const BmsResult &res)
 {
-    // 1. 核心網路任務
-    dnsServer.processNextRequest();
-    ws.cleanupClients();
-
-    // 2. 處理「1. 讀取資訊」(靜態)
-    if (shouldReadStatic)
+    if (res.type == BMS_RESULT_LOG)
     {
-        shouldReadStatic = false;
-        Serial.println("[COM3] >>> 開始執行 readStaticData...");
-
-        SupportedFeatures features;
-        // 這裡建議統一使用 cached_data，除非您有特殊用途
-        String res = bms.readStaticData(cached_data, features);
-
-        if (res.indexOf("OK") != -1) // 檢查是否成功
+        logToClients(res.message, res.log_level);
+        return;
+    }
+    if (res.type == BMS_CMD_STREAM_START || res.type == BMS_CMD_STREAM_STOP)
+    {
+        if (res.type == BMS_CMD_STREAM_START)
+            streamNetDrops = 0;
+        if (!res.ok)
         {
-            delay(20);
-            sendJsonResponse("static_data", cached_data, &features);
-            sendFeedback("success", "log_static_success"); // 發送成功提示 (Key)
-            Serial.println("[COM3] <<< 靜態資訊推送完成");
+            clearStreamMasks(); // 連續讀取失敗而自動停止
+            sendFeedback("error", res.message);
         }
-        else
+        lastUpdateTick = millis();
+        sendStreamStats();
+        return;
+    }
+    if (res.type == BMS_CMD_LOAD_TEST)
+    {
+        loadTestRunning = false;
+        if (!res.ok)
         {
-            sendFeedback("error", res); // 發送錯誤提示
+            sendFeedback("error", res.message);
+            return;
         }
+        sendLoadTestResult();
+        sendFeedback("success", "log_load_test_success");
+        return;
     }
 
-    // 3. 處理「2. 更新數據」(動態)
-    if (shouldUpdateData)
+    if (!res.ok)
     {
-        shouldUpdateData = false;
-        Serial.println("[COM3] >>> 開始執行 readDynamicData...");
+        sendFeedback("error", res.message);
+        return;
+    }
 
-        String err = "";
-        // 1. 讀取電壓、溫度、循環次數 (33h 指令)
-        String res = bms.readDynamicData(cached_data);
-        if (res != "") err = res;
+    if (res.type == BMS_CMD_READ_STATIC)
+    {
+        bmsWorker.snapshot(cached_data, &cached_features);
+        analytics.apply(cached_data);
+        fleetStats.update(cached_data, parseLogTime(currentClientTime.c_str()));
+        sendJsonResponse("static_data", cached_data, &cached_features);
+        forceKeyframes(); // 可能換了一顆電池，差異基準作廢
+        sendFeedback("success", "log_static_success"); // 發送成功提示 (Key)
+        Serial.println("[COM3] <<< 靜態資訊推送完成");
+        return;
+    }
 
-        // 2. 【關鍵！】讀取進階診斷：錯誤 04, 05, 07 與熔絲 (11h/EEPROM 指令)
-        // 如果沒有這行，你的前端 mapping ['err04', 'err05'...] 就會拿不到值
-        // 注意：如果 readDynamicData 已經失敗，這裡可能也會失敗，但我們還是嘗試讀取
-        bms.readAdvancedDiagnostics(cached_data);
+    if (res.type == BMS_CMD_CALIBRATE_TIMING)
+    {
+        sendFeedback("info", String("Timing: ") + res.message);
+        sendFeedback("success", "log_calibrate_success");
+        return;
+    }
+    if (res.type == BMS_CMD_RESET_TIMING)
+    {
+        sendFeedback("success", "log_timing_reset");
+        return;
+    }
 
-        // 3. 在 Serial 印出獲取的數據摘要，方便 Debug
-        if (cached_data.cell_voltages[0] > 0.1)
-        {
-            char buf[128]; // 增加緩衝區以容納更多溫度數據
-            // 優化：顯示完整診斷資訊 (Err04-07, Temp, Fuse)
-            // 修正：確保日誌中包含 T1, T2, T3
-            sprintf(buf, "Data OK: V1=%.2fV, T1=%.1fC, T2=%.1fC, T3=%.1fC, OD=%d, OL=%d, Err=[%d,%d,%d,%d], Fuse=%s",
-                cached_data.cell_voltages[0], cached_data.temp1, cached_data.temp2, cached_data.temp3,
-                cached_data.over_discharge, cached_data.over_load,
-                cached_data.err_cnt_04, cached_data.err_cnt_05, cached_data.err_cnt_06, cached_data.err_cnt_07,
-                cached_data.fuse_blown ? "YES" : "NO");
-            logToClients(String(buf), LOG_LEVEL_INFO);
-        }
-        else
-        {
-            Serial.println("[COM3] ⚠️ 數據獲取異常: 電壓為 0，請檢查連接");
-        }
+    bmsWorker.snapshot(cached_data);
+    // 只有新讀到的數據才計入趨勢；快取結果與清除錯誤只重新套用目前的分析結果
+    if (res.from_cache || res.type == BMS_CMD_CLEAR_ERRORS)
+        analytics.apply(cached_data);
+    else
+        analytics.update(cached_data, millis());
+    if (!res.from_cache)
+        fleetStats.update(cached_data, parseLogTime(currentClientTime.c_str()));
 
-        if (err == "")
-        {
-            delay(20);
-            // 修正：將 "dynamic_update" 改為 "dynamic_data" 以匹配 app.js
-            sendJsonResponse("dynamic_data", cached_data, nullptr);
-            sendFeedback("success", "log_dynamic_success"); // 補上成功提示
-            
-            // 新增：讀取成功後，寫入 CSV 到 MCU
-            if (!skipMcuCsvLog) {
-                appendToLog(cached_data, currentClientTime);
-            }
-            skipMcuCsvLog = false; // 無論是否寫入，都重置旗標
+    if (res.type == BMS_CMD_CLEAR_ERRORS)
+    {
+        // 修正：同樣改為 "dynamic_data"
+        broadcastDynamic(cached_data);
+        sendFeedback("success", "log_clear_success"); // 明確告知清除成功 (Key)
+        Serial.println("[COM3] <<< 清除指令完成");
+        return;
+    }
 
-            Serial.println("[COM3] <<< 動態數據推送完成");
-        }
-        else
-        {
-            sendFeedback("error", err);
-        }
+    if (res.coalesced > 0)
+    {
+        BmsWorkerStats st = bmsWorker.stats();
+        Serial.printf("[COM3] 本次讀取合併了 %u 個請求 (累計: 讀取 %u, 合併 %u, 快取 %u)\n",
+                      res.coalesced, st.dynamic_reads, st.coalesced_hits, st.cache_hits);
     }
 
-    // 4. 處理「清除錯誤」
-    if (shouldClearErrors)
+    if (cached_data.confidence.verified)
     {
-        shouldClearErrors = false;
-        Serial.println("[COM3] >>> 執行清除錯誤程序...");
+        BmsWorkerStats st = bmsWorker.stats();
+        if (st.verify.mismatches > 0)
+            Serial.printf("[COM3] 讀取驗證: %u 次多數決, 不一致 %u, 重試 %u, 失敗 %u\n",
+                          st.verify.frames, st.verify.mismatches, st.verify.retries, st.verify.failures);
+    }
 
-        String res = bms.clearErrors();
-        if (res == "")
-        {
-            // 清除後刷新數據
-            bms.readDynamicData(cached_data);
-            // 修正：補上進階數據讀取，確保 temp3 等數據在清除後能被刷新
-            bms.readAdvancedDiagnostics(cached_data);
+    if (!res.from_cache && ++dynamicRefreshCount % HEAP_REPORT_EVERY == 0)
+    {
+        HeapStats heap = readHeapStats();
+        Serial.printf("[HEAP] refresh #%u: free=%u min=%u max_block=%u frag=%u%%\n",
+                      dynamicRefreshCount, heap.free_bytes, heap.min_free_bytes, heap.max_block, heap.frag_pct);
+    }
 
-            delay(20);
-            // 修正：同樣改為 "dynamic_data"
-            sendJsonResponse("dynamic_data", cached_data, nullptr);
-            sendFeedback("success", "log_clear_success"); // 明確告知清除成功 (Key)
-            Serial.println("[COM3] <<< 清除指令完成");
-        }
+    // 在 Serial 印出獲取的數據摘要，方便 Debug
+    if (!res.from_cache && cached_data.cell_mv[0] > 100)
+    {
+        char buf[128]; // 增加緩衝區以容納更多溫度數據
+        // 優化：顯示完整診斷資訊 (Err04-07, Temp, Fuse)
+        // 修正：確保日誌中包含 T1, T2, T3 (整數原始單位：mV、0.01°C)
+        snprintf(buf, sizeof(buf), "Data OK: V1=%umV, T1=%dcC, T2=%dcC, T3=%dcC, OD=%d, OL=%d, Err=[%d,%d,%d,%d], Fuse=%s",
+            cached_data.cell_mv[0], cached_data.temp1_centi, cached_data.temp2_centi, cached_data.temp3_centi,
+            cached_data.over_discharge, cached_data.over_load,
+            cached_data.err_cnt_04, cached_data.err_cnt_05, cached_data.err_cnt_06, cached_data.err_cnt_07,
+            cached_data.fuse_blown ? "YES" : "NO");
+        logToClients(String(buf), LOG_LEVEL_INFO);
+    }
+    else
+    {
+        Serial.println("[COM3] ⚠️ 數據獲取異常: 電壓為 0，請檢查連接");
+    }
+
+    // 修正：將 "dynamic_update" 改為 "dynamic_data" 以匹配 app.js
+    broadcastDynamic(cached_data);
+    sendFeedback("success", "log_dynamic_success"); // 補上成功提示
+
+    // 新增：讀取成功後，寫入 CSV 到 MCU (LED 測試觸發的更新除外)
+    if (!res.skip_log) {
+        appendToLog(cached_data, currentClientTime);
+        recordDynamicSample(cached_data, millis());
+    }
+
+    Serial.println("[COM3] <<< 動態數據推送完成");
+}
+
+// 優化後
+void loop()
+{
+    // 1. 核心網路任務 (匯流排工作已移至 BMS 工作任務，這裡不再被阻塞)
+    dnsServer.processNextRequest();
+    ws.cleanupClients();
+    serviceTelemetryClients(); // 新連線補送 static_data
+
+    // 2. 推送 BMS 工作任務的結果
+    BmsResult res;
+    while (bmsWorker.poll(res))
+    {
+        handleBmsResult(res);
+    }
+
+    // 3. 由 HTTP/WebSocket 回呼排入的紀錄檔維護
+    if (pendingLogClear)
+    {
+        pendingLogClear = false;
+        dataLog.clear();
+        seriesLog.clear();
+        SPIFFS.remove(LEGACY_LOG_PATH); // 開機時改名保留的舊版 CSV 一併刪除
+    }
+    if (pendingFleetClear)
+    {
+        pendingFleetClear = false;
+        fleetStats.clear();
+    }
+    if (pendingLogCommit)
+    {
+        dataLog.commit();
+        dataLog.saveIndex();
+        seriesLog.commit();
+        fleetStats.save();
+        pendingLogCommit = false;
+    }
+    else if (!otaInProgress)
+    {
+        dataLog.commitIfDue();
+        seriesLog.commitIfDue();
+        fleetStats.saveIfDue();
+    }
+    if (pendingRestartMs && millis() - pendingRestartMs >= OTA_RESTART_DELAY_MS)
+    {
+        ESP.restart();
+    }
+    else if (otaInProgress && !pendingRestartMs && millis() - otaLastChunkMs > OTA_STALL_MS)
+    {
+        // 上傳中斷 (連線斷開或逾時)：放棄這次更新並恢復寫入紀錄
+        Serial.println("[OTA] Upload stalled, aborting update");
+        if (Update.isRunning())
+            Update.abort();
+        otaInProgress = false;
+    }
+    if (pendingLogBenchmark > 0)
+    {
+        uint16_t n = pendingLogBenchmark;
+        pendingLogBenchmark = 0;
+        runPendingLogBenchmark(n);
+    }
+
+    // 4. 推送連續取樣樣本 (不寫入 CSV、不送成功提示，只推給訂閱者；數值存入壓縮時間序列紀錄)
+    DynamicSample sample;
+    while (bmsWorker.pollSample(sample))
+    {
+        uint32_t t_ms = millis() - (micros() - sample.t_us) / 1000;
+        applyDynamicSample(sample, cached_data);
+        // 負載測試的樣本不計入靜置壓差的 EWMA (避免負載尖峰觸發 IMBALANCE_RISING、墊高電池群的最大壓差)
+        if (sample.load_test)
+            analytics.apply(cached_data);
         else
-        {
-            sendFeedback("error", res);
-        }
+            analytics.update(cached_data, t_ms);
+        broadcastStreamSample(cached_data, sample.t_us);
+        recordDynamicSample(cached_data, t_ms);
+    }
+
+    // 5. 串流進行中定期回報達成率、抖動與遺失樣本
+    if (millis() - lastUpdateTick >= STREAM_STATS_EVERY_MS)
+    {
+        lastUpdateTick = millis();
+        if (bmsWorker.streamStats().active)
+            sendStreamStats();
     }
 
     yield();
-}
\ No newline at end of file
+}
@@ -0,0 +1,209 @@
+// test/test_bus_timing/test_main.cpp
+//
+// 主機端測試 (pio test -e native)：GPIO 後端直接以 BusPulse 的時長延遲，
+// RMT 後端把同一份脈衝轉成 rmt_item32_t。兩者的時序必須一致，讀取位元的判定也必須相同。
+
+#include <unity.h>
+#include "OneWireTiming.h"
+
+void setUp() {}
+void tearDown() {}
+
+// RMT 項目必須與 GPIO 後端的脈衝完全相同：先低電位 low_us、再高電位 high_us
+static void assertItemMatchesPulse(const BusPulse &p, uint32_t item)
+{
+    TEST_ASSERT_FALSE(RmtItem::level0(item));
+    TEST_ASSERT_EQUAL_UINT16(p.low_us, RmtItem::duration0(item));
+    TEST_ASSERT_TRUE(RmtItem::level1(item));
+    TEST_ASSERT_EQUAL_UINT16(p.high_us, RmtItem::duration1(item));
+}
+
+// 模擬電池回應一個讀取時槽：“0”時電池在主機釋放後繼續拉低線路
+static uint32_t capturedReadSlot(bool bit, uint16_t hold_low_us)
+{
+    const BusPulse &slot = MakitaTiming::READ_SLOT;
+    uint16_t low = bit ? slot.low_us : hold_low_us;
+    return RmtItem::make(low, false, (uint16_t)(slot.low_us + slot.high_us - low), true);
+}
+
+static void test_item_bit_layout()
+{
+    // 與 rmt_item32_t 相同：duration0 在低 15 位元，level 位於 bit 15 與 bit 31
+    TEST_ASSERT_EQUAL_HEX32(0x00000001u, RmtItem::make(1, false, 0, false));
+    TEST_ASSERT_EQUAL_HEX32(0x00008000u, RmtItem::make(0, true, 0, false));
+    TEST_ASSERT_EQUAL_HEX32(0x00010000u, RmtItem::make(0, false, 1, false));
+    TEST_ASSERT_EQUAL_HEX32(0x80000000u, RmtItem::make(0, false, 0, true));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFFu, RmtItem::make(RmtItem::MAX_DURATION, true, RmtItem::MAX_DURATION, true));
+}
+
+static void test_reset_maps_to_one_item()
+{
+    const BusPulse p = encodeReset();
+    TEST_ASSERT_EQUAL_UINT16(MakitaTiming::RESET_LOW_US, p.low_us);
+    TEST_ASSERT_EQUAL_UINT16(MakitaTiming::PRESENCE_SAMPLE_US + MakitaTiming::RESET_TAIL_US, p.high_us);
+    assertItemMatchesPulse(p, encodeRmtItem(p));
+}
+
+static void test_write_byte_all_values()
+{
+    for (unsigned v = 0; v < 256; v++)
+    {
+        BusPulse pulses[MakitaTiming::BITS_PER_BYTE];
+        TEST_ASSERT_EQUAL(MakitaTiming::BITS_PER_BYTE, encodeWriteByte((uint8_t)v, pulses));
+        for (size_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++)
+        {
+            // LSB 優先
+            const BusPulse &expected = (v >> i) & 1 ? MakitaTiming::WRITE_1 : MakitaTiming::WRITE_0;
+            TEST_ASSERT_EQUAL_UINT16(expected.low_us, pulses[i].low_us);
+            TEST_ASSERT_EQUAL_UINT16(expected.high_us, pulses[i].high_us);
+            assertItemMatchesPulse(pulses[i], encodeRmtItem(pulses[i]));
+        }
+    }
+}
+
+static void test_read_byte_slots()
+{
+    BusPulse slots[MakitaTiming::BITS_PER_BYTE];
+    TEST_ASSERT_EQUAL(MakitaTiming::BITS_PER_BYTE, encodeReadByte(slots));
+    for (const BusPulse &p : slots)
+    {
+        TEST_ASSERT_EQUAL_UINT16(MakitaTiming::READ_SLOT.low_us, p.low_us);
+        TEST_ASSERT_EQUAL_UINT16(MakitaTiming::READ_SLOT.high_us, p.high_us);
+        assertItemMatchesPulse(p, encodeRmtItem(p));
+    }
+}
+
+static void test_decode_read_bit_threshold()
+{
+    // GPIO 後端在釋放後 READ_SAMPLE_US 取樣：低電位持續到取樣點 (含) 即為“0”
+    const uint16_t threshold = MakitaTiming::READ_SLOT.low_us + MakitaTiming::READ_SAMPLE_US;
+    TEST_ASSERT_TRUE(decodeReadBit(MakitaTiming::READ_SLOT.low_us));
+    TEST_ASSERT_TRUE(decodeReadBit(threshold - 1));
+    TEST_ASSERT_FALSE(decodeReadBit(threshold));
+    TEST_ASSERT_FALSE(decodeReadBit(MakitaTiming::READ_SLOT.low_us + MakitaTiming::READ_SLOT.high_us));
+    TEST_ASSERT_TRUE(decodeReadBit(0)); // 擷取不到低電位：線路一直是高電位
+}
+
+static void test_capture_roundtrip_all_values()
+{
+    for (unsigned v = 0; v < 256; v++)
+    {
+        uint32_t items[MakitaTiming::BITS_PER_BYTE];
+        for (size_t i = 0; i < MakitaTiming::BITS_PER_BYTE; i++)
+            items[i] = capturedReadSlot((v >> i) & 1, 45);
+        uint16_t lows[MakitaTiming::BITS_PER_BYTE];
+        TEST_ASSERT_EQUAL(MakitaTiming::BITS_PER_BYTE,
+                          collectLowDurations(items, MakitaTiming::BITS_PER_BYTE, lows, MakitaTiming::BITS_PER_BYTE));
+        TEST_ASSERT_EQUAL_HEX8(v, decodeReadByte(lows));
+    }
+}
+
+static void test_collect_lows_from_both_halves()
+{
+    // 擷取的項目不一定從低電位開始 (例如閒置高電位之後才拉低)
+    const uint32_t items[] = {
+        RmtItem::make(100, true, 750, false),
+        RmtItem::make(70, true, 120, false),
+        RmtItem::make(12, false, 0, true), // duration 0 表示擷取框結束
+    };
+    uint16_t lows[4];
+    TEST_ASSERT_EQUAL(3, collectLowDurations(items, 3, lows, 4));
+    TEST_ASSERT_EQUAL_UINT16(750, lows[0]);
+    TEST_ASSERT_EQUAL_UINT16(120, lows[1]);
+    TEST_ASSERT_EQUAL_UINT16(12, lows[2]);
+    TEST_ASSERT_EQUAL(2, collectLowDurations(items, 3, lows, 2)); // 不超過 max_lows
+}
+
+static void test_presence_detection()
+{
+    const BusPulse reset = encodeReset();
+    // 電池在重置後另外拉低一段
+    uint16_t separate[] = {reset.low_us, 120};
+    TEST_ASSERT_TRUE(capturedPresence(separate, 2, 1));
+    // 存在脈衝緊接重置脈衝，兩段低電位合併
+    uint16_t merged[] = {(uint16_t)(reset.low_us + 120)};
+    TEST_ASSERT_TRUE(capturedPresence(merged, 1, 1));
+    // 沒有電池：只看到主機自己的重置脈衝
+    uint16_t alone[] = {reset.low_us};
+    TEST_ASSERT_FALSE(capturedPresence(alone, 1, 1));
+    TEST_ASSERT_FALSE(capturedPresence(alone, 0, 1));
+    // 擷取不完整 (少於送出的脈衝數)
+    TEST_ASSERT_FALSE(capturedPresence(merged, 1, 2));
+}
+
+// 模擬一次擷取中單一暫存器讀取的低電位區段 (RMT 後端由 collectLowDurations 取得)
+static size_t capturedRegisterRead(uint8_t prefix, uint8_t reg, uint8_t value, int presence, uint16_t *lows)
+{
+    BusPulse pulses[MakitaTiming::REGISTER_READ_PULSES];
+    TEST_ASSERT_EQUAL(MakitaTiming::REGISTER_READ_PULSES, encodeRegisterRead(prefix, reg, pulses));
+    size_t n = 0;
+    // presence：0 沒有電池、1 存在脈衝緊接重置脈衝、2 存在脈衝分開
+    lows[n++] = pulses[0].low_us + (presence == 1 ? 120 : 0);
+    if (presence == 2)
+        lows[n++] = 120;
+    for (size_t i = 1; i < 1 + 2 * MakitaTiming::BITS_PER_BYTE; i++)
+        lows[n++] = pulses[i].low_us;
+    for (size_t b = 0; b < MakitaTiming::BITS_PER_BYTE; b++)
+        lows[n++] = (value >> b) & 1 ? MakitaTiming::READ_SLOT.low_us : 45;
+    return n;
+}
+
+static void test_register_read_sequence()
+{
+    BusPulse pulses[MakitaTiming::REGISTER_READ_PULSES];
+    encodeRegisterRead(0xCC, 0x5A, pulses);
+    TEST_ASSERT_EQUAL_UINT16(encodeReset().low_us, pulses[0].low_us);
+    BusPulse expected[MakitaTiming::BITS_PER_BYTE];
+    encodeWriteByte(0xCC, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, pulses + 1, sizeof(expected));
+    encodeWriteByte(0x5A, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, pulses + 9, sizeof(expected));
+    encodeReadByte(expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, pulses + 17, sizeof(expected));
+
+    // 0xCC 與 0x5A 各有 4 個“1”
+    const uint32_t expected_us = 750 + 480 + 8 * (12 + 120) + 8 * (100 + 30) + 8 * (10 + 63);
+    TEST_ASSERT_EQUAL_UINT32(expected_us, pulseTrainUs(pulses, MakitaTiming::REGISTER_READ_PULSES));
+}
+
+static void test_decode_register_batch()
+{
+    const uint8_t regs[] = {0x8D, 0x8E, 0x8F, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95};
+    const uint8_t values[] = {0x00, 0xFF, 0x01, 0x80, 0x5A, 0xA5, 0x12, 0x00, 0x7E};
+    const int presence[] = {1, 2, 1, 0, 2, 1, 1, 2, 1}; // 第 4 個暫存器沒有回應
+    const size_t count = sizeof(regs);
+    uint16_t lows[count * (MakitaTiming::REGISTER_READ_PULSES + 1)];
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++)
+        found += capturedRegisterRead(0xCC, regs[i], values[i], presence[i], lows + found);
+
+    uint8_t out[count];
+    decodeRegisterReads(lows, found, count, out);
+    for (size_t i = 0; i < count; i++)
+        TEST_ASSERT_EQUAL_HEX8(presence[i] ? values[i] : 0xFF, out[i]);
+
+    // 擷取在第 7 個暫存器中途截斷：之前的結果不受影響，之後全部為 0xFF
+    size_t cut = 0;
+    for (size_t i = 0; i < 6; i++)
+        cut += capturedRegisterRead(0xCC, regs[i], values[i], presence[i], lows + cut);
+    cut += 10;
+    decodeRegisterReads(lows, cut, count, out);
+    for (size_t i = 0; i < count; i++)
+        TEST_ASSERT_EQUAL_HEX8(i < 6 && presence[i] ? values[i] : 0xFF, out[i]);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_item_bit_layout);
+    RUN_TEST(test_reset_maps_to_one_item);
+    RUN_TEST(test_write_byte_all_values);
+    RUN_TEST(test_read_byte_slots);
+    RUN_TEST(test_decode_read_bit_threshold);
+    RUN_TEST(test_capture_roundtrip_all_values);
+    RUN_TEST(test_collect_lows_from_both_halves);
+    RUN_TEST(test_presence_detection);
+    RUN_TEST(test_register_read_sequence);
+    RUN_TEST(test_decode_register_batch);
+    return UNITY_END();
+}
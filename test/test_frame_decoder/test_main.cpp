@@ -0,0 +1,163 @@
+// test/test_frame_decoder/test_main.cpp
+//
+// 主機端測試 (pio test -e native)：以序列埠日誌 (log_hex 的 RAW_33_FULL / RAW_DYN_*) 格式的原始幀
+// 經由 decodeStaticFrame / decodeDynamicFrame 解碼，檢查標準與 F0513 版面的各欄位。
+// 新的實機擷取可直接把日誌行貼進來比對。
+
+#include <unity.h>
+#include <string.h>
+#include "FrameDecoder.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 18V 5.0Ah，2021/07/14 製造，300 次循環，過放 3 次、過載 7 次
+static const char STATIC_DUMP[] =
+    "RAW_33_FULL: 15 07 0E 3A 5C 81 02 9F 00 00 30 04 1B 00 00 00 00 80 02 21 "
+    "00 10 00 00 23 04 00 60 A0 00 0D 1F 00 00 00 C2 13 03 07 00 ";
+// 5 顆電芯 3648-3660mV，25.30°C / 24.85°C
+static const char DYN_STD_DUMP[] =
+    "RAW_DYN_STD: 59 47 42 0E 47 0E 40 0E 4C 0E 44 0E 00 00 E2 09 B5 09 00 00 00 00 00 00 00 00 00 00 00 ";
+// 14.4V 電池：只有 4 顆電芯，第 5 顆的欄位為 0
+static const char DYN_F0513_DUMP[] =
+    "RAW_DYN_F0513: 08 39 42 0E 38 0E 4C 0E 42 0E 00 00 00 00 A2 08 93 08 00 00 00 00 00 00 00 00 00 00 00 ";
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// 解析 "標籤: XX XX ..."，回傳位元組數
+static size_t parseDump(const char *line, uint8_t *out, size_t max)
+{
+    const char *p = strchr(line, ':');
+    p = p ? p + 1 : line;
+    size_t n = 0;
+    while (*p && n < max)
+    {
+        if (*p == ' ')
+        {
+            p++;
+            continue;
+        }
+        int hi = hexDigit(p[0]);
+        int lo = hexDigit(p[1]);
+        TEST_ASSERT_TRUE(hi >= 0 && lo >= 0);
+        out[n++] = (uint8_t)(hi << 4 | lo);
+        p += 2;
+    }
+    return n;
+}
+
+static void test_static_frame()
+{
+    uint8_t frame[StaticLayout::FRAME_LEN];
+    TEST_ASSERT_EQUAL(StaticLayout::FRAME_LEN, parseDump(STATIC_DUMP, frame, sizeof(frame)));
+    const StaticFields s = decodeStaticFrame(frame);
+
+    const uint8_t rom_id[] = {0x15, 0x07, 0x0E, 0x3A, 0x5C, 0x81, 0x02, 0x9F};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(rom_id, s.rom_id, sizeof(rom_id));
+    TEST_ASSERT_EQUAL_UINT8(21, s.prod_year);
+    TEST_ASSERT_EQUAL_UINT8(7, s.prod_month);
+    TEST_ASSERT_EQUAL_UINT8(14, s.prod_day);
+    TEST_ASSERT_EQUAL_UINT8(18, s.voltage_class);    // 0x21 nibble 交換
+    TEST_ASSERT_EQUAL_UINT8(50, s.capacity_deci_ah); // 0x23 nibble 交換
+    TEST_ASSERT_EQUAL_HEX8(0x60, s.status_code);
+    TEST_ASSERT_EQUAL_UINT8(0, s.lock_status);       // 0xA0：只看低 4 位元
+    TEST_ASSERT_EQUAL_UINT16(300, s.charge_cycles);  // C2 13 -> 0x312C & 0x0FFF
+    TEST_ASSERT_EQUAL_UINT8(3, s.over_discharge);
+    TEST_ASSERT_EQUAL_UINT8(7, s.over_load);
+}
+
+static void test_static_lock_codes()
+{
+    uint8_t frame[StaticLayout::FRAME_LEN];
+    parseDump(STATIC_DUMP, frame, sizeof(frame));
+    const struct
+    {
+        uint8_t raw;
+        uint8_t lock_status;
+    } cases[] = {
+        {0x00, 0}, {0xF0, 0}, {0x01, 3}, {0x51, 3}, {0x02, 2}, {0x03, 1}, {0x0F, 1},
+    };
+    for (const auto &c : cases)
+    {
+        frame[StaticLayout::LOCK_CODE.offset] = c.raw;
+        TEST_ASSERT_EQUAL_UINT8(c.lock_status, decodeStaticFrame(frame).lock_status);
+    }
+}
+
+static void test_static_cycles_mask()
+{
+    uint8_t frame[StaticLayout::FRAME_LEN];
+    parseDump(STATIC_DUMP, frame, sizeof(frame));
+    // 36 位元組的低 nibble (交換後為最高位) 不屬於循環次數
+    frame[35] = 0xFF;
+    frame[36] = 0xFF;
+    TEST_ASSERT_EQUAL_UINT16(0x0FFF, decodeStaticFrame(frame).charge_cycles);
+    frame[35] = 0x00;
+    frame[36] = 0x0F;
+    TEST_ASSERT_EQUAL_UINT16(0, decodeStaticFrame(frame).charge_cycles);
+}
+
+static void test_dynamic_standard()
+{
+    constexpr DynamicLayout layout = dynamicLayout<StandardController>();
+    uint8_t frame[StandardController::DYN_FRAME_LEN];
+    TEST_ASSERT_EQUAL(layout.frame_len, parseDump(DYN_STD_DUMP, frame, sizeof(frame)));
+    const DynamicFields d = decodeDynamicFrame(frame, layout);
+
+    const uint16_t cells[] = {3650, 3655, 3648, 3660, 3652};
+    TEST_ASSERT_EQUAL_UINT16(18265, d.pack_mv);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(cells, d.cell_mv, 5);
+    TEST_ASSERT_EQUAL_UINT16(12, d.cell_diff_mv);
+    TEST_ASSERT_EQUAL_UINT16(2530, d.temp1_centi);
+    TEST_ASSERT_EQUAL_UINT16(2485, d.temp2_centi);
+}
+
+static void test_dynamic_f0513_missing_cell()
+{
+    constexpr DynamicLayout layout = dynamicLayout<F0513Controller>();
+    uint8_t frame[F0513Controller::DYN_FRAME_LEN];
+    TEST_ASSERT_EQUAL(layout.frame_len, parseDump(DYN_F0513_DUMP, frame, sizeof(frame)));
+    const DynamicFields d = decodeDynamicFrame(frame, layout);
+
+    const uint16_t cells[] = {3650, 3640, 3660, 3650, 0};
+    TEST_ASSERT_EQUAL_UINT16(14600, d.pack_mv);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(cells, d.cell_mv, 5);
+    // 缺少的電芯 (0mV) 不算入最小值
+    TEST_ASSERT_EQUAL_UINT16(20, d.cell_diff_mv);
+    TEST_ASSERT_EQUAL_UINT16(2210, d.temp1_centi);
+    TEST_ASSERT_EQUAL_UINT16(2195, d.temp2_centi);
+
+    // 未接好的電芯只有數百 mV：同樣不算入最小值
+    frame[layout.cell_mv[4].offset] = 0x2C; // 300mV
+    frame[layout.cell_mv[4].offset + 1] = 0x01;
+    const DynamicFields open = decodeDynamicFrame(frame, layout);
+    TEST_ASSERT_EQUAL_UINT16(300, open.cell_mv[4]);
+    TEST_ASSERT_EQUAL_UINT16(20, open.cell_diff_mv);
+
+    // 門檻本身 (CELL_VALID_MV) 仍視為無效
+    frame[layout.cell_mv[4].offset] = (uint8_t)CELL_VALID_MV;
+    frame[layout.cell_mv[4].offset + 1] = (uint8_t)(CELL_VALID_MV >> 8);
+    TEST_ASSERT_EQUAL_UINT16(20, decodeDynamicFrame(frame, layout).cell_diff_mv);
+
+    // 沒有任何有效電芯：壓差為 0
+    memset(frame + layout.cell_mv[0].offset, 0, 2 * layout.cell_count);
+    TEST_ASSERT_EQUAL_UINT16(0, decodeDynamicFrame(frame, layout).cell_diff_mv);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_static_frame);
+    RUN_TEST(test_static_lock_codes);
+    RUN_TEST(test_static_cycles_mask);
+    RUN_TEST(test_dynamic_standard);
+    RUN_TEST(test_dynamic_f0513_missing_cell);
+    return UNITY_END();
+}
@@ -0,0 +1,254 @@
+// test/test_series_codec/test_main.cpp
+//
+// 主機端測試 (pio test -e native)：時間序列壓縮編碼的往返、varint 邊界、關鍵幀間隔與損毀偵測。
+
+#include <unity.h>
+#include "SeriesCodec.h"
+
+using namespace SeriesCodec;
+
+void setUp() {}
+void tearDown() {}
+
+static uint8_t block[4096];
+
+static BatteryHeader makeHeader()
+{
+    BatteryHeader h;
+    memset(&h, 0, sizeof(h));
+    for (int i = 0; i < 8; i++)
+        h.rom_id[i] = (uint8_t)(0x10 + i);
+    strncpy(h.model, "BL1850B", sizeof(h.model));
+    h.capacity_deci_ah = 50;
+    h.prod_year = 21;
+    h.prod_month = 7;
+    h.prod_day = 14;
+    h.charge_cycles = 300;
+    h.wall_time = 700000000;
+    h.wall_ms = 1234;
+    return h;
+}
+
+// 靜置中緩慢變化的電池，偶爾出現負載造成的跳動
+static Sample makeSample(uint32_t i, uint32_t t0)
+{
+    Sample s;
+    s.t_ms = t0 + i * 100 + (i % 3); // 取樣間隔有少許抖動
+    s.v[CH_PACK_MV] = 19500 - (int32_t)(i / 4);
+    for (int c = CH_CELL1_MV; c <= CH_CELL5_MV; c++)
+        s.v[c] = 3900 - (int32_t)(i / 20) - (i % 17 == 0 ? 250 : 0);
+    s.v[CH_TEMP1_CENTI] = 2500 + (int32_t)(i % 5);
+    s.v[CH_TEMP2_CENTI] = -150; // 負值經 zigzag 編碼
+    s.v[CH_TEMP3_CENTI] = 0;
+    return s;
+}
+
+static void assertSampleEqual(const Sample &expected, const Sample &actual)
+{
+    TEST_ASSERT_EQUAL_UINT32(expected.t_ms, actual.t_ms);
+    TEST_ASSERT_EQUAL_INT32_ARRAY(expected.v, actual.v, CHANNELS);
+}
+
+// 編碼 count 筆樣本 (以標頭開頭)，回傳區塊長度；key_at 記錄每筆是否為關鍵幀
+static size_t encodeSeries(uint32_t count, uint32_t t0, bool *key_at = nullptr)
+{
+    Encoder enc;
+    enc.reset(block, sizeof(block));
+    BatteryHeader h = makeHeader();
+    TEST_ASSERT_TRUE(enc.header(h));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t before = enc.size();
+        TEST_ASSERT_TRUE(enc.sample(makeSample(i, t0)));
+        // 標籤是紀錄的第一個 varint，類型在第一個位元組的低 2 位元
+        if (key_at)
+            key_at[i] = (block[before] & 0x03) == TAG_KEYFRAME;
+    }
+    TEST_ASSERT_EQUAL(count, enc.samples());
+    return enc.size();
+}
+
+static void test_varint_boundaries()
+{
+    const struct
+    {
+        uint32_t value;
+        size_t len;
+    } cases[] = {
+        {0, 1}, {1, 1}, {0x7F, 1},
+        {0x80, 2}, {0x3FFF, 2},
+        {0x4000, 3}, {0x1FFFFF, 3},
+        {0x200000, 4}, {0xFFFFFFF, 4},
+        {0x10000000, 5}, {0xFFFFFFFF, 5},
+    };
+    for (const auto &c : cases)
+    {
+        uint8_t buf[MAX_VARINT_LEN];
+        TEST_ASSERT_EQUAL(c.len, putVarint(buf, c.value));
+        uint32_t v = 0;
+        TEST_ASSERT_EQUAL(c.len, getVarint(buf, c.len, v));
+        TEST_ASSERT_EQUAL_HEX32(c.value, v);
+        // 少一個位元組：資料不足
+        TEST_ASSERT_EQUAL(0, getVarint(buf, c.len - 1, v));
+    }
+
+    // 超過 MAX_VARINT_LEN 仍未結束的 varint 視為錯誤
+    const uint8_t endless[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+    uint32_t v;
+    TEST_ASSERT_EQUAL(0, getVarint(endless, sizeof(endless), v));
+}
+
+static void test_zigzag_boundaries()
+{
+    const int32_t values[] = {0, -1, 1, -2, 63, -64, 64, INT32_MAX, INT32_MIN};
+    for (int32_t v : values)
+        TEST_ASSERT_EQUAL_INT32(v, unzigzag(zigzag(v)));
+    TEST_ASSERT_EQUAL_HEX32(0, zigzag(0));
+    TEST_ASSERT_EQUAL_HEX32(1, zigzag(-1));
+    TEST_ASSERT_EQUAL_HEX32(2, zigzag(1));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, zigzag(INT32_MIN));
+}
+
+static void test_roundtrip()
+{
+    const uint32_t count = 300;
+    size_t len = encodeSeries(count, 5000);
+    // 靜置的電池大多只有溫度/時間抖動，平均每筆遠小於固定長度紀錄 (72 位元組)
+    TEST_ASSERT_LESS_OR_EQUAL(count * 12, len);
+
+    Decoder dec(block, len);
+    BatteryHeader h;
+    Sample s;
+    TEST_ASSERT_EQUAL(Decoder::HEADER, dec.next(h, s));
+    BatteryHeader expected = makeHeader();
+    TEST_ASSERT_EQUAL_MEMORY(expected.rom_id, h.rom_id, 8);
+    TEST_ASSERT_EQUAL_STRING(expected.model, h.model);
+    TEST_ASSERT_EQUAL_UINT32(expected.charge_cycles, h.charge_cycles);
+    TEST_ASSERT_EQUAL_UINT32(expected.wall_time, h.wall_time);
+    TEST_ASSERT_EQUAL_UINT32(expected.wall_ms, h.wall_ms);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        TEST_ASSERT_EQUAL(Decoder::SAMPLE, dec.next(h, s));
+        assertSampleEqual(makeSample(i, 5000), s);
+    }
+    TEST_ASSERT_EQUAL(Decoder::END, dec.next(h, s));
+}
+
+static void test_keyframe_interval()
+{
+    const uint32_t count = 3 * KEYFRAME_EVERY + 5;
+    bool key_at[count];
+    encodeSeries(count, 0, key_at);
+    for (uint32_t i = 0; i < count; i++)
+        TEST_ASSERT_EQUAL(i % KEYFRAME_EVERY == 0, key_at[i]);
+
+    // 新的標頭之後第一筆一定是關鍵幀
+    Encoder enc;
+    enc.reset(block, sizeof(block));
+    BatteryHeader h = makeHeader();
+    TEST_ASSERT_TRUE(enc.header(h));
+    TEST_ASSERT_TRUE(enc.sample(makeSample(0, 0)));
+    TEST_ASSERT_TRUE(enc.sample(makeSample(1, 0)));
+    TEST_ASSERT_TRUE(enc.header(h));
+    size_t before = enc.size();
+    TEST_ASSERT_TRUE(enc.sample(makeSample(2, 0)));
+    TEST_ASSERT_EQUAL(TAG_KEYFRAME, block[before] & 0x03);
+}
+
+static void test_full_block_writes_nothing()
+{
+    uint8_t small[64];
+    Encoder enc;
+    enc.reset(small, sizeof(small));
+    BatteryHeader h = makeHeader();
+    TEST_ASSERT_TRUE(enc.header(h));
+    uint32_t i = 0;
+    while (enc.sample(makeSample(i, 0)))
+        i++;
+    size_t len = enc.size();
+    TEST_ASSERT_FALSE(enc.sample(makeSample(i, 0)));
+    TEST_ASSERT_EQUAL(len, enc.size());
+    TEST_ASSERT_EQUAL(i, enc.samples());
+}
+
+static void test_truncated_block_is_corrupt()
+{
+    size_t len = encodeSeries(10, 0);
+    // 截在最後一筆紀錄中間：之前的樣本仍可解出，之後回報 CORRUPT 而不是 END
+    Decoder dec(block, len - 1);
+    BatteryHeader h;
+    Sample s;
+    TEST_ASSERT_EQUAL(Decoder::HEADER, dec.next(h, s));
+    Decoder::Event ev;
+    uint32_t samples = 0;
+    while ((ev = dec.next(h, s)) == Decoder::SAMPLE)
+        assertSampleEqual(makeSample(samples++, 0), s);
+    TEST_ASSERT_EQUAL(Decoder::CORRUPT, ev);
+    TEST_ASSERT_EQUAL(9, samples);
+
+    // 標頭被截斷
+    Decoder head(block, HEADER_LEN / 2);
+    TEST_ASSERT_EQUAL(Decoder::CORRUPT, head.next(h, s));
+}
+
+static void test_delta_before_keyframe_is_corrupt()
+{
+    uint8_t buf[16];
+    size_t n = putVarint(buf, (1u << CH_PACK_MV) << 2 | TAG_DELTA);
+    n += putVarint(buf + n, zigzag(100));
+    n += putVarint(buf + n, zigzag(-5));
+    BatteryHeader h;
+    Sample s;
+    Decoder dec(buf, n);
+    TEST_ASSERT_EQUAL(Decoder::CORRUPT, dec.next(h, s));
+
+    // 標頭之後、關鍵幀之前的差分幀同樣不可信 (不能沿用前一顆電池的基準)
+    size_t len = encodeSeries(3, 0);
+    Encoder enc;
+    enc.reset(block + len, sizeof(block) - len);
+    BatteryHeader other = makeHeader();
+    TEST_ASSERT_TRUE(enc.header(other));
+    len += enc.size();
+    memcpy(block + len, buf, n);
+    len += n;
+
+    Decoder mixed(block, len);
+    TEST_ASSERT_EQUAL(Decoder::HEADER, mixed.next(h, s));
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL(Decoder::SAMPLE, mixed.next(h, s));
+    TEST_ASSERT_EQUAL(Decoder::HEADER, mixed.next(h, s));
+    TEST_ASSERT_EQUAL(Decoder::CORRUPT, mixed.next(h, s));
+}
+
+static void test_time_wraparound()
+{
+    // millis() 約 49.7 天溢位：差分以無號減法計算，跨越 0 仍須還原原本的時間戳
+    const uint32_t t0 = 0xFFFFFFFF - 250;
+    const uint32_t count = 10;
+    size_t len = encodeSeries(count, t0);
+    Decoder dec(block, len);
+    BatteryHeader h;
+    Sample s;
+    TEST_ASSERT_EQUAL(Decoder::HEADER, dec.next(h, s));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        TEST_ASSERT_EQUAL(Decoder::SAMPLE, dec.next(h, s));
+        assertSampleEqual(makeSample(i, t0), s);
+    }
+    TEST_ASSERT_TRUE(makeSample(count - 1, t0).t_ms < t0); // 確實跨越了溢位
+    TEST_ASSERT_EQUAL(Decoder::END, dec.next(h, s));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_varint_boundaries);
+    RUN_TEST(test_zigzag_boundaries);
+    RUN_TEST(test_roundtrip);
+    RUN_TEST(test_keyframe_interval);
+    RUN_TEST(test_full_block_writes_nothing);
+    RUN_TEST(test_truncated_block_is_corrupt);
+    RUN_TEST(test_delta_before_keyframe_is_corrupt);
+    RUN_TEST(test_time_wraparound);
+    return UNITY_END();
+}